@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+
+namespace k8deployer {
+
+/*! Counts heap allocations.
+ *
+ * The counters are only maintained when the program is built with
+ * `-DWITH_ALLOCATION_COUNTER=ON`, as they replace the global `operator new`.
+ * Otherwise all the methods return 0.
+ */
+struct AllocationCounter {
+    static constexpr bool enabled() noexcept {
+#ifdef K8DEPLOYER_COUNT_ALLOCATIONS
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Allocations done by all threads
+    static uint64_t total() noexcept;
+
+    // Allocations done by the calling thread
+    static uint64_t thisThread() noexcept;
+};
+
+} // ns
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <boost/container/flat_map.hpp>
+
+namespace k8deployer {
+
+/*! Interned string.
+ *
+ * An atom is an index into the process-wide `AtomTable`, which is shared
+ * by all the clusters in the run. Comparing atoms is an integer compare,
+ * and copying them is free. The string is owned by the table, and lives
+ * until the program exits.
+ */
+class Atom {
+public:
+    using id_t = uint32_t;
+
+    /*! Atoms that are interned when the table is created.
+     *
+     * The order must match `wellKnownNames` in Atoms.cpp
+     */
+    enum WellKnown : id_t {
+        EMPTY,
+
+        // Labels
+        APP,
+        K8DEP_DEPLOYMENT,
+        K8DEP_CLUSTER,
+        K8DEP_COMPONENT,
+
+        // Arguments
+        PORT,
+        IMAGE,
+        IMAGE_PULL_POLICY,
+        IMAGE_PULL_SECRETS,
+        IMAGE_PULL_SECRETS_FROM_DOCKER_LOGIN,
+        SERVICE_ACCOUNT_NAME,
+        POD_ARGS,
+        POD_ENV,
+        POD_COMMAND,
+        POD_SCC_ADD,
+        POD_MEMORY,
+        POD_CPU,
+        POD_LIMITS_MEMORY,
+        POD_LIMITS_CPU,
+        POD_REQUESTS_MEMORY,
+        POD_REQUESTS_CPU,
+        TLS_SECRET,
+        TLSSECRET,
+        REPLICAS,
+        DELAY_BEFORE,
+        DELAY_AFTER,
+        DELAY_SEQUENCE,
+        OPEN_IN_BROWSER,
+        SERVICE_ENABLED,
+        SERVICE_TYPE,
+        CONFIG_FROM_FILE,
+        INGRESS_PATHS,
+
+        WELL_KNOWN_COUNT
+    };
+
+    constexpr Atom() noexcept = default;
+    constexpr Atom(WellKnown wk) noexcept : id_{wk} {}
+    constexpr explicit Atom(id_t id) noexcept : id_{id} {}
+
+    /*! Interns `name` in the global table */
+    static Atom intern(std::string_view name);
+
+    /*! Looks up `name` without adding it to the table */
+    static std::optional<Atom> find(std::string_view name);
+
+    constexpr id_t id() const noexcept {
+        return id_;
+    }
+
+    const std::string& str() const;
+
+    constexpr bool operator == (const Atom& o) const noexcept { return id_ == o.id_; }
+    constexpr bool operator != (const Atom& o) const noexcept { return id_ != o.id_; }
+    constexpr bool operator < (const Atom& o) const noexcept { return id_ < o.id_; }
+
+private:
+    id_t id_ = EMPTY;
+};
+
+/*! The table behind the atoms.
+ *
+ * Reads take a shared lock, so lookups from different io-threads
+ * don't serialize. New names take an exclusive lock.
+ */
+class AtomTable {
+public:
+    AtomTable();
+
+    static AtomTable& instance();
+
+    Atom intern(std::string_view name);
+    std::optional<Atom> find(std::string_view name) const;
+    const std::string& str(Atom atom) const;
+    size_t size() const;
+
+private:
+    mutable std::shared_mutex mutex_;
+    // A deque does not move its elements when it grows, so the keys in
+    // `index_` and references returned by `str()` remain valid.
+    std::deque<std::string> names_;
+    std::unordered_map<std::string_view, Atom::id_t> index_;
+};
+
+// Small, sorted vector based maps keyed by atoms.
+template <typename T>
+using atom_map_t = boost::container::flat_map<Atom, T>;
+
+using args_t = atom_map_t<std::string>;
+
+} // ns
@@ -3,6 +3,8 @@
 #include <atomic>
 #include <map>
 #include <mutex>
+#include <set>
+#include <unordered_map>
 
 #include "restc-cpp/restc-cpp.h"
 
@@ -12,10 +14,16 @@
 #include "k8deployer/DataDef.h"
 #include "k8deployer/Kubeconfig.h"
 #include "k8deployer/DnsProvisioner.h"
+#include "k8deployer/Stage.h"
 
 namespace k8deployer {
 
 class Component;
+enum class Kind;
+class DeletionTracker;
+class LogFollower;
+struct PodProjection;
+struct ContainerProjection;
 
 class Cluster
 {
@@ -38,11 +46,19 @@ public:
         return name_;
     }
 
+    size_t id() const noexcept {
+        return id_;
+    }
+
     restc_cpp::RestClient& client() noexcept {
         assert(client_);
         return *client_;
     }
 
+    bool hasClient() const noexcept {
+        return client_ != nullptr;
+    }
+
     std::string getVars() const;
     void setState(State state) {
         state_ = state;
@@ -61,6 +77,16 @@ public:
     std::future<void> execute();
     std::future<void> pendingWork();
 
+    /*! Re-read the definitions and apply the objects that changed.
+     *
+     * Used by the watch command, after the first deployment.
+     * The new component tree replaces the current one.
+     */
+    std::future<void> reconcile();
+
+    // The definition file and other files the components are made from
+    std::vector<std::string> sourceFiles();
+
     bool isExecuting() const noexcept {
         return state_ == State::EXECUTING;
     }
@@ -69,63 +95,128 @@ public:
         return storage_.get();
     }
 
-    std::shared_future<void> getVarsReadyStage() {
-        return vars_ready_;
+    Stage& getVarsReadyStage() {
+        return varsReady_;
     }
 
-    std::shared_future<void> getDefinitionsReady() {
-        return definitions_ready_;
+    Stage& getBasicComponentsReady() {
+        return basicComponentsReady_;
     }
 
-    std::shared_future<void> getBasicComponentsReady() {
-        return basic_components_ready_;
-    }
-
-    std::shared_future<void> getPreparedReady() {
-        return prepared_ready_;
-    }
+    /*! Continue preparing when a stage in another cluster is done.
+     *
+     * `fn` is called from our own io-thread. Our prepare stage is not
+     * complete until all such pending resolutions have run.
+     * If the other stage fails, or don't complete within
+     * `--cluster-dependency-timeout` seconds, our prepare fails.
+     *
+     * Must be called from our io-thread while we are preparing.
+     */
+    void resolveAfter(Stage& stage, const std::string& what, std::function<void()> fn);
 
     auto& getIoService() {
       assert(client_);
       return client_->GetIoService();
     }
 
+    // The other clusters our components depend on. Known when we are prepared.
+    std::set<size_t> clusterDependencies();
+
     // Returns false if there is no such component
     bool addStateListener(const std::string& componentName,
                           const std::function<void (const Component& component)>& fn);
 
     void add(Component *component);
 
+    /*! Get a component by name. Does not take the registry mutex once it is frozen. */
     Component *getComponent(const std::string& name);
 
+    /*! The component with the same kind and name in the tree we replace.
+     *
+     * Only set while reconcile() prepares the new tree. Returns nullptr otherwise.
+     */
+    Component *previousComponent(Kind kind, const std::string& name);
+
+    // True when the components are prepared, and resolveAfter() can no longer be used
+    bool isPrepared() const noexcept {
+        return prepareDone_;
+    }
+
+    /*! Publish a hash index of the components.
+     *
+     * Called when the component tree is prepared. After this, lookups
+     * don't take the registry mutex. Components added later (rare) publish
+     * a new index, and the old one is freed when its last reader is done.
+     */
+    void freezeComponents();
+
     DnsProvisioner *getDns() {
         return dns_.get();
     }
 
     void listenForContainers();
 
+    // Log the critical path of the deployment and write it as a DOT graph
+    void reportCriticalPath();
+
+    DeletionTracker& deletionTracker() noexcept {
+        return *deletionTracker_;
+    }
+
 private:
     using action_fn_t = std::function<std::future<void>()>;
     void loadKubeconfig();
+    // Client for the render command, where we don't connect to the cluster
+    void createOfflineClient();
     void startEventsLoop();
+    void finalizeVariables();
     void readDefinitions();
+    void readDefinitionsWhenReady();
+
+    /*! Runs blocking work, like reading the definitions.
+     *
+     * In fleet mode, `work` runs on Engine::blockingPool(), so it don't
+     * stall the io-thread we share with other clusters. Otherwise it
+     * runs right away. `then` is called from our io-thread with the
+     * exception from `work`, if any.
+     */
+    void runBlocking(std::function<void()> work, std::function<void(std::exception_ptr)> then);
+    // Replace the components with the ones in dataDef_. Called from reconcile().
+    void applyDefinitions(const std::shared_ptr<std::promise<void>>& promise);
+    void afterVariablesOf(std::vector<size_t> clusters, std::function<void()> fn);
+    void prepareComponents();
+    void checkIfPrepared();
+    void failPrepare(std::exception_ptr ex);
     void createComponents();
     void setCmds();
     void parseArgs(const std::string& args);
-    void prepareLogging(const k8api::Pod& pod, const k8api::ContainerStatus& container);
-    void startLogging(const k8api::Pod& pod, const k8api::ContainerStatus& container);
-    void stopLogging(const k8api::Pod& pod, const k8api::ContainerStatus& container);
-    std::filesystem::path logPath(const k8api::Pod& pod, const k8api::ContainerStatus& container);
+    void updateContainers(const PodProjection& pod);
+    void forgetPod(const PodProjection& pod);
+    void prepareLogging(const PodProjection& pod, const ContainerProjection& container);
+    void startLogging(const PodProjection& pod, const ContainerProjection& container);
+    void stopLogging(const PodProjection& pod, const ContainerProjection& container);
+    std::filesystem::path logPath(const PodProjection& pod, const ContainerProjection& container);
     std::pair<std::string, std::string> split(const std::string& str, char ch) const;
 
     State state_{State::INIT};
+    const size_t id_;
     std::string url_;
     std::string name_;
     vars_t variables_;
     std::unique_ptr<DnsProvisioner> dns_;
+    std::unique_ptr<DeletionTracker> deletionTracker_;
     std::promise<void> pendingWork_;
+    using component_index_t = std::unordered_map<std::string, Component *>;
     std::map<std::string, Component *> components_;
+    // Read and replaced with std::atomic_load() / std::atomic_store(). A reader
+    // keeps the index it loaded alive, and an old index is freed when the last
+    // reader is done with it.
+    std::shared_ptr<const component_index_t> frozenComponents_;
     std::shared_ptr<Component> rootComponent_;
+    // Replaced by the last reconcile(). Kept while its removed components are deleted.
+    std::shared_ptr<Component> retiredRoot_;
+    // The tree we replace, while reconcile() prepares the new one
+    Component *previousRoot_ = {};
     std::string kubeconfig_; // Empty for default (no arguments)
     const Config& cfg_;
 
@@ -135,18 +226,21 @@ private:
     std::unique_ptr<ComponentDataDef> dataDef_;
     std::string verb_ = "Executing";
 
-    std::promise<void> vars_ready_pr_;
-    std::promise<void> definitions_ready_pr_;
-    std::promise<void> basic_components_pr_;
-    std::promise<void> prepared_ready_pr_;
+    Stage varsReady_;
+    Stage basicComponentsReady_;
+
+    // Only used from our io-thread
+    std::shared_ptr<std::promise<void>> preparePromise_;
+    size_t pendingResolutions_ = 0;
+    bool prepareDone_ = false;
 
-    std::shared_future<void> vars_ready_{vars_ready_pr_.get_future()};
-    std::shared_future<void> definitions_ready_{definitions_ready_pr_.get_future()};
-    std::shared_future<void> basic_components_ready_{basic_components_pr_.get_future()};
-    std::shared_future<void> prepared_ready_{prepared_ready_pr_.get_future()};
     std::mutex mutex_;
-    std::map<std::string /* container id */, k8api::ContainerStatus /* previous known state*/> knownContainers_;
-    std::map<std::string /* container id */, std::string /* path */> openLogs_;
+
+    // Container logs. Protected by logMutex_.
+    std::mutex logMutex_;
+    std::map<std::string /* ns/pod */, std::map<std::string /* container id */, bool /* started */>> knownContainers_;
+    std::map<std::string /* path */, std::shared_ptr<LogFollower>> openLogs_;
+    std::set<std::string /* path */> loggedPaths_; // Truncated the first time only
     std::shared_ptr<restc_cpp::RestClient> client_;
 };
 
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <functional>
 #include <string>
 #include <memory>
@@ -17,6 +19,9 @@
 #include "k8deployer/Engine.h"
 #include "k8deployer/logging.h"
 #include "k8deployer/DataDef.h"
+#include "k8deployer/Atoms.h"
+#include "k8deployer/Journal.h"
+#include "k8deployer/Profiler.h"
 
 namespace k8deployer {
 
@@ -62,9 +67,13 @@ template <typename T>
 void fileToObject(T& obj, const std::string& pathToFile, const variables_t& vars, bool doExpandVariables = false) {
   const auto json = fileToJson(pathToFile, false,
                                doExpandVariables
-                               ? [&vars] (const std::string& input) {return expandVariables(input, vars);}
+                               ? [&vars] (const std::string& input) {
+                                    Profiler::Scope profile{Profiler::Phase::EXPAND_VARIABLES};
+                                    return expandVariables(input, vars);
+                                 }
                                : input_processor_t{});
 
+    Profiler::Scope profile{Profiler::Phase::DESERIALIZE};
     std::istringstream ifs{json};
     restc_cpp::serialize_properties_t properties;
     properties.ignore_unknown_properties = false;
@@ -112,6 +121,37 @@ port_info_list_t parsePorts(const std::string& ports);
 std::optional<PortInfo> findPort(const port_info_list_t& pil, const std::string& name);
 std::optional<PortInfo> findPort(const port_info_list_t& pil, const uint16_t port);
 
+/*! Typed view of the arguments a component use.
+ *
+ * The arguments are parsed once, when the component is initialized,
+ * so that malformed values are reported for the whole tree before
+ * anything is sent to the cluster. Which fields are parsed depends on
+ * the kind of the component.
+ */
+struct ComponentArgs {
+    // Pods and services
+    port_info_list_t ports;
+
+    // Pods
+    k8api::string_list_t podArgs;
+    k8api::string_list_t podCommand;
+    k8api::env_vars_t podEnv;
+    k8api::string_list_t sccAdd;
+    std::string limitsMemory;
+    std::string limitsCpu;
+    std::string requestsMemory;
+    std::string requestsCpu;
+
+    // Deployments and statefulsets
+    std::optional<size_t> replicas;
+    std::optional<bool> serviceEnabled;
+
+    // All kinds
+    int delayBefore = 0;
+    int delayAfter = 0;
+    int delaySequence = 0;
+};
+
 /*! Tree of components to work with.
  *
  */
@@ -244,6 +284,11 @@ public:
             return name_;
         }
 
+        // Identifies the task in the journal
+        std::string journalKey() const {
+            return component_.name + "/" + name_;
+        }
+
         Component& component() {
             return component_;
         }
@@ -267,6 +312,8 @@ public:
         const std::string name_;
         fn_t fn_; // What this task has to do
         TaskState state_ = TaskState::PRE;
+        std::chrono::steady_clock::time_point stateSince_ = std::chrono::steady_clock::now();
+        std::optional<std::chrono::steady_clock::time_point> pollScheduled_;
         std::unique_ptr<boost::asio::deadline_timer> pollTimer_;
         const Mode mode_ = Mode::CREATE;
     };
@@ -277,7 +324,7 @@ public:
 
     Component(const Component::ptr_t& parent, Cluster& cluster, const ComponentData& data);
 
-    virtual ~Component() = default;
+    virtual ~Component();
 
     // When to execute a child, relative to the parent
     enum class ParentRelation {
@@ -296,17 +343,25 @@ public:
     std::string logName() const noexcept;
 
     std::optional<bool> getBoolArg(const std::string& name) const;
+    std::optional<bool> getBoolArg(Atom name) const;
     std::optional<std::string> getArg(const std::string& name) const;
-    k8api::string_list_t getArgAsStringList(const std::string& values, const std::string& defaultVal) const;
-    k8api::env_vars_t getArgAsEnvList(const std::string& values, const std::string& defaultVal) const;
+    std::optional<std::string> getArg(Atom name) const;
+    k8api::string_list_t getArgAsStringList(Atom name, const std::string& defaultVal) const;
+    k8api::env_vars_t getArgAsEnvList(Atom name, const std::string& defaultVal) const;
     static k8api::string_list_t getArgAsStringList(const std::string& values);
     static k8api::env_vars_t getArgAsEnvList(const std::string& values);
     static k8api::key_values_t getArgAsKv(const std::string& values);
 
     std::string getArg(const std::string& name, const std::string& defaultVal) const;
+    std::string getArg(Atom name, const std::string& defaultVal) const;
     int getIntArg(const std::string& name, int defaultVal) const;
+    int getIntArg(Atom name, int defaultVal) const;
     size_t getSizetArg(const std::string &name, size_t defaultVal) const;
 
+    const ComponentArgs& parsedArgs() const noexcept {
+        return parsedArgs_;
+    }
+
     Cluster& cluster() noexcept {
         assert(cluster_);
         return *cluster_;
@@ -321,18 +376,61 @@ public:
     // Called on the root component
     void prepare();
 
+    /*! Prepare the component and its children.
+     *
+     * With --prepare-threads, the children of a component are prepared in
+     * parallel, after the component itself. So an override may change
+     * this component, read its parents, and add and prepare its own
+     * children, but it must not change any other component. Side effects
+     * outside the tree, like the directories created by the storage
+     * engines, must be serialized.
+     */
     virtual void prepareDeploy();
 
+    // Called on the root component
+    // Serialize the objects for all the components, after prepareDeploy()
+    void renderPayloads();
+
+    // Called on the root component
+    // Write the rendered objects to files below `dir` in stead of applying them
+    std::future<void> writePayloads(const std::string& dir);
+
+    // Called on the root component
+    // Mark the tasks that are done in the journal as DONE, if their objects still exist.
+    // `done` is called from the io-thread when the cluster is checked.
+    void resumeFromJournal(const Journal::states_t& states, std::function<void ()> done);
+
+    // Called on the root component of a new, prepared tree in watch mode
+    // Run the tasks for the components that differ from `previous`, in the
+    // same order as a deployment, with server-side apply in stead of POST.
+    // With --prune, then run the removal tasks for the components that were
+    // removed. Otherwise they are only reported.
+    // Unchanged components that depend on changed workloads are re-probed
+    // when the changed workloads are ready.
+    // `done` is called from the io-thread when all the work is done.
+    void applyChanges(Component& previous, std::function<void (std::exception_ptr)> done);
+
+    // The json we send to create the object. Empty if nothing is rendered.
+    const std::string& payload() const noexcept {
+        return payload_;
+    }
+
     // Called on the root component
     // Let clusters deploy themselfs in parallell
     std::future<void> deploy();
 
     std::future<void> dumpDependencies();
+    void writeDependencies(std::ostream& out);
 
     // Called on the root component
     // Let clusters delete themselfs in parallell
     std::future<void> remove();
 
+    // Called on the root component
+    // Delete all the objects with our k8dep-deployment label, with one
+    // request per collection, in stead of running the removal tasks.
+    std::future<void> fastRemove();
+
     // Called on the root component
     void onEvent(const std::shared_ptr<k8api::Event>& event);
 
@@ -349,6 +447,22 @@ public:
         return children_;
     }
 
+    // Top town invocation of `fn` on eachg component, starting with root
+    void forAllComponents(const std::function<void (Component&)>& fn);
+
+    /*! True if the effective arguments are the same as for `other`.
+     *
+     * The effective arguments are our own, and the default arguments
+     * from us and our parents.
+     */
+    bool hasSameArgs(const Component& other) const;
+
+    const Component *parentPtr() const;
+
+    const std::string& objectName() const noexcept {
+        return objectName_;
+    }
+
     enum class K8ObjectState {
         FAILED,
         DONT_EXIST,
@@ -368,6 +482,11 @@ public:
         return false;
     }
 
+    // Trace track for the probe being started; the journalKey() of the polling task
+    const std::string& probeTrack() const noexcept {
+        return probeTrack_;
+    }
+
     void schedule(std::function<void ()> fn);
     void schedule(std::function<void ()> fn, int afterSeconds);
 
@@ -398,6 +517,33 @@ public:
 
     void addStateListener(const std::function<void (const Component& component)>& fn);
 
+    // Where the time went while the component was executed
+    struct Timeline {
+        enum Timer {
+            DELAY_BEFORE,
+            DELAY_SEQUENCE,
+            DELAY_AFTER
+        };
+
+        std::optional<std::chrono::steady_clock::time_point> started; // No longer blocked (PRE_TIMER or RUNNING)
+        std::optional<std::chrono::steady_clock::time_point> done; // DONE or FAILED
+        std::optional<std::chrono::steady_clock::time_point> tasksDone; // The last of our own tasks was done
+        std::array<double, 3> timers = {}; // Seconds in each timer
+        double probing = 0; // Seconds the tasks waited for the probes to see the object done
+        double pollLatency = 0; // Longest wait for the poll that saw the object ready. An upper bound.
+    };
+
+    const Timeline& timeline() const noexcept {
+        return timeline_;
+    }
+
+    const std::vector<std::weak_ptr<Component>>& dependencies() const noexcept {
+        return dependsOn_;
+    }
+
+    // Seconds our own tasks took in earlier runs, if --history-db knows
+    std::optional<double> estimatedDuration() const;
+
 protected:
     virtual std::string getCreationUrl() const {
         assert(false); // Implement!
@@ -408,6 +554,19 @@ protected:
         return getCreationUrl() + "/" + name;
     };
 
+    // Hostnames we provision in the DNS. They have no k8 object that
+    // fastRemove() can select by label, so it deletes them by name.
+    virtual std::vector<std::string> dnsNames() const {
+        return {};
+    }
+
+    /*! Serialize the object this component creates.
+     *
+     * Called from the worker-threads when the tree is prepared, so it
+     * must not change any other component.
+     */
+    virtual std::string renderPayload();
+
     void addDependenciesRecursively(std::set<Component *>& contains);
     void processEvent(const k8api::Event& event);
 
@@ -433,12 +592,18 @@ protected:
     // Build the DeployTasks list for this component
     tasks_t buildDeployTasks();
 
-    conf_t mergeArgs() const;
+    void mergeArgs();
+    const std::string *findArg(Atom name) const noexcept;
 
     // Get a path to root, where the current node is first in the list
     std::vector<const Component *> getPathToRoot() const;
-    const Component *parentPtr() const;
     void runTasks();
+    // Start the READY tasks that are on the longest paths first, within --max-concurrent-tasks
+    bool startReadyTasks(std::vector<Task *>& ready, size_t limit);
+    // Set the priority of the components from the estimated critical path
+    void prioritizeTasks();
+    // Add the duration of our own tasks to the history
+    void recordDuration();
     bool allTasksAreDone() const noexcept {
         return state_ >= State::DONE;
     }
@@ -459,8 +624,6 @@ protected:
         return state_ >= State::DONE;
     }
 
-    // Top town invocation of `fn` on eachg component, starting with root
-    void forAllComponents(const std::function<void (Component&)>& fn);
     void walkAndExecuteFn(const std::function<void (Component&)>& fn);
 
     virtual void buildDependencies() {}
@@ -472,87 +635,30 @@ protected:
         // Create the json payload here for two reasons:
         //  1) kubernetes don't seem to like chunked bodies for patch payloads
         //  2) We have no guarantee regarding the lifetime of the data object.
-        auto json = toJson(data);
-
-        cluster_->client().Process([this, url, task, json=std::move(json), requestType](auto& ctx) {
-            std::string taskName = "***";
-            if (auto t = task.lock()) {
-                taskName = t->name();
-            }
-            LOG_DEBUG << logName() << "Applying task " << taskName << " to " << url;
-            LOG_TRACE << logName() << "Applying payload for task " << taskName << ": " << json;
-            std::string contentType = "application/json; charset=utf-8";
-            if (requestType == restc_cpp::Request::Type::PATCH) {
-                contentType = "application/merge-patch+json; charset=utf-8";
-            }
-
-            try {
-                auto reply = restc_cpp::RequestBuilder{ctx}.Req(url, requestType)
-                   .Header("Content-Type", contentType)
-                   .Data(json)
-                   .Execute();
-
-                LOG_DEBUG << logName()
-                      << "Applying task " << taskName << " gave response: "
-                      << reply->GetResponseCode() << ' '
-                      << reply->GetHttpResponse().reason_phrase;
-
-                if (auto t = task.lock()) {
-                    if (t->startProbeAfterApply /* && Engine::mode() != Engine::Mode::DELETE*/) {
-                        t->setState(Task::TaskState::WAITING);
-                        t->schedulePoll();
-                    } else {
-                        // Assume that tasks that don't need polling are OK after create.
-                        t->setState(Task::TaskState::DONE);
-                    }
-                }
-
-                return;
-            } catch(const restc_cpp::RequestFailedWithErrorException& err) {
-                if (err.http_response.status_code == 404) {
-                    if (auto t = task.lock()) {
-                        if (t->mode() == Mode::REMOVE) {
-                            LOG_DEBUG << logName()
-                                      << "Applying REMOVE task " << taskName << " to already deleted resource. Probably ok: "
-                                      << err.http_response.status_code << ' '
-                                      << err.http_response.reason_phrase;
-                            t->setState(Task::TaskState::DONE);
-                            return;
-                        }
-                    }
-                }
-
-                if (err.http_response.status_code == 409) {
-                    if (auto t = task.lock()) {
-                        if (t->mode() == Mode::CREATE && t->dontFailIfAlreadyExists) {
-                            LOG_DEBUG << logName()
-                                      << "Applying task " << taskName << " to existing resource. Probably ok: "
-                                      << err.http_response.status_code << ' '
-                                      << err.http_response.reason_phrase;
-                            t->setState(Task::TaskState::DONE);
-                            return;
-                        }
-                    }
-                }
-
-                LOG_WARN << logName()
-                         << "Apply task " << taskName << ": Request failed: " << err.http_response.status_code
-                         << ' ' << err.http_response.reason_phrase
-                         << ": " << err.what();
-
-            } catch(const std::exception& ex) {
-                LOG_WARN << logName()
-                         << "Apply task " << taskName << ": Request failed: " << ex.what();
-            }
-
-            if (auto taskInstance = task.lock()) {
-                taskInstance->setState(Task::TaskState::FAILED);
-            }
-            setState(State::FAILED);
-
-        });
+        sendApplyJson(toJson(data), url, std::move(task), requestType);
     }
 
+    void sendApplyJson(std::string json, const std::string& url, std::weak_ptr<Task> task,
+                       const restc_cpp::Request::Type requestType = restc_cpp::Request::Type::POST);
+
+    // POST `json` to `url`. When applyServerSide_ is set, update or create
+    // the object with kubernetes server-side apply in stead.
+    std::unique_ptr<restc_cpp::Reply> sendCreate(restc_cpp::Context& ctx, const std::string& url,
+                                                 const std::string& json);
+
+    // Called on the root component of the tree that was replaced by applyChanges()
+    // Run the removal tasks for `removed`. The ones that depend on others go first.
+    void removeComponents(const std::vector<Component *>& removed,
+                          std::function<void (std::exception_ptr)> done);
+    void runRemovalTasks();
+
+    // Move the state listeners from `from`, that is replaced by us
+    void takeStateListeners(Component& from);
+
+    // Wait for `componentName` in `cluster`
+    void addClusterDependency(Cluster& cluster, const std::string& depName,
+                              const std::string& componentName);
+
     void sendDelete(const std::string& url, std::weak_ptr<Component::Task> task,
                     bool ignoreErrors = false,
                     const std::initializer_list<std::pair<std::string, std::string>>& args = {});
@@ -568,23 +674,52 @@ protected:
      */
     ptr_t getAppComponent();
 
+    // Account for the time spent waiting for the delay timers
+    void startTimer(Timeline::Timer timer);
+    void stopTimer();
+
     State state_{State::PRE}; // From our logic
+    std::chrono::steady_clock::time_point stateSince_ = std::chrono::steady_clock::now();
+    Timeline timeline_;
+    Timeline::Timer pendingTimer_ = Timeline::DELAY_BEFORE; // The timer we wait for in PRE_TIMER or POST_TIMER
+    std::optional<std::chrono::steady_clock::time_point> timerSince_;
+    double priority_ = 0; // Estimated seconds from we start until the deployment is done
     std::string k8state_; // From the event-loop
     std::weak_ptr<Component> parent_;
     Cluster *cluster_ = {};
     ParentRelation parentRelation_ = ParentRelation::INDEPENDENT;
     Kind kind_ = Kind::APP;
-    conf_t effectiveArgs_;
+    // Our own arguments. pod.args and pod.env include the inherited values.
+    args_t ownArgs_;
+    // defaultArgs from this component and its parents. Shared with the
+    // parent when this component has no defaultArgs of its own.
+    std::shared_ptr<const args_t> defaults_;
+    ComponentArgs parsedArgs_;
+    std::vector<std::string> argErrors_;
+    std::string payload_;
+    std::string objectName_; // metadata.name in the payload
     childrens_t children_;
     std::unique_ptr<tasks_t> tasks_;
     std::unique_ptr<std::promise<void>> executionPromise_;
+    // Called in stead of executionPromise_ when applyChanges() is done
+    std::function<void (std::exception_ptr)> executionDone_;
+    // Set while removeComponents() runs the tasks
+    std::function<void (std::exception_ptr)> removalDone_;
     std::vector<std::weak_ptr<Component>> dependsOn_;
     std::vector<std::unique_ptr<DependencyReference>> clusterDependencies_;
-    std::vector<std::function<void (const Component& component)>> stateListeners_;
+    // Lock-free list of state listeners. Listeners are only added, never
+    // removed, so setState() can walk the list without locking or copying.
+    // takeStateListeners() moves them to the component that replaces us.
+    struct StateListener {
+        std::function<void (const Component& component)> fn;
+        StateListener *next = nullptr;
+    };
+    std::atomic<StateListener *> stateListeners_{nullptr};
     Mode mode_ = Mode::CREATE;
+    bool applyServerSide_ = false; // Set by applyChanges()
+    std::string probeTrack_; // Set by Task::schedulePoll() while it calls probe()
     std::optional<std::chrono::steady_clock::time_point> startTime;
     std::optional<double> elapsed = {};
-    std::mutex mutex_;
     std::optional<bool> delayBeforeTimerExceuted_;
     std::optional<bool> delayAfterTimerExceuted_;
     std::optional<bool> delaySequenceTimerExceuted_;
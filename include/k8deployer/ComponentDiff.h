@@ -0,0 +1,66 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "k8deployer/Component.h"
+
+namespace k8deployer {
+
+/*! The difference between two component trees for the same cluster.
+ *
+ * Components are matched by kind and name. Components with a rendered
+ * payload are updated if the payload changed. Components without one
+ * (like App and HttpRequest) are compared by their effective arguments.
+ *
+ * Unchanged components that wait for the readiness of a workload that
+ * is created or updated, are marked for a new probe.
+ */
+class ComponentDiff
+{
+public:
+    enum class Action {
+        CREATE,
+        UPDATE,
+        DELETE,
+        UNCHANGED,
+        REPROBE
+    };
+
+    struct Entry {
+        Action action = Action::UNCHANGED;
+        Component *current = {}; // nullptr for DELETE
+        Component *previous = {}; // nullptr for CREATE
+    };
+
+    using entries_t = std::vector<Entry>;
+
+    /*! Compute the diff.
+     *
+     * Both must be root components, with rendered payloads. The entries
+     * are in the order of the current tree, followed by the deleted
+     * components in the order of the previous tree.
+     */
+    ComponentDiff(Component& previous, Component& current);
+
+    const entries_t& entries() const noexcept {
+        return entries_;
+    }
+
+    size_t count(Action action) const noexcept {
+        return counts_.at(static_cast<size_t>(action));
+    }
+
+    std::string summary() const;
+
+    static std::string toString(Action action);
+
+private:
+    void add(Action action, Component *current, Component *previous);
+
+    entries_t entries_;
+    std::array<size_t, 5> counts_ = {};
+};
+
+} // ns
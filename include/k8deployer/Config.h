@@ -32,9 +32,42 @@ struct Config {
   std::string logDir;
   std::string logViewer;
   bool wipeLogDir = false;
+  size_t logQueueSize = 4 * 1024 * 1024; // Max bytes queued for each container log
+  std::string logOverflow = "wait"; // wait or drop
+  std::string logCompression = "none"; // none, gzip or zstd
+  size_t logRotateSize = 0; // MB of uncompressed log. 0: Don't rotate by size
+  size_t logRotateSeconds = 0; // 0: Don't rotate by age
+  size_t logKeepSegments = 0; // 0: Keep all
+  bool logStore = false; // Also write the container logs to the time-indexed LogStore
+  std::string logsSince; // For the logs command. RFC3339 or ms since the epoch
+  std::string logsUntil;
+  std::string logsSource; // Regex against cluster/namespace/pod
+  std::string logsGrep; // Regex against the lines
   std::string webBrowser;
   std::string pvcStorageClassName;
   bool ignoreResourceLimits = false;
+  size_t clusterDependencyTimeout = 300; // seconds
+  bool syncStart = false;
+  bool fleetMode = false;
+  size_t fleetThreads = 0; // 0: One per core
+  size_t maxParallelClusters = 0; // 0: Unlimited
+  size_t rolloutCanary = 0;
+  size_t rolloutBatchPercent = 0; // 0: All the remaining clusters in one wave
+  size_t prepareThreads = 0; // 0: One per core, 1: Prepare in the io-thread
+  std::string renderOnly; // Write the rendered objects to this directory in stead of deploying them
+  size_t virtualClusters = 0; // For the render command
+  std::string journalDir;
+  bool resume = false;
+  bool prune = false; // With watch, delete the components removed from the definitions
+  bool fastTeardown = false; // Delete by label, one request per collection
+  size_t deleteTimeout = 600; // Seconds to wait for deleted objects to be gone. 0: Wait forever
+  unsigned metricsPort = 0; // 0: Don't serve the metrics
+  std::string metricsFile; // Write the metrics here when we are done
+  std::string traceFile; // Trace Event Format timeline of the run
+  bool criticalPath = false; // Report the critical path of the deployment
+  std::string historyDb; // Directory for the durations of earlier runs
+  size_t maxConcurrentTasks = 0; // Per cluster. 0: Unlimited
+  bool profile = false; // Log where the time went before the deployments started
 };
 
 } // ns
@@ -18,6 +18,7 @@ protected:
 private:
     void doDeploy(std::weak_ptr<Task> task);
     void doRemove(std::weak_ptr<Task> task);
+    std::string getCreationUrl() const override;
 
     bool prepared_ = false;
 };
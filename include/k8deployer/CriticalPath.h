@@ -0,0 +1,82 @@
+#pragma once
+
+#include <functional>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace k8deployer {
+
+class Component;
+
+/*! Finds the chain of components that bounded the duration of a deployment.
+ *
+ * The graph is made from the dependencies between the components
+ * (`dependsOn_`, and the children that must be done before their parent
+ * starts or is done), and the times recorded in each component's timeline.
+ *
+ * The critical path is found by walking backwards from the component
+ * that was done last, to the predecessor that was done last. The slack
+ * of a component is how much later it could have been done without
+ * delaying the deployment.
+ *
+ * Before a deployment, the same analysis can be made from the estimated
+ * duration of each component. The components are then scheduled as early
+ * as their dependencies allow.
+ */
+class CriticalPath
+{
+public:
+    struct Node {
+        const Component *component = {};
+        double start = 0; // Seconds from the first component started
+        double done = 0;
+        double slack = 0;
+        double latestStart = 0; // The latest it could start without delaying the deployment
+        bool critical = false;
+        bool unknown = false; // No estimate for it
+        std::vector<size_t> startsAfter; // Must be done before this can start
+        std::vector<size_t> doneAfter; // Must be done before this can be done (children)
+    };
+
+    using estimate_t = std::function<std::optional<double> (const Component& component)>;
+
+    // Analyze the recorded timelines of the components in the tree
+    explicit CriticalPath(Component& root);
+
+    // Analyze the estimated durations of the components in the tree. Unknown durations are 0.
+    CriticalPath(Component& root, const estimate_t& estimate);
+
+    const std::vector<Node>& nodes() const noexcept {
+        return nodes_;
+    }
+
+    // The critical path, from the first to the last component
+    const std::vector<size_t>& path() const noexcept {
+        return path_;
+    }
+
+    // Seconds from the first component started until the last was done
+    double total() const noexcept {
+        return total_;
+    }
+
+    // Log a table with the components, in the order they started
+    void report(const std::string& logName) const;
+
+    // The dependencies, annotated with the timings and with the critical path in red
+    void writeDot(std::ostream& out) const;
+
+private:
+    void build(Component& root, const std::function<bool (const Component&)>& include);
+    void schedule(const estimate_t& estimate);
+    void analyze();
+
+    std::vector<Node> nodes_;
+    std::vector<size_t> path_;
+    double total_ = 0;
+    bool estimated_ = false;
+};
+
+} // ns
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace k8deployer {
+
+class Cluster;
+
+/*! Tells when deleted objects are gone from the cluster.
+ *
+ * Objects are tracked by name and uid in their collection. Each
+ * collection with pending objects has one watch for DELETED
+ * notifications. If the watch can't be used, we poll the collection
+ * in stead, with an increasing delay.
+ *
+ * We only list and watch the pending objects: by name when there is
+ * one, and by their deployment label when there are more.
+ */
+class DeletionTracker
+{
+public:
+    // `gone` is false if the object remains after --delete-timeout
+    using done_t = std::function<void (bool gone)>;
+
+    explicit DeletionTracker(Cluster& cluster);
+
+    /*! Call `done` when the object at `url` is gone.
+     *
+     * \param url The url to the object, like the one we sent DELETE to.
+     * \param uid The uid of the object, if known. Then a new object
+     *      with the same name does not count as the old one.
+     * \param selector A label selector that matches the object, if known.
+     * \param done Called from the io-thread.
+     */
+    void track(const std::string& url, std::string uid, std::string selector, done_t done);
+
+private:
+    struct Waiter {
+        std::string name;
+        std::string uid;
+        std::string selector;
+        std::optional<std::chrono::steady_clock::time_point> deadline;
+        done_t done;
+    };
+
+    // The objects we list and watch in a collection
+    struct Query {
+        std::string argument; // fieldSelector or labelSelector. Empty for all the objects.
+        std::string value;
+
+        bool covers(const Waiter& waiter) const;
+    };
+
+    struct Collection {
+        std::vector<Waiter> waiters;
+        // DELETED notifications that arrived before the object was tracked
+        std::map<std::string, std::string> deleted; // name -> uid
+        Query query; // Used by the current list and watch
+        bool stale = false; // A waiter was added that `query` don't cover
+    };
+
+    using existing_t = std::map<std::string, std::string>; // name -> uid
+
+    void watch(const std::string& url);
+    void poll(const std::string& url, std::chrono::milliseconds delay);
+
+    // Fail the waiters that are past their deadline, and select the
+    // objects to list and watch. `timeLeft` is set to the time until the
+    // next deadline, if any. Returns false if there are no waiters left.
+    bool nextQuery(const std::string& url, Query& query,
+                   std::optional<std::chrono::milliseconds>& timeLeft);
+
+    // True if a waiter was added that the current query don't cover
+    bool isStale(const std::string& url);
+
+    // Complete the waiters covered by `query` for objects that are not in `existing`.
+    // Returns the number of waiters left. The collection is no longer
+    // tracked when there are none.
+    size_t completeGone(const std::string& url, const Query& query, const existing_t& existing);
+
+    // Complete the waiter for an object we got a DELETED notification for.
+    // Returns the number of waiters left.
+    size_t completeDeleted(const std::string& url, const std::string& name, const std::string& uid);
+
+    Cluster& cluster_;
+    std::mutex mutex_;
+    std::map<std::string, Collection> collections_;
+};
+
+} // ns
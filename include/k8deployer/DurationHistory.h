@@ -0,0 +1,69 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+
+namespace k8deployer {
+
+/*! How long the components took to become ready in earlier runs.
+ *
+ * Enabled with --history-db. The directory has two files:
+ *
+ *   - `durations.summary`: The statistics for each
+ *     (cluster, component, kind, image), one line per key.
+ *   - `durations.log`: Durations recorded since the summary was written,
+ *     one line per sample:
+ *
+ *         <milliseconds since epoch> <tab> <cluster> <tab> <component> <tab> <kind> <tab> <image> <tab> <seconds>
+ *
+ * When opened, the log is replayed on top of the summary, and both are
+ * compacted into a new summary. compact() does the same when the run is
+ * done, so the log only grows during a run, and an interrupted run
+ * loses nothing.
+ *
+ * Not meant to be shared by k8deployer instances that run at the same time.
+ * The last one to compact wins.
+ */
+class DurationHistory
+{
+public:
+    struct Stats {
+        size_t samples = 0;
+        double average = 0; // Exponentially weighted, so that recent runs count more
+        double last = 0;
+        double max = 0;
+    };
+
+    explicit DurationHistory(const std::filesystem::path& dir);
+
+    DurationHistory(const DurationHistory&) = delete;
+    DurationHistory& operator = (const DurationHistory&) = delete;
+
+    void record(const std::string& cluster, const std::string& component,
+                const std::string& kind, const std::string& image, double seconds);
+
+    std::optional<Stats> get(const std::string& cluster, const std::string& component,
+                             const std::string& kind, const std::string& image) const;
+
+    // Write the summary, and start a new log
+    void compact();
+
+private:
+    static std::string toKey(const std::string& cluster, const std::string& component,
+                             const std::string& kind, const std::string& image);
+    void add(const std::string& key, double seconds);
+    void load();
+    void writeSummary();
+
+    const std::filesystem::path summaryPath_;
+    const std::filesystem::path logPath_;
+    mutable std::mutex mutex_;
+    std::map<std::string, Stats> stats_;
+    std::ofstream log_;
+};
+
+} // ns
@@ -1,10 +1,26 @@
 #pragma once
 
+#include <array>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
 
 #include "restc-cpp/restc-cpp.h"
 #include "k8deployer/Config.h"
 #include "k8deployer/Cluster.h"
+#include "k8deployer/DurationHistory.h"
+#include "k8deployer/IoServicePool.h"
+#include "k8deployer/Journal.h"
+#include "k8deployer/LogWriter.h"
+#include "k8deployer/Metrics.h"
+#include "k8deployer/Profiler.h"
+#include "k8deployer/RolloutController.h"
+#include "k8deployer/Tracer.h"
+#include "k8deployer/WorkerPool.h"
 
 namespace k8deployer {
 
@@ -16,7 +32,17 @@ public:
     enum class Mode {
         DEPLOY,
         DELETE,
-        SHOW_DEPENDENCIES
+        SHOW_DEPENDENCIES,
+        RENDER
+    };
+
+    /*! Thrown by getClusterVar() when the other cluster is still loading its variables. */
+    struct VariablesNotReady : public std::runtime_error {
+        explicit VariablesNotReady(size_t ix)
+            : std::runtime_error{"Variables not ready for cluster" + std::to_string(ix)}
+            , clusterIx{ix} {}
+
+        const size_t clusterIx;
     };
 
     Engine(const Config& config);
@@ -39,17 +65,120 @@ public:
 
     Cluster *getCluster(size_t ix);
 
+    // Shared io-services in fleet mode. nullptr otherwise.
+    IoServicePool *ioPool() noexcept {
+        return ioPool_.get();
+    }
+
+    // Threads for blocking work that must not stall the shared io-threads in fleet mode.
+    // nullptr otherwise.
+    WorkerPool *blockingPool() noexcept {
+        return blockingPool_.get();
+    }
+
+    // Task journal, if enabled. nullptr otherwise.
+    Journal *journal() noexcept {
+        return journal_.get();
+    }
+
+    // Durations from earlier runs, if --history-db is used. nullptr otherwise.
+    DurationHistory *history() noexcept {
+        return history_.get();
+    }
+
+    // Writes the container logs, if --log-dir is used. nullptr otherwise.
+    LogWriter *logWriter() noexcept {
+        return logWriter_.get();
+    }
+
+    // Threads used to prepare components. nullptr if we prepare sequentially.
+    WorkerPool *preparePool() noexcept {
+        return preparePool_.get();
+    }
+
     static std::tuple<bool, size_t, std::string> parseClusterVar(const std::string& name);
 
     std::string getClusterVar(size_t clusterIx, const std::string& varName);
 
+    /*! Look for a dependency cycle through a component.
+     *
+     * Follows the declared `depends` of the components, also across clusters.
+     * Returns the cycle as a readable path if one is found.
+     */
+    std::optional<std::string> findDependencyCycle(size_t clusterIx, const std::string& componentName);
+
+    /*! Wake up run() to look at the clusters again.
+     *
+     * Called after a cluster has completed a phase (prepare, execute or pending work).
+     * May be called from any thread.
+     */
+    static void notifyPhaseDone() noexcept;
+
 private:
+    // Where a cluster is in its life-cycle
+    enum class Phase {
+        STARTING,
+        PREPARING,
+        PREPARED, // Waiting for the rollout controller
+        EXECUTING,
+        PENDING_WORK,
+        DONE,
+        FAILED,
+        SKIPPED
+    };
+
+    struct ClusterRun {
+        explicit ClusterRun(Cluster *c)
+            : cluster{c} {}
+
+        ~ClusterRun() {
+            if (starter.joinable()) {
+                starter.join();
+            }
+        }
+
+        void start(Phase p);
+        void done();
+
+        Cluster *cluster = {};
+        Phase phase = Phase::STARTING;
+        std::future<std::future<void>> starting;
+        std::thread starter; // Runs the synchronous part of prepare()
+        std::future<void> future;
+        std::chrono::steady_clock::time_point started;
+        std::array<double, 3> elapsed = {}; // Seconds in prepare, execute and pending work
+    };
+
+    void runSynchronized();
+    void runPipelined();
+    // The watch command. Returns on SIGINT or SIGTERM, or if there is nothing to watch.
+    void watchForChanges();
+    void reportTimings() const;
+    void reportCriticalPaths() const;
+    void writeMetrics() const;
+    static std::string toString(Phase phase);
     void startPortForwardig();
 
     const Config cfg_;
     static Engine *instance_;
     Mode mode_ = Mode::DEPLOY;
+    bool watch_ = false; // Deploy, then re-apply changes to the files
+    // Declared before the clusters, so it outlives them
+    std::unique_ptr<Metrics> metrics_;
+    std::unique_ptr<Tracer> tracer_;
+    std::unique_ptr<Profiler> profiler_;
+    std::unique_ptr<Journal> journal_;
+    std::unique_ptr<DurationHistory> history_;
+    std::unique_ptr<LogWriter> logWriter_;
     std::vector<std::unique_ptr<Cluster>> clusters_;
+    std::deque<ClusterRun> runs_;
+    std::mutex phaseMutex_;
+    std::condition_variable phaseDone_;
+    uint64_t phaseGeneration_ = 0; // Incremented by notifyPhaseDone()
+    std::unique_ptr<IoServicePool> ioPool_;
+    std::unique_ptr<RolloutController> rollout_;
+    std::unique_ptr<WorkerPool> preparePool_;
+    std::unique_ptr<WorkerPool> blockingPool_;
 };
 
 } // ns
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <set>
+#include <string>
+
+namespace k8deployer {
+
+/*! Waits for changes to a set of files, using inotify.
+ *
+ * We watch the directories, not the files, as most editors save
+ * by writing a new file and renaming it over the old one.
+ */
+class FileWatcher
+{
+public:
+    FileWatcher();
+    ~FileWatcher();
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator = (const FileWatcher&) = delete;
+
+    // Start watching the file, if we don't already do that
+    void add(const std::string& path);
+
+    /*! Make wait() return when SIGINT or SIGTERM is received.
+     *
+     * The previous signal handlers are restored when the watcher is
+     * destroyed. Only one watcher can do this at the time.
+     */
+    void stopOnSignals();
+
+    /*! Block until one or more of the files are changed.
+     *
+     * When something changed, waits until there has been no changes for
+     * `settle` before it returns, so that an editor that saves in several
+     * steps is seen as one change.
+     *
+     * \return The paths that changed, as given to add(). Empty if we
+     *      got a signal after stopOnSignals().
+     */
+    std::set<std::string> wait(std::chrono::milliseconds settle = std::chrono::milliseconds{100});
+
+private:
+    void readEvents(std::set<std::string>& changed);
+
+    void restoreSignals();
+
+    int fd_ = -1;
+    bool handlingSignals_ = false;
+    std::map<int, std::string> dirs_; // watch-descriptor -> directory
+    std::map<std::string, std::string> files_; // absolute path -> path as given
+};
+
+} // ns
@@ -26,6 +26,7 @@ private:
     void doDeploy(std::weak_ptr<Task> task);
     void doRemove(std::weak_ptr<Task> task);
     std::string getCreationUrl() const override;
+    std::vector<std::string> dnsNames() const override;
     std::string loadBalancerIp_;
 };
 
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+namespace k8deployer {
+
+/*! A fixed number of io-services, each run by one thread.
+ *
+ * Used in fleet mode, where the clusters share the pool instead of
+ * having a RestClient with its own thread each. Each cluster is bound
+ * to one io-service, so all the work for a cluster still happens
+ * in one thread, in order.
+ */
+class IoServicePool
+{
+public:
+    // 0 threads means one per core
+    explicit IoServicePool(size_t numThreads);
+    ~IoServicePool();
+
+    IoServicePool(const IoServicePool&) = delete;
+    IoServicePool& operator = (const IoServicePool&) = delete;
+
+    /*! Get an io-service for a cluster. Round robin. */
+    boost::asio::io_service& next();
+
+    size_t size() const noexcept {
+        return workers_.size();
+    }
+
+    /*! Stop all the io-services and wait for the threads to finish */
+    void stop();
+
+private:
+    struct Worker {
+        boost::asio::io_service ios;
+        std::optional<boost::asio::io_service::work> work;
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::atomic_size_t next_{0};
+};
+
+} // ns
@@ -34,6 +34,7 @@ protected:
 
     void doDeploy(std::weak_ptr<Task> task) override;
     void doRemove(std::weak_ptr<Task> task) override;
+    std::string getCreationUrl() const override;
 };
 
 } // ns
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace k8deployer {
+
+/*! Append-only journal of the task state changes for each cluster.
+ *
+ * Used to resume a deployment that was interrupted. Each cluster has
+ * its own file, `<dir>/<cluster>.journal`, with one line per change:
+ *
+ *     <milliseconds since epoch> <tab> <component>/<task> <tab> <state>
+ *
+ * `record()` only queues the entry. A background thread writes the
+ * queued entries in batches and calls fdatasync() on the file, so the
+ * io-threads are never blocked on the disk.
+ */
+class Journal
+{
+public:
+    // Last known state for each <component>/<task>
+    using states_t = std::map<std::string, std::string>;
+
+    /*! Constructor
+     *
+     * \param dir Directory for the journal files
+     * \param append Append to existing journals in stead of truncating them
+     */
+    Journal(const std::string& dir, bool append);
+    ~Journal();
+
+    Journal(const Journal&) = delete;
+    Journal& operator = (const Journal&) = delete;
+
+    void record(const std::string& cluster, std::string key, std::string state);
+
+    // Reads the journal for the cluster. Returns an empty map if there is none.
+    states_t load(const std::string& cluster) const;
+
+private:
+    struct Entry {
+        std::string cluster;
+        std::string line;
+    };
+
+    void run();
+    void write(std::vector<Entry>& entries);
+    std::string path(const std::string& cluster) const;
+
+    const std::string dir_;
+    const bool append_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<Entry> pending_;
+    bool done_ = false;
+    std::map<std::string, int> files_; // Only used by the writer thread
+    std::thread thread_;
+};
+
+} // ns
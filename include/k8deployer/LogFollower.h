@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "restc-cpp/restc-cpp.h"
+
+#include "k8deployer/LogWriter.h"
+#include "k8deployer/k8/k8api.h"
+
+namespace k8deployer {
+
+class Cluster;
+
+/*! Follows the log of a container, and writes it with the LogWriter.
+ *
+ * We ask for timestamps, and remember the last one we got. If the
+ * stream drops, we reconnect with `sinceTime` and skip the lines we
+ * already have. If the container is restarted, we get the rest of the
+ * log from the previous instance with `previous=true`, and then go on
+ * with the new instance in the same log-file.
+ *
+ * The follower ends when the pod is gone, or the container terminated
+ * without being restarted.
+ *
+ * With --log-store, the lines are also written with their time to the
+ * LogStore file for the log.
+ */
+class LogFollower : public std::enable_shared_from_this<LogFollower>
+{
+public:
+    struct Target {
+        std::string ns;
+        std::string pod;
+        std::string container;
+        std::string containerId;
+        std::filesystem::path path;
+        bool truncate = false;
+    };
+
+    using done_t = std::function<void ()>;
+
+    LogFollower(Cluster& cluster, Target target, done_t onDone);
+
+    // Starts a coroutine that follows the log
+    void start();
+
+    // The container is no longer running. Don't wait for it to come back.
+    void stop() noexcept {
+        stopped_ = true;
+    }
+
+    const Target& target() const noexcept {
+        return target_;
+    }
+
+private:
+    void run(restc_cpp::Context& ctx);
+
+    // Returns true if we got any new lines
+    bool follow(restc_cpp::Context& ctx, bool previous);
+    void write(restc_cpp::Context& ctx, LogWriter::Stream& stream, std::string_view data);
+    // Write a line to the log, and the store if we use it
+    void writeLine(restc_cpp::Context& ctx, std::string_view line);
+    /* Append the new lines in `data` to `out`, without their timestamps,
+     * and to `records` as LogStore records if we use the store.
+     */
+    void processLines(std::string_view data, std::string& out, std::string& records);
+    void addLine(std::string_view line, std::string& out, std::string& records);
+    std::optional<k8api::ContainerStatus> getStatus(restc_cpp::Context& ctx, bool& podExists);
+    void sleep(restc_cpp::Context& ctx, std::chrono::milliseconds duration);
+    void resetPosition();
+
+    Cluster& cluster_;
+    Target target_;
+    done_t onDone_;
+    LogWriter::stream_t out_;
+    LogWriter::stream_t store_; // nullptr if we don't use the LogStore
+    uint64_t lastMs_ = 0; // Time of the last line, for the store
+    std::atomic_bool stopped_{false};
+
+    // Position in the log of the current container instance
+    std::string lastTimestamp_; // As we got it from the server, for `sinceTime`
+    std::string lastKey_; // Normalized, so it can be compared
+    size_t linesAtLastKey_ = 0; // Lines we have written with the last timestamp
+    size_t skipAtLastKey_ = 0; // Lines with the last timestamp to skip after a reconnect
+    std::string partial_; // Incomplete line from the last chunk
+};
+
+} // ns
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/uio.h>
+
+namespace k8deployer {
+
+/*! One file of a container log, optionally compressed.
+ *
+ * Compressed segments are written as one gzip member (or zstd frame)
+ * each time the segment is opened, so a file that is appended to later
+ * is still a valid gzip (or zstd) file.
+ */
+class LogSegment
+{
+public:
+    enum class Compression {
+        NONE,
+        GZIP,
+        ZSTD
+    };
+
+    virtual ~LogSegment();
+
+    LogSegment(const LogSegment&) = delete;
+    LogSegment& operator = (const LogSegment&) = delete;
+
+    /*! Open a segment for append.
+     *
+     * Throws std::runtime_error if the file can't be opened, or the
+     * compression is not supported by this build.
+     */
+    static std::unique_ptr<LogSegment> open(const std::filesystem::path& path, Compression compression);
+
+    // Returns false on error. Then the segment should not be used anymore.
+    virtual bool write(const std::vector<iovec>& iov) = 0;
+
+    // Make what is written so far readable from the file.
+    virtual bool flush() {
+        return true;
+    }
+
+    // Complete the segment. Called once before the segment is deleted.
+    virtual bool finish() {
+        return true;
+    }
+
+    const std::filesystem::path& path() const noexcept {
+        return path_;
+    }
+
+    // File name extension for the compression, like ".gz"
+    static std::string extension(Compression compression);
+    static Compression toCompression(const std::string& name);
+
+protected:
+    LogSegment(const std::filesystem::path& path);
+    bool writeAll(const void *data, size_t bytes);
+
+    const std::filesystem::path path_;
+    int fd_ = -1;
+};
+
+} // ns
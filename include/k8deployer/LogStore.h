@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace k8deployer {
+
+/*! Time-indexed copy of the container logs, and queries over it.
+ *
+ * With --log-store, each container log `<log-dir>/<cluster>/<ns>/<pod>.log`
+ * also gets a `<pod>.tlog`, where each line starts with the time it was
+ * logged (from the cluster), as 13 digits of milliseconds since the epoch,
+ * and a space. The cluster, namespace, pod and container of the lines are
+ * given by the path of the file.
+ *
+ * `<pod>.tlog.index` is a sparse index with a line for each 64 KB or so:
+ *
+ *     <ms of the first line at the offset> <tab> <offset>
+ *
+ * When the logs are rotated, the store is written to segments like
+ * `<pod>.tlog.000001`, each with its own index. --log-keep-segments
+ * removes the oldest ones.
+ *
+ * A query seeks to the start of the time range in each matching file,
+ * and merges the lines from all of them in time order.
+ */
+class LogStore
+{
+public:
+    struct Query {
+        uint64_t fromMs = 0;
+        uint64_t toMs = std::numeric_limits<uint64_t>::max();
+        std::string source; // Regex against "<cluster>/<ns>/<pod>[_container]"
+        std::string grep; // Regex against the log lines
+    };
+
+    explicit LogStore(std::filesystem::path root);
+
+    // Write the lines matching the query to `out`. Returns the number of lines.
+    size_t query(const Query& query, std::ostream& out) const;
+
+    // The store file for a container log
+    static std::filesystem::path storePath(const std::filesystem::path& logPath);
+
+    // Append a line (that ends with a newline) to `out` as a record
+    static void addRecord(uint64_t ms, std::string_view line, std::string& out);
+
+    // Parse a RFC3339 time, like "2021-03-04T05:06:07.123456789Z". Returns 0 if it's invalid.
+    static uint64_t toMs(std::string_view time);
+
+    // Parse a time from the command line: RFC3339 or milliseconds since the epoch
+    static uint64_t parseTime(const std::string& time);
+
+    static std::string formatTime(uint64_t ms);
+
+    // Bytes between the entries in the sparse index
+    static constexpr size_t indexInterval = 64 * 1024;
+
+private:
+    const std::filesystem::path root_;
+};
+
+} // ns
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "k8deployer/LogSegment.h"
+
+namespace k8deployer {
+
+/*! Writes the container logs to disk from a thread of its own.
+ *
+ * The io-threads only copy the data they receive into the queue for the
+ * stream. The writer thread writes everything that is queued for a
+ * stream with one writev() call, so the io-threads that also process
+ * the events and replies never wait for the disk.
+ *
+ * Each stream can have at most `maxQueued` bytes queued. When a stream
+ * is full, the data is either dropped (and a note about it written to
+ * the log), or the caller is asked to try again later.
+ *
+ * The logs can be compressed, and rotated by size or age. Then the log
+ * for `pod.log` is written to segments, like `pod.log.000001.gz`, and
+ * `pod.log.index` gets a line for each completed segment:
+ *
+ *     <segment file name> <tab> <offset> <tab> <bytes> <tab> <first ms> <tab> <last ms>
+ *
+ * The offset and size are for the uncompressed log, so a tool can find
+ * the segment with a position or time without decompressing the others.
+ * Segments removed because of `keepSegments` are removed from the index.
+ *
+ * Streams opened with `timeIndexed` are for the LogStore. They are never
+ * compressed, and get a sparse time index. When the logs are rotated,
+ * they are rotated the same way, to segments like `pod.tlog.000001`,
+ * each with its own time index in `pod.tlog.000001.index`.
+ */
+class LogWriter
+{
+public:
+    enum class Overflow {
+        WAIT,
+        DROP
+    };
+
+    struct Options {
+        size_t maxQueued = 4 * 1024 * 1024;
+        Overflow overflow = Overflow::WAIT;
+        LogSegment::Compression compression = LogSegment::Compression::NONE;
+        size_t rotateBytes = 0; // Uncompressed. 0: Don't rotate by size
+        std::chrono::seconds rotateAge{0}; // 0: Don't rotate by age
+        size_t keepSegments = 0; // 0: Keep all
+    };
+
+    class Stream;
+    using stream_t = std::shared_ptr<Stream>;
+
+    explicit LogWriter(const Options& options);
+    ~LogWriter();
+
+    LogWriter(const LogWriter&) = delete;
+    LogWriter& operator = (const LogWriter&) = delete;
+
+    /*! Start a log.
+     *
+     * The file is opened for append by the writer thread. If `truncate`
+     * is true, the existing log (including any segments) is deleted first.
+     *
+     * If `timeIndexed` is true, the data must be LogStore records, and
+     * each write() must start with a new record.
+     */
+    stream_t open(const std::filesystem::path& path, bool truncate = false, bool timeIndexed = false);
+
+    /*! Queue data for the stream.
+     *
+     * Data larger than the queue limit is accepted when nothing else
+     * is queued for the stream.
+     *
+     * \return false if the stream is full and the policy is to wait.
+     *      The caller must then call write() again with the same data
+     *      a little later.
+     */
+    bool write(Stream& stream, std::string_view data);
+
+    // Write what is queued, and close the file.
+    void close(const stream_t& stream);
+
+    static Overflow toOverflow(const std::string& name);
+
+private:
+    void run();
+    void flush(Stream& stream, std::vector<std::string>& chunks);
+    void openSegment(Stream& stream);
+    void openTimeIndexedSegment(Stream& stream);
+    // Delete a segment, and its line in the index
+    void removeSegment(const Stream& stream, size_t number);
+    void addToTimeIndex(Stream& stream, std::string_view chunk, uint64_t offset);
+    bool needsRotation(const Stream& stream) const;
+    bool usesSegments(const Stream& stream) const noexcept;
+    bool rotates(const Stream& stream) const noexcept;
+    std::filesystem::path segmentPath(const Stream& stream, size_t number) const;
+
+    const Options options_;
+    const size_t maxQueued_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<stream_t> ready_; // Streams with queued data
+    std::vector<std::string> spare_; // Written chunks, for reuse
+    std::vector<stream_t> unflushed_; // Compressed data not yet flushed. Writer thread only.
+    bool done_ = false;
+    std::thread thread_;
+};
+
+} // ns
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "restc-cpp/restc-cpp.h"
+
+namespace k8deployer {
+
+class Tracer;
+
+/*! Counters, gauges and histograms for a run, in the Prometheus text format.
+ *
+ * Enabled with --metrics-port, which serves them on
+ * http://127.0.0.1:<port>/metrics while we run, and/or --metrics-file,
+ * which writes them as a node-exporter textfile when the run is done.
+ *
+ * The metric families are declared in Metrics.cpp. Using a name that
+ * is not declared there is a bug, and throws std::logic_error.
+ */
+class Metrics
+{
+public:
+    using labels_t = std::initializer_list<std::pair<std::string_view, std::string_view>>;
+
+    /*! Counts one API request, and its duration.
+     *
+     * Create it before the request, and call status() when the reply
+     * (or an error reply) is received. If status() is not called, the
+     * request is counted with status "error". The request is also added
+     * to the trace, on the track for the component, or the track set
+     * with track(). Does nothing if
+     * neither the metrics nor the trace are enabled.
+     */
+    class ApiCall {
+    public:
+        ApiCall(const std::string& cluster, std::string_view verb, std::string_view kind,
+                std::string_view component = {});
+        ~ApiCall();
+
+        ApiCall(const ApiCall&) = delete;
+        ApiCall& operator = (const ApiCall&) = delete;
+
+        void status(unsigned code);
+
+        // Name of the span in the trace, in stead of "<verb> <kind>"
+        void traceAs(std::string_view name) {
+            traceName_ = name;
+        }
+
+        // Track in the trace, like the journalKey() of the task that makes
+        // the request, so the span nests in the state spans for the task.
+        void track(std::string_view track) {
+            if (!track.empty()) {
+                track_ = track;
+            }
+        }
+
+    private:
+        void record(std::string_view status);
+
+        Metrics *metrics_ = {};
+        Tracer *tracer_ = {};
+        std::string cluster_;
+        std::string verb_;
+        std::string kind_;
+        std::string track_;
+        std::string traceName_;
+        std::chrono::steady_clock::time_point started_;
+    };
+
+    Metrics();
+    ~Metrics();
+
+    Metrics(const Metrics&) = delete;
+    Metrics& operator = (const Metrics&) = delete;
+
+    // The metrics for this run. nullptr if they are disabled.
+    static Metrics *instance() noexcept;
+
+    void inc(std::string_view name, labels_t labels, double value = 1.0);
+    void add(std::string_view name, labels_t labels, double delta);
+    void set(std::string_view name, labels_t labels, double value);
+    void observe(std::string_view name, labels_t labels, double value);
+
+    // All the metrics, in the Prometheus text exposition format
+    std::string render() const;
+
+    // Write the metrics to a file. The file is replaced atomically.
+    void writeTextfile(const std::filesystem::path& path) const;
+
+    // Serve the metrics over HTTP on the loopback interface from a thread of its own
+    void serve(uint16_t port);
+
+    static std::string_view toVerb(restc_cpp::Request::Type type) noexcept;
+
+private:
+    struct Series {
+        double value = 0;
+        std::vector<uint64_t> buckets; // Histograms. Not cumulative.
+        double sum = 0;
+        uint64_t count = 0;
+    };
+
+    struct Family;
+    struct Server;
+
+    static const Family& family(std::string_view name);
+    Series& series(const Family& family, labels_t labels);
+
+    mutable std::mutex mutex_;
+    std::map<std::string, std::map<std::string /* labels */, Series>, std::less<>> series_;
+    std::unique_ptr<Server> server_;
+};
+
+} // ns
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+namespace k8deployer {
+
+/*! Where the time goes before a cluster starts to deploy.
+ *
+ * Enabled with --profile. The phases are timed with Profiler::Scope,
+ * and a summary is logged when the run is done, for all the clusters
+ * and for each cluster.
+ *
+ * CPU time and allocations are counted for the thread that runs the
+ * phase. Work done by --prepare-threads for a phase is in its wall time
+ * only. The CPU time for a yaml subprocess is taken from its own
+ * resource usage when it is reaped, see Scope::addChildCpu(). Allocations are only
+ * counted in builds with WITH_ALLOCATION_COUNTER=ON.
+ *
+ * Phases can run inside other phases, like the yaml subprocess in
+ * the kubeconfig phase. The wall time of the outer phase includes the
+ * inner one.
+ */
+class Profiler
+{
+public:
+    enum class Phase {
+        KUBECONFIG,
+        YAML,
+        CONNECT,
+        READ_DEFINITIONS,
+        EXPAND_VARIABLES,
+        DESERIALIZE,
+        POPULATE_TREE,
+        PREPARE,
+        PREPARE_TASKS,
+        SCAN_DEPENDENCIES,
+        DIFF,
+        COUNT_ // Must be last
+    };
+
+    /*! Times a phase from it is constructed until it is destroyed.
+     *
+     * If `cluster` is empty, the phase belongs to the cluster of the
+     * closest enclosing Scope in this thread. Does nothing if the
+     * profiler is disabled.
+     */
+    class Scope {
+    public:
+        explicit Scope(Phase phase, const std::string& cluster = {});
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator = (const Scope&) = delete;
+
+        // Add the CPU seconds used by a child process we ran in the phase
+        void addChildCpu(double seconds) noexcept {
+            childrenCpu_ += seconds;
+        }
+
+    private:
+        Profiler *profiler_ = {};
+        Phase phase_ = Phase::KUBECONFIG;
+        std::string cluster_;
+        const std::string *outerCluster_ = {};
+        std::chrono::steady_clock::time_point started_;
+        double cpu_ = 0;
+        double childrenCpu_ = 0;
+        uint64_t allocations_ = 0;
+    };
+
+    Profiler();
+    ~Profiler();
+
+    Profiler(const Profiler&) = delete;
+    Profiler& operator = (const Profiler&) = delete;
+
+    // The profiler for this run. nullptr if --profile is not used.
+    static Profiler *instance() noexcept;
+
+    // Called before each API request that changes something. Only the first one for the cluster counts.
+    void onWrite(const std::string& cluster);
+
+    void report() const;
+
+    static std::string_view toString(Phase phase) noexcept;
+
+private:
+    struct Stats {
+        size_t count = 0;
+        double wall = 0;
+        double cpu = 0;
+        uint64_t allocations = 0;
+    };
+
+    struct ClusterStats {
+        std::array<Stats, static_cast<size_t>(Phase::COUNT_)> phases;
+        double firstWrite = -1; // Seconds from the start of the run. -1 if none was sent.
+    };
+
+    void add(const std::string& cluster, Phase phase, const Stats& stats);
+    void report(const std::string& title, const ClusterStats& stats, std::string_view firstWrite) const;
+
+    const std::chrono::steady_clock::time_point started_ = std::chrono::steady_clock::now();
+    mutable std::mutex mutex_;
+    std::map<std::string, ClusterStats> clusters_;
+};
+
+} // ns
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <chrono>
+#include <set>
+#include <vector>
+
+#include "k8deployer/Config.h"
+
+namespace k8deployer {
+
+/*! Decides when the clusters can start to execute.
+ *
+ * The clusters are split into waves: first the canary clusters, then
+ * batches of a percentage of the clusters. A wave starts when all the
+ * clusters in the previous wave have executed (their root components
+ * are DONE). If any cluster in a wave fails, no further waves are started.
+ *
+ * Within a wave, at most `--max-parallel-clusters` clusters execute at
+ * the same time.
+ *
+ * Clusters can only depend on clusters in the same or earlier waves.
+ * checkDependencies() enforces that before a cluster starts, so it does
+ * not hold a slot while it waits for a cluster that can not start.
+ *
+ * Not thread-safe. Only used from the thread running `Engine::run()`.
+ */
+class RolloutController
+{
+public:
+    RolloutController(const Config& cfg, size_t numClusters);
+
+    /*! True if waves or a concurrency limit is configured */
+    bool enabled() const noexcept {
+        return enabled_;
+    }
+
+    /*! True if the cluster can start to execute now */
+    bool mayStart(size_t clusterIx);
+
+    /*! Check the cross-cluster dependencies of a prepared cluster against the plan.
+     *
+     * Throws if the cluster depends on a cluster in a later wave. With
+     * --max-parallel-clusters, it also throws if the clusters in the wave
+     * that depend on other clusters in the wave could hold all the slots.
+     * Called once for each cluster, before it can start.
+     */
+    void checkDependencies(size_t clusterIx, const std::set<size_t>& dependsOn);
+
+    void onStarted(size_t clusterIx);
+
+    /*! Called when a cluster is done executing, or failed before it started */
+    void onDone(size_t clusterIx, bool success);
+
+    /*! True if a wave failed, and the remaining clusters should be skipped */
+    bool aborted() const noexcept {
+        return aborted_;
+    }
+
+    /*! True if the cluster is in a wave that will never start */
+    bool isSkipped(size_t clusterIx) const;
+
+    void report() const;
+
+private:
+    using clock_t = std::chrono::steady_clock;
+
+    struct Wave {
+        std::vector<size_t> clusters;
+        size_t done = 0;
+        size_t failed = 0;
+        size_t waiting = 0; // Clusters that depend on other clusters in the wave
+        bool started = false;
+        clock_t::time_point startTime;
+        clock_t::time_point endTime;
+
+        bool isFinished() const noexcept {
+            return done + failed == clusters.size();
+        }
+    };
+
+    void advance();
+    size_t waveOf(size_t clusterIx) const;
+
+    bool enabled_ = false;
+    bool aborted_ = false;
+    size_t maxParallel_ = 0; // 0: unlimited
+    size_t running_ = 0;
+    size_t current_ = 0;
+    std::vector<Wave> waves_;
+    std::vector<size_t> clusterWave_;
+    std::vector<bool> started_;
+    clock_t::time_point startTime_ = clock_t::now();
+};
+
+} // ns
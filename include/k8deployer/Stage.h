@@ -0,0 +1,57 @@
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace k8deployer {
+
+/*! A one-shot milestone, like "the variables for a cluster are ready".
+ *
+ * Unlike a std::shared_future, a stage lets other clusters attach a
+ * continuation instead of blocking their io-thread while they wait.
+ */
+class Stage
+{
+public:
+    // Gets a nullptr on success, or the reason the stage failed
+    using cb_t = std::function<void (std::exception_ptr)>;
+
+    Stage() = default;
+    Stage(const Stage&) = delete;
+    Stage& operator = (const Stage&) = delete;
+
+    void setReady();
+    void setFailed(std::exception_ptr ex);
+
+    bool isDone() const;
+    bool isReady() const;
+
+    /*! Calls `fn` when the stage is done.
+     *
+     * If the stage is already done, `fn` is called immediately.
+     * Else it is called from the thread that completes the stage,
+     * so it should just post the real work to its own io-service.
+     */
+    void onDone(cb_t fn);
+
+    /*! Blocks until the stage is done.
+     *
+     * Must not be called from an io-thread.
+     * Throws if the stage failed.
+     */
+    void wait();
+
+private:
+    void complete(std::exception_ptr ex);
+
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    std::optional<std::exception_ptr> result_;
+    std::vector<cb_t> callbacks_;
+};
+
+} // ns
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace k8deployer {
+
+/*! Writes a timeline of the run in the Trace Event Format.
+ *
+ * Enabled with --trace-file. The file can be opened in Perfetto
+ * (ui.perfetto.dev) or chrome://tracing.
+ *
+ * Each cluster is shown as a process. The cluster phases, each
+ * component and each task get a track (thread) in it. Spans are
+ * written as they complete, so the file is usable even if we
+ * are interrupted (the viewers accept a missing end of the array).
+ */
+class Tracer
+{
+public:
+    using clock_t = std::chrono::steady_clock;
+
+    explicit Tracer(const std::filesystem::path& path);
+    ~Tracer();
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator = (const Tracer&) = delete;
+
+    // The tracer for this run. nullptr if tracing is disabled.
+    static Tracer *instance() noexcept;
+
+    /*! Add a span to a track.
+     *
+     * \param cluster Name of the cluster
+     * \param track Name of the track in the cluster. Empty for the cluster phases.
+     * \param name What happened
+     * \param category Category, like "task" or "http"
+     * \param detail Optional text shown with the span
+     */
+    void span(const std::string& cluster, const std::string& track, std::string_view name,
+              std::string_view category, clock_t::time_point start, clock_t::time_point end,
+              std::string_view detail = {});
+
+private:
+    // Returns pid and tid. Adds the names of new processes and threads to the trace.
+    std::pair<int, int> ids(const std::string& cluster, const std::string& track);
+    void write(const std::string& event);
+    uint64_t toUs(clock_t::time_point when) const;
+
+    const clock_t::time_point started_ = clock_t::now();
+    std::mutex mutex_;
+    std::ofstream file_;
+    bool first_ = true;
+    std::map<std::string, int> clusters_;
+    std::map<std::pair<int, std::string>, int> tracks_;
+};
+
+} // ns
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace k8deployer {
+
+/*! Threads for CPU and disk bound work, like preparing components.
+ *
+ * This is not for anything that use asio. The io-threads
+ * owns the network.
+ */
+class WorkerPool
+{
+public:
+    // 0 threads means one per core
+    explicit WorkerPool(size_t numThreads);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator = (const WorkerPool&) = delete;
+
+    /*! Calls fn(0) ... fn(count -1) in parallel, and wait for all of them.
+     *
+     * The calling thread takes part in the work. Items not yet started by
+     * a worker are run by the caller, so nested calls can not deadlock
+     * even if all the workers are busy.
+     *
+     * If any of the calls throw, the exception from the lowest index
+     * is re-thrown when all the calls are done.
+     */
+    void parallelFor(size_t count, const std::function<void (size_t)>& fn);
+
+    /*! Runs job on one of the workers. Exceptions from job are logged. */
+    void post(std::function<void ()> job);
+
+    size_t size() const noexcept {
+        return threads_.size();
+    }
+
+private:
+    void run();
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<std::function<void ()>> queue_;
+    bool done_ = false;
+    std::vector<std::thread> threads_;
+};
+
+} // ns
@@ -1086,6 +1086,26 @@ struct PodList {
     ListMeta metadata;
 };
 
+// Returned for lists when we ask for `as=PartialObjectMetadataList`
+struct PartialObjectMetadata {
+    std::string apiVersion = "meta.k8s.io/v1";
+    std::string kind = "PartialObjectMetadata";
+    ObjectMeta metadata;
+};
+
+struct PartialObjectMetadataList {
+    std::string apiVersion = "meta.k8s.io/v1";
+    std::string kind = "PartialObjectMetadataList";
+    std::vector<PartialObjectMetadata> items;
+    ListMeta metadata;
+};
+
+// Watch notification when we ask for `as=PartialObjectMetadata`
+struct PartialObjectMetadataEvent {
+    std::string type;
+    PartialObjectMetadata object;
+};
+
 } // ns
 
 BOOST_FUSION_ADAPT_STRUCT(k8deployer::k8api::Selector,
@@ -2078,3 +2098,21 @@ BOOST_FUSION_ADAPT_STRUCT(k8deployer::k8api::PodList,
     (std::vector<k8deployer::k8api::Pod>, pods)
     (k8deployer::k8api::ListMeta, metadata)
 );
+
+BOOST_FUSION_ADAPT_STRUCT(k8deployer::k8api::PartialObjectMetadata,
+    (std::string, apiVersion)
+    (std::string, kind)
+    (k8deployer::k8api::ObjectMeta, metadata)
+);
+
+BOOST_FUSION_ADAPT_STRUCT(k8deployer::k8api::PartialObjectMetadataList,
+    (std::string, apiVersion)
+    (std::string, kind)
+    (std::vector<k8deployer::k8api::PartialObjectMetadata>, items)
+    (k8deployer::k8api::ListMeta, metadata)
+);
+
+BOOST_FUSION_ADAPT_STRUCT(k8deployer::k8api::PartialObjectMetadataEvent,
+    (std::string, type)
+    (k8deployer::k8api::PartialObjectMetadata, object)
+);
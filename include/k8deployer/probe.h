@@ -5,6 +5,7 @@
 #include "k8deployer/Engine.h"
 #include "k8deployer/Cluster.h"
 #include "k8deployer/Component.h"
+#include "k8deployer/Metrics.h"
 #include "k8deployer/logging.h"
 
 namespace k8deployer {
@@ -14,16 +15,28 @@ void sendProbe(Component& component, const std::string& url,
                std::function<void(const std::optional<T>& object, Component::K8ObjectState state)> onDone,
                TvalidateFn && validate)
 {
-        component.client().Process([url, &component,
+        component.client().Process([url, &component, track=component.probeTrack(),
                              onDone=std::move(onDone),
                              validate=std::move(validate)](auto& ctx) {
 
         LOG_TRACE << component.logName() << "Probing";
 
+        const auto kind = Component::toString(component.getKind());
+        auto countProbe = [&](std::string_view result) {
+            if (auto metrics = Metrics::instance()) {
+                metrics->inc("k8deployer_probes_total",
+                             {{"cluster", component.cluster().name()}, {"kind", kind}, {"result", result}});
+            }
+        };
+
+        Metrics::ApiCall call{component.cluster().name(), "GET", kind, component.name};
+        call.traceAs("probe");
+        call.track(track);
         try {
             T data;
             auto reply = restc_cpp::RequestBuilder{ctx}.Get(url)
                     .Execute();
+            call.status(reply->GetResponseCode());
 
             restc_cpp::SerializeFromJson(data, *reply);
             const auto done = validate(data);
@@ -34,9 +47,12 @@ void sendProbe(Component& component, const std::string& url,
                   << reply->GetHttpResponse().reason_phrase
                   << ", done = " << (done ? "yes": "no");
 
+            countProbe(done ? "done" : "pending");
             onDone(data, done ? Component::K8ObjectState::DONE : Component::K8ObjectState::INIT);
             return;
         } catch(const restc_cpp::RequestFailedWithErrorException& err) {
+            call.status(err.http_response.status_code);
+            countProbe(err.http_response.status_code == 404 ? "missing" : "failed");
 
             if (err.http_response.status_code == 404) {
                 LOG_TRACE << component.logName()
@@ -57,6 +73,7 @@ void sendProbe(Component& component, const std::string& url,
         } catch(const std::exception& ex) {
             LOG_WARN << component.logName()
                      << "Probing failed: " << ex.what();
+            countProbe("failed");
             onDone({}, Component::K8ObjectState::FAILED);
         }
     });
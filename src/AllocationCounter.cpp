@@ -0,0 +1,92 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "k8deployer/AllocationCounter.h"
+
+using namespace std;
+
+namespace k8deployer {
+
+#ifdef K8DEPLOYER_COUNT_ALLOCATIONS
+
+namespace {
+atomic_uint64_t allocations_total{0};
+thread_local uint64_t allocations_thread{0};
+
+void *countedAlloc(size_t size)
+{
+    allocations_total.fetch_add(1, memory_order_relaxed);
+    ++allocations_thread;
+
+    if (size == 0) {
+        size = 1;
+    }
+
+    if (auto ptr = malloc(size)) {
+        return ptr;
+    }
+
+    throw bad_alloc{};
+}
+} // anon ns
+
+uint64_t AllocationCounter::total() noexcept
+{
+    return allocations_total.load(memory_order_relaxed);
+}
+
+uint64_t AllocationCounter::thisThread() noexcept
+{
+    return allocations_thread;
+}
+
+#else
+
+uint64_t AllocationCounter::total() noexcept
+{
+    return 0;
+}
+
+uint64_t AllocationCounter::thisThread() noexcept
+{
+    return 0;
+}
+
+#endif
+
+} // ns
+
+#ifdef K8DEPLOYER_COUNT_ALLOCATIONS
+
+void *operator new(std::size_t size)
+{
+    return k8deployer::countedAlloc(size);
+}
+
+void *operator new[](std::size_t size)
+{
+    return k8deployer::countedAlloc(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t) noexcept
+{
+    free(ptr);
+}
+
+#endif
@@ -0,0 +1,128 @@
+#include <array>
+#include <mutex>
+#include <stdexcept>
+
+#include "k8deployer/Atoms.h"
+
+using namespace std;
+
+namespace k8deployer {
+
+namespace {
+
+const array<string_view, Atom::WELL_KNOWN_COUNT> wellKnownNames = {
+    "",
+
+    "app",
+    "k8dep-deployment",
+    "k8dep-cluster",
+    "k8dep-component",
+
+    "port",
+    "image",
+    "imagePullPolicy",
+    "imagePullSecrets",
+    "imagePullSecrets.fromDockerLogin",
+    "serviceAccountName",
+    "pod.args",
+    "pod.env",
+    "pod.command",
+    "pod.scc.add",
+    "pod.memory",
+    "pod.cpu",
+    "pod.limits.memory",
+    "pod.limits.cpu",
+    "pod.requests.memory",
+    "pod.requests.cpu",
+    "tls.secret",
+    "tlsSecret",
+    "replicas",
+    "delay.before",
+    "delay.after",
+    "delay.sequence",
+    "openInBrowser",
+    "service.enabled",
+    "service.type",
+    "config.fromFile",
+    "ingress.paths"
+};
+
+} // anon ns
+
+AtomTable::AtomTable()
+{
+    index_.reserve(256);
+    for(const auto name : wellKnownNames) {
+        const auto id = static_cast<Atom::id_t>(names_.size());
+        names_.emplace_back(name);
+        index_.emplace(names_.back(), id);
+    }
+
+    if (index_.size() != Atom::WELL_KNOWN_COUNT) {
+        throw runtime_error("Duplicate names in the well-known atoms");
+    }
+}
+
+AtomTable &AtomTable::instance()
+{
+    static AtomTable table;
+    return table;
+}
+
+Atom AtomTable::intern(string_view name)
+{
+    if (auto atom = find(name)) {
+        return *atom;
+    }
+
+    unique_lock<shared_mutex> lock{mutex_};
+
+    // Someone may have added it while we were unlocked
+    if (auto it = index_.find(name); it != index_.end()) {
+        return Atom{it->second};
+    }
+
+    const auto id = static_cast<Atom::id_t>(names_.size());
+    names_.emplace_back(name);
+    index_.emplace(names_.back(), id);
+    return Atom{id};
+}
+
+std::optional<Atom> AtomTable::find(string_view name) const
+{
+    shared_lock<shared_mutex> lock{mutex_};
+    if (auto it = index_.find(name); it != index_.end()) {
+        return Atom{it->second};
+    }
+
+    return {};
+}
+
+const string &AtomTable::str(Atom atom) const
+{
+    shared_lock<shared_mutex> lock{mutex_};
+    return names_.at(atom.id());
+}
+
+size_t AtomTable::size() const
+{
+    shared_lock<shared_mutex> lock{mutex_};
+    return names_.size();
+}
+
+Atom Atom::intern(string_view name)
+{
+    return AtomTable::instance().intern(name);
+}
+
+std::optional<Atom> Atom::find(string_view name)
+{
+    return AtomTable::instance().find(name);
+}
+
+const string &Atom::str() const
+{
+    return AtomTable::instance().str(*this);
+}
+
+} // ns
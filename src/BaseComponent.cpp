@@ -24,11 +24,11 @@ void BaseComponent::basicPrepareDeploy()
         auto selector = getSelector();
 
         // Make sure we have a selector
-        meta->labels.emplace(selector);
+        meta->labels.try_emplace(selector.first, selector.second);
 
         // Copy all labels that is not already defined in the meta
-        for (const auto& label : labels) {
-            meta->labels.emplace(label);
+        for (const auto& [k, v] : labels) {
+            meta->labels.try_emplace(k, v);
         }
 
         if (auto podTemplate = getPodTemplate()) {
@@ -40,31 +40,31 @@ void BaseComponent::basicPrepareDeploy()
                 podTemplate->spec.securityContext = *podSpecSecurityContext;
             }
 
-            if (auto arg = getArg("serviceAccountName")
+            if (auto arg = getArg(Atom::SERVICE_ACCOUNT_NAME)
                     ; arg && podTemplate->spec.serviceAccountName.empty()) {
                 podTemplate->spec.serviceAccountName = *arg;
             }
 
             // Copy all labels from meta that is not already degined in the pod
-            for (const auto& label : meta->labels) {
-                podTemplate->metadata.labels.emplace(label);
+            for (const auto& [k, v] : meta->labels) {
+                podTemplate->metadata.labels.try_emplace(k, v);
             }
 
             k8api::Container container;
             container.name = name;
-            container.image = getArg("image", name);
-            container.args = getArgAsStringList("pod.args", ""s);
-            container.env = getArgAsEnvList("pod.env", ""s);
+            container.image = getArg(Atom::IMAGE, name);
+            container.args = parsedArgs_.podArgs;
+            container.env = parsedArgs_.podEnv;
             filterEnvVars(container.env);
 
-            container.command = getArgAsStringList("pod.command", ""s);
-            container.imagePullPolicy = getArg("imagePullPolicy", {});
+            container.command = parsedArgs_.podCommand;
+            container.imagePullPolicy = getArg(Atom::IMAGE_PULL_POLICY, {});
 
             if (podSecurityContext) {
                 container.securityContext = *podSecurityContext;
             }
 
-            if (auto psca = getArgAsStringList("pod.scc.add", ""s); !psca.empty()) {
+            if (const auto& psca = parsedArgs_.sccAdd; !psca.empty()) {
                 if (!container.securityContext) {
                     container.securityContext.emplace();
                 }
@@ -78,7 +78,7 @@ void BaseComponent::basicPrepareDeploy()
                 }
             }
 
-            if (auto ports = parsePorts(getArg("port", ""s)); !ports.empty()) {
+            if (const auto& ports = parsedArgs_.ports; !ports.empty()) {
                 for(const auto& port: ports) {
                     k8api::ContainerPort p;
                     p.containerPort = port.port;
@@ -103,32 +103,24 @@ void BaseComponent::basicPrepareDeploy()
                 // TODO: Add `resources.limits.hugepages-*`
                 // https://kubernetes.io/docs/concepts/configuration/manage-resources-containers/
 
-                if (auto v = getArg("pod.limits.memory"); v && !v->empty()) {
-                    resources().limits["memory"] = *v;
-                } else if (auto v = getArg("pod.memory"); v && !v->empty()) {
-                    resources().limits["memory"] = *v;
+                if (!parsedArgs_.limitsMemory.empty()) {
+                    resources().limits["memory"] = parsedArgs_.limitsMemory;
                 }
 
-                if (auto v = getArg("pod.limits.cpu"); v && !v->empty()) {
-                    resources().limits["cpu"] = *v;
-                } else if (auto v = getArg("pod.cpu"); v && !v->empty()) {
-                    resources().limits["cpu"] = *v;
+                if (!parsedArgs_.limitsCpu.empty()) {
+                    resources().limits["cpu"] = parsedArgs_.limitsCpu;
                 }
 
-                if (auto v = getArg("pod.requests.memory"); v && !v->empty()) {
-                    resources().requests["memory"] = *v;
-                } else if (auto v = getArg("pod.memory"); v && !v->empty()) {
-                    resources().requests["memory"] = *v;
+                if (!parsedArgs_.requestsMemory.empty()) {
+                    resources().requests["memory"] = parsedArgs_.requestsMemory;
                 }
 
-                if (auto v = getArg("pod.requests.cpu"); v && !v->empty()) {
-                    resources().requests["cpu"] = *v;
-                } else if (auto v = getArg("pod.cpu"); v && !v->empty()) {
-                    resources().requests["cpu"] = *v;
+                if (!parsedArgs_.requestsCpu.empty()) {
+                    resources().requests["cpu"] = parsedArgs_.requestsCpu;
                 }
             }
 
-            if (auto dhcred = getArg("imagePullSecrets")) {
+            if (auto dhcred = getArg(Atom::IMAGE_PULL_SECRETS)) {
                 // Use existing secret|
                 if (!dhcred->empty()) {
                     k8api::LocalObjectReference lor = {*dhcred};
@@ -137,7 +129,7 @@ void BaseComponent::basicPrepareDeploy()
                 }
             }
 
-            if (auto tls = getArg("tls.secret")) {
+            if (auto tls = getArg(Atom::TLS_SECRET)) {
                 // Use existing secret
 
                 k8api::VolumeMount vm;
@@ -170,7 +162,6 @@ void BaseComponent::addDeploymentTasks(Component::tasks_t& tasks)
 
         // Execution?
         if (task.state() == Task::TaskState::READY) {
-            buildInitContainers(); // This must be done after all components are initialized
             task.setState(Task::TaskState::EXECUTING);
             doDeploy(task.weak_from_this());
         }
@@ -207,6 +198,12 @@ void BaseComponent::addDeploymentTasks(Component::tasks_t& tasks)
     Component::addDeploymentTasks(tasks);
 }
 
+string BaseComponent::renderPayload()
+{
+    buildInitContainers(); // This must be done after all components are initialized
+    return Component::renderPayload();
+}
+
 void BaseComponent::addRemovementTasks(Component::tasks_t &tasks)
 {
     auto task = make_shared<Task>(*this, name, [&](Task& task, const k8api::Event */*event*/) {
@@ -4,6 +4,7 @@
 //#define RESTC_CPP_LOG_TRACE LOG_TRACE
 
 #include <sstream>
+#include <fstream>
 #include <filesystem>
 #include <future>
 #include <string_view>
@@ -17,8 +18,16 @@
 
 #include "k8deployer/logging.h"
 #include "k8deployer/Cluster.h"
+#include "k8deployer/AllocationCounter.h"
+#include "k8deployer/Atoms.h"
 #include "k8deployer/Engine.h"
 #include "k8deployer/Component.h"
+#include "k8deployer/CriticalPath.h"
+#include "k8deployer/DeletionTracker.h"
+#include "k8deployer/IoServicePool.h"
+#include "k8deployer/LogFollower.h"
+#include "k8deployer/Metrics.h"
+#include "k8deployer/Profiler.h"
 #include "k8deployer/k8/k8api.h"
 
 namespace k8deployer {
@@ -27,16 +36,57 @@ struct EventStream {
     k8api::Event object;
 };
 
-struct PodStream {
+// The parts of a pod we need to follow its containers
+struct ContainerProjection {
+    std::string containerID;
+    std::string name;
+    bool started = false;
+};
+
+struct PodProjectionMeta {
+    std::string name;
+    std::string namespace_;
+};
+
+struct PodProjectionStatus {
+    std::vector<ContainerProjection> containerStatuses;
+};
+
+struct PodProjection {
+    PodProjectionMeta metadata;
+    PodProjectionStatus status;
+};
+
+struct PodProjectionStream {
     std::string type;
-    k8api::Pod object;
+    PodProjection object;
 };
 
 } // ns
 
-BOOST_FUSION_ADAPT_STRUCT(k8deployer::PodStream,
+BOOST_FUSION_ADAPT_STRUCT(k8deployer::ContainerProjection,
+    (std::string, containerID)
+    (std::string, name)
+    (bool, started)
+    );
+
+BOOST_FUSION_ADAPT_STRUCT(k8deployer::PodProjectionMeta,
+    (std::string, name)
+    (std::string, namespace_)
+    );
+
+BOOST_FUSION_ADAPT_STRUCT(k8deployer::PodProjectionStatus,
+    (std::vector<k8deployer::ContainerProjection>, containerStatuses)
+    );
+
+BOOST_FUSION_ADAPT_STRUCT(k8deployer::PodProjection,
+    (k8deployer::PodProjectionMeta, metadata)
+    (k8deployer::PodProjectionStatus, status)
+    );
+
+BOOST_FUSION_ADAPT_STRUCT(k8deployer::PodProjectionStream,
     (std::string, type)
-    (k8deployer::k8api::Pod, object)
+    (k8deployer::PodProjection, object)
     );
 
 BOOST_FUSION_ADAPT_STRUCT(k8deployer::StorageDef,
@@ -119,15 +169,13 @@ string ipFromUrl(const string& url) {
 }
 
 Cluster::Cluster(const Config &cfg, const string &arg, const size_t id)
-    : cfg_{cfg}
+    : id_{id}, deletionTracker_{make_unique<DeletionTracker>(*this)}, cfg_{cfg}
 {
     variables_["clusterId"] = to_string(id);
     parseArgs(arg);
     if (!cfg_.storageEngine.empty()) {
         storage_ = Storage::create(cfg_.storageEngine);
     }
-
-    vars_ready_pr_.set_value();
 }
 
 Cluster::~Cluster()
@@ -175,18 +223,31 @@ std::future<void> Cluster::prepare()
 {
     // Prepare the clusters in paralell.
     // They may be inter-connected, and depend on the other clusters
-    // being partally initialized.
+    // being partally initialized. We never block our io-thread while
+    // waiting for another cluster. See resolveAfter().
 
     setState(State::INIT);
     LOG_INFO << name () << " Preparing ...";
 
-    loadKubeconfig();
+    preparePromise_ = make_shared<promise<void>>();
+    auto future = preparePromise_->get_future();
 
-    auto pr = make_shared<promise<void>>();
+    try {
+        if (Engine::mode() == Engine::Mode::RENDER) {
+            createOfflineClient();
+        } else {
+            loadKubeconfig();
+        }
+        finalizeVariables();
+    } catch(const exception&) {
+        varsReady_.setFailed(current_exception());
+        throw;
+    }
+    varsReady_.setReady();
 
     assert(client_);
 
-    if (!cfg_.dnsServerConfig.empty()) {
+    if (!cfg_.dnsServerConfig.empty() && Engine::mode() != Engine::Mode::RENDER) {
         dns_ = DnsProvisioner::create(Engine::config().dnsServerConfig,
                                       client_->GetIoService());
         if (!dns_) {
@@ -195,26 +256,223 @@ std::future<void> Cluster::prepare()
         }
     }
 
-    client_->GetIoService().post([this, pr] {
-       try {
-          readDefinitions();
-          setCmds();
-          createComponents();
-          if (rootComponent_) {
-              assert(prepareCmd_);
-              prepareCmd_();
-              prepared_ready_pr_.set_value();
-          } else {
-              LOG_WARN << name() << " No components. Nothing to do.";
-          }
-
-          pr->set_value();
-       } catch(const exception& ex) {
-          pr->set_exception(current_exception());
-       }
+    client_->GetIoService().post([this] {
+        // Hold the prepare stage open until the definitions are read
+        ++pendingResolutions_;
+        try {
+            readDefinitionsWhenReady();
+        } catch(const exception&) {
+            failPrepare(current_exception());
+        }
+        --pendingResolutions_;
+        checkIfPrepared();
+    });
+
+    return future;
+}
+
+void Cluster::readDefinitionsWhenReady()
+{
+    // Hold the prepare stage open while we read
+    ++pendingResolutions_;
+
+    runBlocking([this] {
+        readDefinitions();
+    }, [this](exception_ptr ex) {
+        try {
+            if (ex) {
+                rethrow_exception(ex);
+            }
+            prepareComponents();
+        } catch(const Engine::VariablesNotReady& err) {
+            // The definitions use a variable from a cluster that is still
+            // loading its variables. Read them again when it's done.
+            afterVariablesOf({err.clusterIx}, [this] {
+                readDefinitionsWhenReady();
+            });
+        } catch(const exception&) {
+            failPrepare(current_exception());
+        }
+
+        --pendingResolutions_;
+        checkIfPrepared();
+    });
+}
+
+void Cluster::runBlocking(std::function<void ()> work, std::function<void (exception_ptr)> then)
+{
+    auto run = [](const std::function<void ()>& work) {
+        try {
+            work();
+        } catch(...) {
+            return current_exception();
+        }
+        return exception_ptr{};
+    };
+
+    auto pool = Engine::instance().blockingPool();
+    if (!pool) {
+        then(run(work));
+        return;
+    }
+
+    pool->post([this, run, work=move(work), then=move(then)] {
+        auto ex = run(work);
+        getIoService().post([then, ex] {
+            then(ex);
+        });
+    });
+}
+
+void Cluster::prepareComponents()
+{
+    const auto allocations = AllocationCounter::thisThread();
+    setCmds();
+    createComponents();
+    if (rootComponent_) {
+        assert(prepareCmd_);
+        {
+            Profiler::Scope profile{Profiler::Phase::PREPARE, name_};
+            prepareCmd_();
+        }
+
+        if (cfg_.resume) {
+            // Hold the prepare stage open until we know what's already done
+            ++pendingResolutions_;
+            rootComponent_->resumeFromJournal(Engine::instance().journal()->load(name()), [this] {
+                --pendingResolutions_;
+                checkIfPrepared();
+            });
+        }
+        if (AllocationCounter::enabled()) {
+            LOG_DEBUG << name() << " Prepare used "
+                      << (AllocationCounter::thisThread() - allocations)
+                      << " heap allocations. "
+                      << AtomTable::instance().size() << " atoms are interned.";
+        }
+    } else {
+        LOG_WARN << name() << " No components. Nothing to do.";
+    }
+}
+
+void Cluster::resolveAfter(Stage &stage, const string &what, std::function<void ()> fn)
+{
+    struct Resolution {
+        explicit Resolution(boost::asio::io_service& ios)
+            : timer{ios} {}
+
+        boost::asio::deadline_timer timer;
+        bool done = false; // Only used from our io-thread
+    };
+
+    if (prepareDone_) {
+        throw runtime_error("resolveAfter() called after prepare is complete");
+    }
+
+    auto& ios = getIoService();
+    auto res = make_shared<Resolution>(ios);
+    ++pendingResolutions_;
+
+    LOG_TRACE << name() << " Waiting for " << what;
+
+    auto complete = [this, res, what, fn=move(fn)](exception_ptr ex) {
+        if (res->done) {
+            return;
+        }
+        res->done = true;
+        res->timer.cancel();
+
+        if (ex) {
+            LOG_ERROR << name() << " Failed while waiting for " << what;
+            failPrepare(ex);
+        } else if (!prepareDone_) {
+            LOG_TRACE << name() << " Resolved " << what;
+            try {
+                fn();
+            } catch(const exception&) {
+                failPrepare(current_exception());
+            }
+        }
+
+        --pendingResolutions_;
+        checkIfPrepared();
+    };
+
+    if (const auto timeout = Engine::config().clusterDependencyTimeout) {
+        res->timer.expires_from_now(boost::posix_time::seconds(timeout));
+        res->timer.async_wait([this, what, complete](const boost::system::error_code& ec) {
+            if (ec) {
+                return; // Cancelled
+            }
+            LOG_ERROR << name() << " Timed out waiting for " << what;
+            complete(make_exception_ptr(runtime_error("Timed out waiting for "s + what)));
+        });
+    }
+
+    stage.onDone([&ios, complete](exception_ptr ex) {
+        // Called from the other clusters thread.
+        ios.post([complete, ex] {
+            complete(ex);
+        });
     });
+}
+
+void Cluster::afterVariablesOf(std::vector<size_t> clusters, std::function<void ()> fn)
+{
+    if (clusters.empty()) {
+        fn();
+        return;
+    }
+
+    const auto ix = clusters.back();
+    clusters.pop_back();
+
+    auto other = Engine::instance().getCluster(ix);
+    if (!other) {
+        LOG_ERROR << name() << " The definitions refer to unknown cluster" << ix;
+        throw runtime_error("No such cluster: cluster"s + to_string(ix));
+    }
+
+    if (other == this) {
+        afterVariablesOf(move(clusters), move(fn));
+        return;
+    }
+
+    resolveAfter(other->getVarsReadyStage(), "variables from cluster"s + to_string(ix),
+                 [this, clusters=move(clusters), fn=move(fn)]() mutable {
+        afterVariablesOf(move(clusters), move(fn));
+    });
+}
+
+void Cluster::checkIfPrepared()
+{
+    if (pendingResolutions_ || prepareDone_) {
+        return;
+    }
+
+    prepareDone_ = true;
+    if (rootComponent_) {
+        freezeComponents();
+    }
+
+    preparePromise_->set_value();
+    Engine::notifyPhaseDone();
+}
+
+void Cluster::failPrepare(exception_ptr ex)
+{
+    if (prepareDone_) {
+        return;
+    }
+
+    prepareDone_ = true;
+    setState(State::ERROR);
+
+    // Release any other clusters waiting for us
+    basicComponentsReady_.setFailed(ex);
 
-    return pr->get_future();
+    preparePromise_->set_exception(ex);
+    Engine::notifyPhaseDone();
 }
 
 std::future<void> Cluster::execute()
@@ -222,7 +480,7 @@ std::future<void> Cluster::execute()
     if (Engine::mode() == Engine::Mode::DEPLOY && !Engine::config().logDir.empty()) {
         listenForContainers();
     }
-    if (executeCmd_) {
+    if (executeCmd_ && rootComponent_) {
         setState(State::EXECUTING);
         LOG_INFO << name () << " " << verb_ << " ...";
         assert(executeCmd_);
@@ -236,16 +494,135 @@ std::future<void> Cluster::execute()
 std::future<void> Cluster::pendingWork()
 {
     client_->GetIoService().post([this] {
-        if (openLogs_.empty()) {
+        bool done = false;
+        {
+            std::lock_guard<std::mutex> lock{logMutex_};
+            if (openLogs_.empty()) {
+                done = true;
+            } else {
+                setState(State::LOGGING);
+            }
+        }
+
+        if (done) {
             pendingWork_.set_value();
-        } else {
-            setState(State::LOGGING);
+            Engine::notifyPhaseDone();
         }
     });
 
     return pendingWork_.get_future();
 }
 
+std::future<void> Cluster::reconcile()
+{
+    auto promise = make_shared<std::promise<void>>();
+    auto future = promise->get_future();
+
+    client_->GetIoService().post([this, promise] {
+        runBlocking([this] {
+            readDefinitions();
+        }, [this, promise](exception_ptr ex) {
+            if (ex) {
+                LOG_ERROR << name() << " Failed to read the changes. Keeping the current components.";
+                promise->set_exception(ex);
+                return;
+            }
+
+            applyDefinitions(promise);
+        });
+    });
+
+    return future;
+}
+
+void Cluster::applyDefinitions(const std::shared_ptr<std::promise<void>>& promise)
+{
+    map<string, Component *> previousComponents;
+    auto previous = rootComponent_;
+    bool replacedRegistry = false;
+
+    try {
+        // Build the new tree in an empty registry
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            previousComponents = move(components_);
+            components_.clear();
+            atomic_store(&frozenComponents_, shared_ptr<const component_index_t>{});
+            replacedRegistry = true;
+        }
+
+        previousRoot_ = previous.get();
+        rootComponent_ = Component::populateTree(*dataDef_, *this);
+        rootComponent_->prepare();
+        previousRoot_ = {};
+    } catch(const exception& ex) {
+        LOG_ERROR << name() << " Failed to prepare the changes. Keeping the current components: "
+                  << ex.what();
+        previousRoot_ = {};
+        if (replacedRegistry) {
+            std::lock_guard<std::mutex> lock{mutex_};
+            components_ = move(previousComponents);
+        }
+        rootComponent_ = previous;
+        freezeComponents();
+        promise->set_exception(current_exception());
+        return;
+    }
+
+    freezeComponents();
+
+    // watchForChanges() waits for us, so the tree before `previous` is no longer in use
+    retiredRoot_ = previous;
+
+    rootComponent_->applyChanges(*previous, [promise](exception_ptr ex) {
+        if (ex) {
+            promise->set_exception(ex);
+        } else {
+            promise->set_value();
+        }
+    });
+}
+
+std::vector<string> Cluster::sourceFiles()
+{
+    vector<string> files{cfg_.definitionFile};
+
+    std::lock_guard<std::mutex> lock{mutex_};
+    for(const auto& [_, component] : components_) {
+        if (auto fileNames = component->getArg(Atom::CONFIG_FROM_FILE)) {
+            vector<string> names;
+            boost::split(names, *fileNames, boost::is_any_of(","));
+            for(auto& fn : names) {
+                if (!fn.empty()) {
+                    files.push_back(move(fn));
+                }
+            }
+        }
+
+        if (auto file = component->getArg(Atom::IMAGE_PULL_SECRETS_FROM_DOCKER_LOGIN)) {
+            files.push_back(*file);
+        }
+    }
+
+    return files;
+}
+
+std::set<size_t> Cluster::clusterDependencies()
+{
+    std::set<size_t> clusters;
+    if (rootComponent_) {
+        rootComponent_->forAllComponents([&](Component& c) {
+            for(const auto& dep : c.depends) {
+                if (auto [isClusterVar, ix, _] = Engine::parseClusterVar(dep); isClusterVar && ix != id_) {
+                    clusters.insert(ix);
+                }
+            }
+        });
+    }
+
+    return clusters;
+}
+
 bool Cluster::addStateListener(const std::string& componentName,
                                const std::function<void (const Component& component)>& fn)
 {
@@ -262,10 +639,23 @@ void Cluster::add(Component *component)
 {
     std::lock_guard<std::mutex> lock{mutex_};
     components_[component->name] = component;
+
+    if (atomic_load(&frozenComponents_)) {
+        // Copy on write
+        atomic_store(&frozenComponents_, shared_ptr<const component_index_t>{
+            make_shared<component_index_t>(components_.begin(), components_.end())});
+    }
 }
 
 Component *Cluster::getComponent(const string &name)
 {
+    if (const auto index = atomic_load(&frozenComponents_)) {
+        if (auto it = index->find(name) ; it != index->end()) {
+            return it->second;
+        }
+        return {};
+    }
+
     std::lock_guard<std::mutex> lock{mutex_};
 
     if (auto it = components_.find(name) ; it != components_.end()) {
@@ -275,6 +665,47 @@ Component *Cluster::getComponent(const string &name)
     return {};
 }
 
+Component *Cluster::previousComponent(Kind kind, const string &name)
+{
+    Component *match = {};
+    if (previousRoot_) {
+        previousRoot_->forAllComponents([&](Component& c) {
+            if (!match && c.getKind() == kind && c.name == name) {
+                match = &c;
+            }
+        });
+    }
+
+    return match;
+}
+
+void Cluster::freezeComponents()
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (!atomic_load(&frozenComponents_)) {
+        atomic_store(&frozenComponents_, shared_ptr<const component_index_t>{
+            make_shared<component_index_t>(components_.begin(), components_.end())});
+    }
+}
+
+void Cluster::reportCriticalPath()
+{
+    if (!rootComponent_) {
+        return;
+    }
+
+    const CriticalPath path{*rootComponent_};
+    path.report(name_ + " ");
+
+    const auto dotName = name_ + "-critical-path.dot";
+    ofstream out{dotName};
+    if (!out.is_open()) {
+        throw runtime_error("Failed to write "s + dotName);
+    }
+    LOG_INFO << name_ << " Writing the critical path to: " << dotName;
+    path.writeDot(out);
+}
+
 void Cluster::listenForContainers()
 {
     assert(client_);
@@ -299,27 +730,18 @@ void Cluster::listenForContainers()
         sp.name_mapping = jsonFieldMappings();
 
         try {
-            IteratorFromJsonSerializer<PodStream> pods{*reply, &sp, true};
+            // Only the names and container statuses are deserialized
+            IteratorFromJsonSerializer<PodProjectionStream> pods{*reply, &sp, true};
             for(const auto& pod : pods) {
                 LOG_TRACE << name_ << " Container: " << pod.type << " " << pod.object.metadata.name;
+                if (auto metrics = Metrics::instance()) {
+                    metrics->inc("k8deployer_watch_events_total", {{"cluster", name_}, {"watch", "pods"}});
+                }
 
-                // See if we should start logging for the container
-                for(const auto& c: pod.object.status.containerStatuses) {
-                    auto& prevState = knownContainers_[c.containerID];
-                    if (prevState.name.empty()) {
-                        // New container. Delete any existing log file?
-                        prepareLogging(pod.object, c);
-                    }
-
-                    if (c.started != prevState.started) {
-                        if (c.started) {
-                            startLogging(pod.object, c);
-                        } else {
-                            stopLogging(pod.object, c);
-                        }
-                    }
-
-                    prevState = c;
+                if (pod.type == "DELETED") {
+                    forgetPod(pod.object);
+                } else {
+                    updateContainers(pod.object);
                 }
 
                 if (state() > State::EXECUTING) {
@@ -341,7 +763,13 @@ void Cluster::listenForContainers()
 
 void Cluster::loadKubeconfig()
 {
-    auto kc = Kubeconfig::load(kubeconfig_);
+    unique_ptr<Kubeconfig> kc;
+    {
+        Profiler::Scope profile{Profiler::Phase::KUBECONFIG, name()};
+        kc = Kubeconfig::load(kubeconfig_);
+    }
+
+    Profiler::Scope profile{Profiler::Phase::CONNECT, name()};
 
     // Prepare tls for rest client
     auto tls = make_shared<boost::asio::ssl::context>(
@@ -361,14 +789,37 @@ void Cluster::loadKubeconfig()
     tls->use_private_key({key.data(), key.size()}, boost::asio::ssl::context_base::pem);
 
     restc_cpp::Request::Properties properties;
-    properties.cacheMaxConnectionsPerEndpoint = 64;
-    client_ = restc_cpp::RestClient::Create(tls, properties);
+    if (auto pool = Engine::instance().ioPool()) {
+        // Don't let the connection-caches grow with the number of clusters.
+        // restc-cpp can not bind its coroutines to a strand, so in stead of
+        // a strand per cluster, each cluster is bound to one of the
+        // single-threaded io-services in the pool.
+        properties.cacheMaxConnectionsPerEndpoint = 8;
+        client_ = restc_cpp::RestClient::Create(tls, properties, pool->next());
+    } else {
+        properties.cacheMaxConnectionsPerEndpoint = 64;
+        client_ = restc_cpp::RestClient::Create(tls, properties);
+    }
 
     url_ = kc->getServer();
 
     LOG_INFO << name() << " Will connect directly to: " << url_;
 }
 
+void Cluster::createOfflineClient()
+{
+    // The client is only used for its io-service. We never connect.
+    if (auto pool = Engine::instance().ioPool()) {
+        client_ = restc_cpp::RestClient::Create(pool->next());
+    } else {
+        client_ = restc_cpp::RestClient::Create();
+    }
+
+    url_ = "https://"s + name();
+
+    LOG_DEBUG << name() << " Rendering offline. No kubeconfig is used.";
+}
+
 void Cluster::startEventsLoop()
 {
     LOG_DEBUG << "Starting event-loops";
@@ -395,6 +846,9 @@ void Cluster::startEventsLoop()
             for(const auto& item : events) {
                 // This gets called asynchrounesly for each event we get from the server
                 const auto& event = item.object;
+                if (auto metrics = Metrics::instance()) {
+                    metrics->inc("k8deployer_watch_events_total", {{"cluster", name_}, {"watch", "events"}});
+                }
                 LOG_TRACE << name() << ": got event: "
                           << event.metadata.namespace_ << '.'
                           << event.metadata.name
@@ -418,13 +872,8 @@ void Cluster::startEventsLoop()
     });
 }
 
-void Cluster::readDefinitions()
+void Cluster::finalizeVariables()
 {
-    LOG_DEBUG << name_ << ": Creating components from " << cfg_.definitionFile;
-
-    // Load component definitions
-    dataDef_ = make_unique<ComponentDataDef>();
-
     {
         auto vars = cfg_.variables;
 
@@ -453,20 +902,29 @@ void Cluster::readDefinitions()
     for(const auto& [k, v]: variables_) {
         LOG_DEBUG << "Cluster " << name_ << " has variable: " << k << '=' << v;
     }
+}
+
+void Cluster::readDefinitions()
+{
+    LOG_DEBUG << name_ << ": Creating components from " << cfg_.definitionFile;
+
+    Profiler::Scope profile{Profiler::Phase::READ_DEFINITIONS, name_};
+
+    // Load component definitions
+    dataDef_ = make_unique<ComponentDataDef>();
 
     fileToObject(*dataDef_, cfg_.definitionFile, variables_, true);
     if (dataDef_->kind.empty()) {
         LOG_ERROR << "Invalid definition file: " << cfg_.definitionFile;
         throw runtime_error("Invalid definition "s + cfg_.definitionFile);
     }
-
-    definitions_ready_pr_.set_value();
 }
 
 void Cluster::createComponents()
 {
+    Profiler::Scope profile{Profiler::Phase::POPULATE_TREE, name_};
     rootComponent_ = Component::populateTree(*dataDef_, *this);
-    basic_components_pr_.set_value();
+    basicComponentsReady_.setReady();
 }
 
 void Cluster::setCmds()
@@ -487,6 +945,21 @@ void Cluster::setCmds()
         executeCmd_ = [this] {
             return rootComponent_->remove();
         };
+        if (cfg_.fastTeardown) {
+            executeCmd_ = [this] {
+                return rootComponent_->fastRemove();
+            };
+        }
+        prepareCmd_ = [this] {
+            rootComponent_->prepare();
+            return dummyReturnFuture();
+        };
+        break;
+    case Engine::Mode::RENDER:
+        verb_ = "Rendering";
+        executeCmd_ = [this] {
+            return rootComponent_->writePayloads(cfg_.renderOnly);
+        };
         prepareCmd_ = [this] {
             rootComponent_->prepare();
             return dummyReturnFuture();
@@ -495,7 +968,14 @@ void Cluster::setCmds()
     case Engine::Mode::SHOW_DEPENDENCIES:
             verb_ = "Scanning Dependencies";
             executeCmd_ = [this] {
-                return rootComponent_->dumpDependencies();
+                auto rval = rootComponent_->dumpDependencies();
+                if (Engine::instance().history()) {
+                    const CriticalPath path{*rootComponent_, [](const Component& c) {
+                        return c.estimatedDuration();
+                    }};
+                    path.report(name_ + " ");
+                }
+                return rval;
             };
             prepareCmd_ = [this] {
                 rootComponent_->prepare();
@@ -543,7 +1023,68 @@ void Cluster::parseArgs(const std::string& args)
     LOG_TRACE << "Cluster " << name() << " has variables: " << getVars();
 }
 
-void Cluster::prepareLogging(const k8api::Pod &pod, const k8api::ContainerStatus &container)
+void Cluster::updateContainers(const PodProjection &pod)
+{
+    struct Change {
+        const ContainerProjection *container = {};
+        bool isNew = false;
+        bool started = false;
+        bool startedChanged = false;
+    };
+
+    vector<Change> changes;
+    {
+        std::lock_guard<std::mutex> lock{logMutex_};
+
+        // Only the current containers are kept, so restarts don't add up
+        auto& known = knownContainers_[pod.metadata.namespace_ + "/" + pod.metadata.name];
+        map<string, bool> current;
+        for(const auto& c: pod.status.containerStatuses) {
+            if (c.containerID.empty()) {
+                continue; // Not created yet
+            }
+
+            const auto it = known.find(c.containerID);
+            const bool wasStarted = it != known.end() && it->second;
+            if (it == known.end() || c.started != wasStarted) {
+                changes.push_back({&c, it == known.end(), c.started, c.started != wasStarted});
+            }
+            current[c.containerID] = c.started;
+        }
+
+        known.swap(current);
+    }
+
+    for(const auto& change : changes) {
+        if (change.isNew) {
+            prepareLogging(pod, *change.container);
+        }
+
+        // See if we should start or stop logging for the container
+        if (change.startedChanged) {
+            if (change.started) {
+                startLogging(pod, *change.container);
+            } else {
+                stopLogging(pod, *change.container);
+            }
+        }
+    }
+}
+
+void Cluster::forgetPod(const PodProjection &pod)
+{
+    std::lock_guard<std::mutex> lock{logMutex_};
+    knownContainers_.erase(pod.metadata.namespace_ + "/" + pod.metadata.name);
+
+    // A new pod with the same name gets a new log
+    for(const auto& c: pod.status.containerStatuses) {
+        if (const auto path = logPath(pod, c); !path.empty()) {
+            loggedPaths_.erase(path.string());
+        }
+    }
+}
+
+void Cluster::prepareLogging(const PodProjection &pod, const ContainerProjection &container)
 {
     auto path = logPath(pod, container);
     if (path.empty()) {
@@ -553,80 +1094,75 @@ void Cluster::prepareLogging(const k8api::Pod &pod, const k8api::ContainerStatus
     if (!filesystem::is_directory(path.parent_path())) {
         LOG_INFO << name() << " Creating log directory: " << path.parent_path().string();
         filesystem::create_directories(path.parent_path());
-    } else if (filesystem::is_regular_file(path)) {
-        LOG_DEBUG << name() << " Truncating log-file: " << path.string();
-        filesystem::resize_file(path, 0);
     }
 }
 
-void Cluster::startLogging(const k8api::Pod &pod, const k8api::ContainerStatus &container)
+void Cluster::startLogging(const PodProjection &pod, const ContainerProjection &container)
 {
     assert(client_);
-    client_->Process([this, pod, container](restc_cpp::Context& ctx) {
-        // TODO: How do we signal to stop logging?
-
-        const auto path = logPath(pod, container);
-        ofstream out{path, ::ios_base::app};
-        if (!out.is_open()) {
-            LOG_WARN << "Failed to open log-file: " << path.string();
-        }
-
-        LOG_INFO << name() << " Opening log: " << path.string();
+    const auto path = logPath(pod, container);
+    if (path.empty()) {
+        return;
+    }
 
-        if (!Engine::config().logViewer.empty()) {
-            const auto cmd = Engine::config().logViewer + " " + path.string() + " &";
-            LOG_TRACE << name() << " Executing: " << cmd;
-            system(cmd.c_str());
+    const auto key = path.string();
+    shared_ptr<LogFollower> follower;
+    {
+        std::lock_guard<std::mutex> lock{logMutex_};
+        if (openLogs_.find(key) != openLogs_.end()) {
+            // A restarted container. The follower we have takes care of it.
+            LOG_TRACE << name() << " Already following log: " << key;
+            return;
         }
 
-        const auto url = url_ + "/api/v1/namespaces/"
-            + *getVar("namespace")
-            + "/pods/" + pod.metadata.name + "/log";
-
-        auto prop = make_shared<Request::Properties>();
-        prop->recvTimeout = (60 * 60 * 24) * 1000;
-
-        openLogs_[container.containerID] = path.string();
-
-        auto reply = RequestBuilder(ctx)
-                .Get(url)
-                .Properties(prop)
-                .Argument("follow", "true")
-                .Header("X-Client", "k8deployer")
-                .Execute();
-
-        while (true) {
-            const auto& b = reply->GetSomeData();
-
-            if (boost::asio::buffer_size(b) == 0) {
-                LOG_TRACE << name() << " End of log-file: " << path.string();
-                break;
+        // The log-writer deletes the old log when it opens the new one
+        const bool truncate = loggedPaths_.insert(key).second;
+
+        LogFollower::Target target{
+            pod.metadata.namespace_.empty() ? *getVar("namespace") : pod.metadata.namespace_,
+            pod.metadata.name, container.name, container.containerID, path, truncate};
+
+        follower = make_shared<LogFollower>(*this, move(target), [this, key] {
+            bool done = false;
+            {
+                std::lock_guard<std::mutex> lock{logMutex_};
+                openLogs_.erase(key);
+                if (openLogs_.empty() && state() == State::LOGGING) {
+                    setState(State::DONE);
+                    done = true;
+                }
             }
 
-            const string_view s{boost::asio::buffer_cast<const char*>(b),
-                        boost::asio::buffer_size(b)};
-            out << s;
-        }
-
-        LOG_INFO << name() << " Closing log: " << path.string();
-
-        openLogs_.erase(container.containerID);
-        if (openLogs_.empty()) {
-            pendingWork_.set_value();
-            if (state() == State::LOGGING) {
-                setState(State::DONE);
+            if (done) {
+                pendingWork_.set_value();
+                Engine::notifyPhaseDone();
             }
-        }
+        });
+
+        openLogs_[key] = follower;
+    }
 
-      });
+    follower->start();
 }
 
-void Cluster::stopLogging(const k8api::Pod &pod, const k8api::ContainerStatus &container)
+void Cluster::stopLogging(const PodProjection &pod, const ContainerProjection &container)
 {
-    LOG_DEBUG << name() << " Ignoring stop log on: " << logPath(pod, container);
+    const auto path = logPath(pod, container);
+    shared_ptr<LogFollower> follower;
+    {
+        std::lock_guard<std::mutex> lock{logMutex_};
+        if (auto it = openLogs_.find(path.string()); it != openLogs_.end()) {
+            follower = it->second;
+        }
+    }
+
+    if (follower) {
+        LOG_DEBUG << name() << " Container stopped. Ending log when drained: " << path.string();
+        follower->stop();
+    }
 }
 
-filesystem::path Cluster::logPath(const k8api::Pod &pod, const k8api::ContainerStatus &container)
+filesystem::path Cluster::logPath(const PodProjection &pod, const ContainerProjection &container)
 {
     if (Engine::config().logDir.empty()) {
         return {};
@@ -637,7 +1173,7 @@ filesystem::path Cluster::logPath(const k8api::Pod &pod, const k8api::ContainerS
     p /= pod.metadata.namespace_;
     p /= pod.metadata.name;
 
-    if (pod.spec.containers.size() > 1) {
+    if (pod.status.containerStatuses.size() > 1) {
         p += "_" + container.name;
     }
 
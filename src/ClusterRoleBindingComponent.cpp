@@ -76,7 +76,7 @@ void ClusterRoleBindingComponent::addRemovementTasks(Component::tasks_t &tasks)
 
 void ClusterRoleBindingComponent::doDeploy(std::weak_ptr<Component::Task> task)
 {
-    sendApply(clusterrolebinding, getCreationUrl(), task);
+    sendApplyJson(payload_, getCreationUrl(), task);
 }
 
 void ClusterRoleBindingComponent::doRemove(std::weak_ptr<Component::Task> task)
@@ -70,7 +70,7 @@ void ClusterRoleComponent::addRemovementTasks(Component::tasks_t &tasks)
 
 void ClusterRoleComponent::doDeploy(std::weak_ptr<Component::Task> task)
 {
-    sendApply(clusterrole, getCreationUrl(), task);
+    sendApplyJson(payload_, getCreationUrl(), task);
 }
 
 void ClusterRoleComponent::doRemove(std::weak_ptr<Component::Task> task)
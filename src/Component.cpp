@@ -1,33 +1,48 @@
 
 #include <map>
 #include <algorithm>
+#include <filesystem>
+#include <fstream>
 #include <queue>
+#include <set>
 
+#include <sys/resource.h>
+#include <sys/wait.h>
 #include <boost/algorithm/string.hpp>
 #include <boost/process.hpp>
 
+#include "restc-cpp/IteratorFromJsonSerializer.h"
 #include "restc-cpp/RequestBuilder.h"
+#include "rapidjson/document.h"
 
 #include "k8deployer/AppComponent.h"
 #include "k8deployer/Cluster.h"
 #include "k8deployer/ClusterRoleBindingComponent.h"
 #include "k8deployer/ClusterRoleComponent.h"
 #include "k8deployer/Component.h"
+#include "k8deployer/ComponentDiff.h"
 #include "k8deployer/ConfigMapComponent.h"
+#include "k8deployer/CriticalPath.h"
 #include "k8deployer/DaemonSetComponent.h"
+#include "k8deployer/DeletionTracker.h"
 #include "k8deployer/DeploymentComponent.h"
+#include "k8deployer/DurationHistory.h"
 #include "k8deployer/Engine.h"
 #include "k8deployer/HttpRequestComponent.h"
 #include "k8deployer/IngressComponent.h"
 #include "k8deployer/JobComponent.h"
+#include "k8deployer/Metrics.h"
 #include "k8deployer/NamespaceComponent.h"
 #include "k8deployer/PersistentVolumeComponent.h"
+#include "k8deployer/Profiler.h"
 #include "k8deployer/RoleBindingComponent.h"
 #include "k8deployer/RoleComponent.h"
 #include "k8deployer/SecretComponent.h"
 #include "k8deployer/ServiceAccountComponent.h"
 #include "k8deployer/ServiceComponent.h"
 #include "k8deployer/StatefulSetComponent.h"
+#include "k8deployer/Tracer.h"
+#include "k8deployer/WorkerPool.h"
 #include "k8deployer/k8/k8api.h"
 #include "k8deployer/logging.h"
 #include "k8deployer/exprtk_fn.h"
@@ -145,7 +160,7 @@ string Component::toString(const Kind &kind)
 void Component::init()
 {
     setState(State::CREATING);
-    effectiveArgs_ = mergeArgs();
+    mergeArgs();
 
     if (isRoot()) {
         if (Engine::config().autoMaintainNamespace) {
@@ -156,11 +171,12 @@ void Component::init()
 
     cluster_->add(this);
 
-    labels.emplace("k8dep-deployment", getRoot().name);
-    labels.emplace("k8dep-cluster", cluster_->name());
+    // try_emplace() don't allocate a node if the label is already set
+    labels.try_emplace(Atom{Atom::K8DEP_DEPLOYMENT}.str(), getRoot().name);
+    labels.try_emplace(Atom{Atom::K8DEP_CLUSTER}.str(), cluster_->name());
 
     if (auto component = getAppComponent()) {
-        labels.emplace("k8dep-component", component->name);
+        labels.try_emplace(Atom{Atom::K8DEP_COMPONENT}.str(), component->name);
     }
 
     initChildren();
@@ -212,6 +228,15 @@ Component::Component(const Component::ptr_t &parent, Cluster &cluster, const Com
 {
 }
 
+Component::~Component()
+{
+    for(auto l = stateListeners_.exchange(nullptr); l != nullptr;) {
+        auto next = l->next;
+        delete l;
+        l = next;
+    }
+}
+
 string Component::toString(const Component::ParentRelation &rel)
 {
     static const std::array<string, 3> names = {"INDEPENDENT", "BEFORE", "AFTER"};
@@ -226,16 +251,25 @@ string Component::logName() const noexcept
 
 std::optional<bool> Component::getBoolArg(const string &name) const
 {
-    if (auto it = effectiveArgs_.find(name) ; it != effectiveArgs_.end()) {
-        if (it->second == "true" || it->second == "yes" || it->second == "1") {
+    if (auto atom = Atom::find(name)) {
+        return getBoolArg(*atom);
+    }
+
+    return {};
+}
+
+std::optional<bool> Component::getBoolArg(Atom name) const
+{
+    if (auto value = findArg(name)) {
+        if (*value == "true" || *value == "yes" || *value == "1") {
             return true;
         }
 
-        if (it->second == "false" || it->second == "no" || it->second == "0") {
+        if (*value == "false" || *value == "no" || *value == "0") {
             return false;
         }
 
-        throw runtime_error("Argument "s + name + " is not a boolean value (1|0|true|false|yes|no)");
+        throw runtime_error("Argument "s + name.str() + " is not a boolean value (1|0|true|false|yes|no)");
     }
 
     return {};
@@ -243,16 +277,41 @@ std::optional<bool> Component::getBoolArg(const string &name) const
 
 std::optional<string> Component::getArg(const string &name) const
 {
-    if (auto it = effectiveArgs_.find(name) ; it != effectiveArgs_.end()) {
-        return it->second;
+    // Names that were never interned can not be among the arguments
+    if (auto atom = Atom::find(name)) {
+        return getArg(*atom);
+    }
+
+    return {};
+}
+
+std::optional<string> Component::getArg(Atom name) const
+{
+    if (auto value = findArg(name)) {
+        return *value;
     }
 
     return {};
 }
 
-k8api::string_list_t Component::getArgAsStringList(const string &values, const string &defaultVal) const
+const string *Component::findArg(Atom name) const noexcept
 {
-    return getArgAsStringList(getArg(values, defaultVal));
+    if (auto it = ownArgs_.find(name) ; it != ownArgs_.end()) {
+        return &it->second;
+    }
+
+    if (defaults_) {
+        if (auto it = defaults_->find(name) ; it != defaults_->end()) {
+            return &it->second;
+        }
+    }
+
+    return nullptr;
+}
+
+k8api::string_list_t Component::getArgAsStringList(Atom name, const string &defaultVal) const
+{
+    return getArgAsStringList(getArg(name, defaultVal));
 }
 
 k8api::string_list_t Component::getArgAsStringList(const string &values)
@@ -314,9 +373,9 @@ k8api::string_list_t Component::getArgAsStringList(const string &values)
     return rval;
 }
 
-k8api::env_vars_t Component::getArgAsEnvList(const string &values, const string &defaultVal) const
+k8api::env_vars_t Component::getArgAsEnvList(Atom name, const string &defaultVal) const
 {
-    return getArgAsEnvList(getArg(values, defaultVal));
+    return getArgAsEnvList(getArg(name, defaultVal));
 }
 
 k8api::env_vars_t Component::getArgAsEnvList(const string &values)
@@ -401,6 +460,15 @@ string Component::getArg(const string &name, const string &defaultVal) const
     return defaultVal;
 }
 
+string Component::getArg(Atom name, const string &defaultVal) const
+{
+    if (auto value = findArg(name)) {
+        return *value;
+    }
+
+    return defaultVal;
+}
+
 int Component::getIntArg(const string &name, int defaultVal) const
 {
     auto v = getArg(name);
@@ -411,109 +479,965 @@ int Component::getIntArg(const string &name, int defaultVal) const
     return defaultVal;
 }
 
+int Component::getIntArg(Atom name, int defaultVal) const
+{
+    if (auto value = findArg(name); value && !value->empty()) {
+        return stoi(*value);
+    }
+
+    return defaultVal;
+}
+
 size_t Component::getSizetArg(const string &name, size_t defaultVal) const
 {
     auto v = getArg(name);
     if (v) {
         return stoll(*v);
     }
-
-    return defaultVal;
+
+    return defaultVal;
+}
+
+Component::ptr_t Component::populateTree(ComponentDataDef &def, Cluster &cluster)
+{
+    if (auto root = populate(def, cluster, {})) {
+        root->init();
+
+        // Report all the invalid arguments at once
+        size_t numErrors = 0;
+        root->forAllComponents([&numErrors](Component& c) {
+            for(const auto& err : c.argErrors_) {
+                LOG_ERROR << err;
+                ++numErrors;
+            }
+        });
+
+        if (numErrors) {
+            throw runtime_error("Found "s + to_string(numErrors) + " invalid argument(s)");
+        }
+
+        return root;
+    }
+
+    return {};
+}
+
+void Component::prepare()
+{
+    tasks_ = make_unique<tasks_t>();
+    switch(Engine::mode()) {
+    case Engine::Mode::DEPLOY:
+    case Engine::Mode::RENDER:
+    case Engine::Mode::SHOW_DEPENDENCIES:
+        prepareDeploy();
+        addDeploymentTasks(*tasks_);
+        {
+            Profiler::Scope profile{Profiler::Phase::PREPARE_TASKS};
+            prepareTasks(*tasks_, false);
+        }
+        if (Engine::mode() != Engine::Mode::SHOW_DEPENDENCIES) {
+            renderPayloads();
+        }
+        {
+            Profiler::Scope profile{Profiler::Phase::SCAN_DEPENDENCIES};
+            scanDependencies();
+        }
+        break;
+    case Engine::Mode::DELETE:
+        prepareDeploy();
+        addRemovementTasks(*tasks_);
+        {
+            Profiler::Scope profile{Profiler::Phase::PREPARE_TASKS};
+            prepareTasks(*tasks_, true);
+        }
+        {
+            Profiler::Scope profile{Profiler::Phase::SCAN_DEPENDENCIES};
+            scanDependencies();
+        }
+        break;
+    }
+}
+
+void Component::prepareDeploy()
+{
+    // We are called at the end of the overrides, so the children added
+    // with addChild() are in place, and the ones an override needed right
+    // away (like the ConfigMap for a Deployment) are already prepared in this
+    // thread. A child only reads its parents, which are done, and changes its
+    // own sub-tree, so the sub-trees of the children are independent.
+    auto pool = Engine::instance().preparePool();
+    if (!pool || children_.size() < 2) {
+        for(auto& child : children_) {
+            child->prepareDeploy();
+        }
+        return;
+    }
+
+    // Copy, as the children are already in place. Errors are re-thrown in child order.
+    const auto children = children_;
+    pool->parallelFor(children.size(), [&children](size_t ix) {
+        children[ix]->prepareDeploy();
+    });
+}
+
+void Component::renderPayloads()
+{
+    assert(isRoot());
+
+    vector<Component *> components;
+    forAllComponents([&components](Component& c) {
+        components.push_back(&c);
+    });
+
+    // Render and verify in parallel. The errors are reported in tree order.
+    vector<string> errors(components.size());
+    auto render = [&](size_t ix) {
+        auto& c = *components[ix];
+        try {
+            c.payload_ = c.renderPayload();
+            if (c.payload_.empty()) {
+                return;
+            }
+
+            rapidjson::Document doc;
+            doc.Parse(c.payload_.c_str(), c.payload_.size());
+            if (doc.HasParseError()) {
+                errors[ix] = c.logName() + "Rendered invalid json at offset "
+                        + to_string(doc.GetErrorOffset());
+                return;
+            }
+
+            if (!doc.IsObject() || !doc.HasMember("metadata") || !doc["metadata"].IsObject()
+                    || !doc["metadata"].HasMember("name") || !doc["metadata"]["name"].IsString()
+                    || doc["metadata"]["name"].GetStringLength() == 0) {
+                errors[ix] = c.logName() + "Rendered object has no metadata.name";
+                return;
+            }
+
+            c.objectName_ = doc["metadata"]["name"].GetString();
+        } catch(const exception& ex) {
+            errors[ix] = c.logName() + "Failed to render: " + ex.what();
+        }
+    };
+
+    if (auto pool = Engine::instance().preparePool()) {
+        pool->parallelFor(components.size(), render);
+    } else {
+        for(size_t i = 0; i < components.size(); ++i) {
+            render(i);
+        }
+    }
+
+    size_t numErrors = 0, bytes = 0;
+    for(size_t i = 0; i < components.size(); ++i) {
+        if (!errors[i].empty()) {
+            LOG_ERROR << errors[i];
+            ++numErrors;
+        }
+        bytes += components[i]->payload_.size();
+    }
+
+    if (numErrors) {
+        throw runtime_error("Failed to render "s + to_string(numErrors) + " object(s)");
+    }
+
+    LOG_DEBUG << logName() << "Rendered " << bytes << " bytes for "
+              << components.size() << " components";
+}
+
+void Component::resumeFromJournal(const Journal::states_t &states, std::function<void ()> done)
+{
+    assert(isRoot());
+    assert(tasks_);
+
+    const auto doneState = toString(Task::TaskState::DONE);
+    // Used from the coroutine below, so it keeps its own copy of the states
+    auto isDoneInJournal = [states, doneState](const Task& task) {
+        if (task.mode() != Mode::CREATE) {
+            return false;
+        }
+        const auto it = states.find(task.journalKey());
+        return it != states.end() && it->second == doneState;
+    };
+
+    // Verify that the objects still exist, with one LIST request
+    // for each collection. We only need the names.
+    set<Component *> candidates;
+    map<string, vector<Component *>> collections;
+    for(const auto& t : *tasks_) {
+        if (isDoneInJournal(*t) && candidates.insert(&t->component()).second
+                && !t->component().payload_.empty()) {
+            collections[t->component().getCreationUrl()].push_back(&t->component());
+        }
+    }
+
+    client().Process([this, isDoneInJournal, candidates=move(candidates),
+                     collections=move(collections), done=move(done)](Context& ctx) {
+        set<Component *> verified;
+        for(const auto& [url, components] : collections) {
+            try {
+                auto reply = RequestBuilder{ctx}.Get(url)
+                        .Header("Accept", "application/json;as=PartialObjectMetadataList;g=meta.k8s.io;v=v1,application/json")
+                        .Execute();
+
+                k8api::PartialObjectMetadataList list;
+                SerializeFromJson(list, *reply, jsonFieldMappings());
+
+                set<string> names;
+                for(const auto& item : list.items) {
+                    names.insert(item.metadata.name);
+                }
+
+                for(auto c : components) {
+                    if (names.find(c->objectName_) != names.end()) {
+                        verified.insert(c);
+                    } else {
+                        LOG_INFO << c->logName() << "Is done in the journal, but the object is gone. Will apply it again.";
+                    }
+                }
+            } catch(const RequestFailedWithErrorException& err) {
+                LOG_WARN << logName() << "Failed to list " << url << ": "
+                         << err.http_response.status_code << ' ' << err.http_response.reason_phrase
+                         << ". Will apply the objects again.";
+            } catch(const exception& ex) {
+                LOG_WARN << logName() << "Failed to list " << url << ": " << ex.what()
+                         << ". Will apply the objects again.";
+            }
+        }
+
+        size_t skipped = 0;
+        for(const auto& t : *tasks_) {
+            auto& c = t->component();
+            if (candidates.find(&c) == candidates.end()
+                    || (!c.payload_.empty() && verified.find(&c) == verified.end())
+                    || !isDoneInJournal(*t)) {
+                continue;
+            }
+
+            t->setState(Task::TaskState::DONE, false);
+            ++skipped;
+        }
+
+        LOG_INFO << logName() << "Resuming: " << skipped << " of " << tasks_->size()
+                 << " tasks are already done.";
+        done();
+    });
+}
+
+void Component::applyChanges(Component &previous, std::function<void (exception_ptr)> done)
+{
+    assert(isRoot());
+    assert(tasks_);
+
+    const auto diff = [&] {
+        Profiler::Scope profile{Profiler::Phase::DIFF, cluster().name()};
+        return ComponentDiff{previous, *this};
+    }();
+    LOG_INFO << logName() << "Changes: " << diff.summary();
+
+    struct Progress {
+        size_t remaining = 1;
+        size_t failed = 0;
+        std::function<void (exception_ptr)> done;
+
+        void completed(bool success) {
+            if (!success) {
+                ++failed;
+            }
+
+            if (--remaining == 0) {
+                done(failed
+                     ? make_exception_ptr(runtime_error("Failed to apply the changes"))
+                     : exception_ptr{});
+            }
+        }
+    };
+
+    // Only used from our io-thread
+    auto progress = make_shared<Progress>();
+    progress->done = move(done);
+
+    set<const Component *> changed;
+    set<const Component *> affected; // The changed components and their parents
+    vector<Component *> removed;
+    vector<Component *> reprobe;
+
+    for(const auto& e : diff.entries()) {
+        switch(e.action) {
+        case ComponentDiff::Action::CREATE:
+        case ComponentDiff::Action::UPDATE:
+            LOG_DEBUG << e.current->logName() << "Will apply (" << ComponentDiff::toString(e.action) << ").";
+            changed.insert(e.current);
+            for(const Component *c = e.current; c && affected.insert(c).second; c = c->parentPtr())
+                ;
+            break;
+        case ComponentDiff::Action::DELETE:
+            if (Engine::config().prune) {
+                LOG_INFO << e.previous->logName() << "Removed from the definitions. Will delete it.";
+                removed.push_back(e.previous);
+            } else {
+                LOG_INFO << e.previous->logName() << "Removed from the definitions. Use --prune to delete it.";
+            }
+            break;
+        case ComponentDiff::Action::REPROBE:
+            reprobe.push_back(e.current);
+            break;
+        case ComponentDiff::Action::UNCHANGED:
+            break;
+        }
+
+        if (e.current && e.previous) {
+            // Components in other clusters may depend on it
+            e.current->takeStateListeners(*e.previous);
+        }
+    }
+
+    // The tasks for the components that did not change are already done
+    for(auto& task : *tasks_) {
+        if (changed.find(&task->component()) == changed.end()) {
+            task->setState(Task::TaskState::DONE, false);
+        }
+    }
+
+    forAllComponents([&](Component& c) {
+        c.applyServerSide_ = true;
+        if (affected.find(&c) == affected.end()) {
+            // Not setState(), as nothing happened to it
+            c.state_ = State::DONE;
+        }
+    });
+
+    auto onApplied = [progress, prev=previous.shared_from_this(), removed=move(removed),
+                      reprobe=move(reprobe)](exception_ptr ex) {
+        if (ex) {
+            LOG_WARN << prev->logName() << "Failed to apply the changes. Keeping the removed components.";
+            progress->completed(false);
+            return;
+        }
+
+        // The changed workloads are ready now
+        for(auto c : reprobe) {
+            ++progress->remaining;
+            const auto probing = c->probe([c, progress](K8ObjectState s) {
+                if (s == K8ObjectState::READY || s == K8ObjectState::DONE) {
+                    LOG_DEBUG << c->logName() << "Still ready after the changes.";
+                } else {
+                    LOG_WARN << c->logName() << "Not ready after the changes.";
+                }
+                progress->completed(true);
+            });
+            if (!probing) {
+                --progress->remaining;
+            }
+        }
+
+        prev->removeComponents(removed, [progress](exception_ptr ex) {
+            progress->completed(!ex);
+        });
+    };
+
+    if (isDone()) {
+        onApplied({});
+    } else {
+        executionDone_ = move(onApplied);
+        scheduleRunTasks();
+    }
+}
+
+void Component::removeComponents(const std::vector<Component *> &removed,
+                                 std::function<void (exception_ptr)> done)
+{
+    assert(isRoot());
+
+    if (removed.empty()) {
+        done({});
+        return;
+    }
+
+    const set<Component *> isRemoved{removed.begin(), removed.end()};
+    for(auto c : removed) {
+        c->mode_ = Mode::REMOVE;
+    }
+
+    tasks_t tasks;
+    for(auto c : removed) {
+        // The parent adds the tasks for its children
+        if (auto parent = c->parent_.lock(); !parent || isRemoved.find(parent.get()) == isRemoved.end()) {
+            c->addRemovementTasks(tasks);
+        }
+    }
+
+    // A child may be moved to a parent that still exists
+    tasks.erase(remove_if(tasks.begin(), tasks.end(), [&isRemoved](const auto& task) {
+        return isRemoved.find(&task->component()) == isRemoved.end();
+    }), tasks.end());
+
+    for(auto& task : tasks) {
+        task->setState(Task::TaskState::BLOCKED, false);
+    }
+
+    // Remove the components that depend on others first, like
+    // the contents of a namespace before the namespace.
+    for(auto c : removed) {
+        for(const auto& wdep : c->dependsOn_) {
+            auto dep = wdep.lock();
+            if (!dep || isRemoved.find(dep.get()) == isRemoved.end()) {
+                continue;
+            }
+
+            for(auto& depTask : tasks) {
+                if (&depTask->component() != dep.get()) {
+                    continue;
+                }
+                for(auto& task : tasks) {
+                    if (&task->component() == c) {
+                        depTask->addDependency(task);
+                    }
+                }
+            }
+        }
+    }
+
+    LOG_INFO << logName() << "Removing " << removed.size() << " component(s) with "
+             << tasks.size() << " task(s).";
+
+    tasks_ = make_unique<tasks_t>(move(tasks));
+    removalDone_ = move(done);
+    scheduleRunTasks();
+}
+
+void Component::runRemovalTasks()
+{
+    assert(tasks_);
+    bool again = true;
+    while(again && cluster_->isExecuting()) {
+        again = false;
+        bool allDone = true;
+        size_t failed = 0;
+        for(auto task : *tasks_) {
+            again = task->evaluate() ? true : again;
+            if (task->state() == Task::TaskState::READY) {
+                task->execute();
+                again = true;
+            }
+
+            if (!task->isDone()) {
+                allDone = false;
+            } else if (task->state() != Task::TaskState::DONE) {
+                ++failed;
+            }
+        }
+
+        if (allDone) {
+            auto done = move(removalDone_);
+            removalDone_ = {};
+            if (failed) {
+                LOG_WARN << logName() << failed << " removal task(s) failed.";
+                done(make_exception_ptr(runtime_error(to_string(failed) + " removal task(s) failed")));
+            } else {
+                done({});
+            }
+            return;
+        }
+    }
+}
+
+void Component::takeStateListeners(Component &from)
+{
+    for(auto l = from.stateListeners_.exchange(nullptr); l != nullptr;) {
+        auto next = l->next;
+        l->next = stateListeners_.load(memory_order_relaxed);
+        while(!stateListeners_.compare_exchange_weak(l->next, l,
+                                                     memory_order_release,
+                                                     memory_order_relaxed))
+            ;
+        l = next;
+    }
+}
+
+std::future<void> Component::writePayloads(const string &dir)
+{
+    assert(isRoot());
+
+    const auto clusterDir = filesystem::path{dir} / cluster_->name();
+    LOG_INFO << logName() << "Writing the rendered objects to " << clusterDir;
+    filesystem::create_directories(clusterDir);
+
+    forAllComponents([&clusterDir](Component& c) {
+        if (c.payload_.empty()) {
+            return;
+        }
+
+        auto path = clusterDir;
+        if (const auto ns = c.getNamespace(); !ns.empty()) {
+            path /= ns;
+        }
+        filesystem::create_directories(path);
+        path /= toString(c.getKind()) + "-" + c.name + ".json";
+
+        ofstream out{path, ios_base::out | ios_base::trunc | ios_base::binary};
+        if (!out.is_open()) {
+            LOG_ERROR << c.logName() << "Failed to open " << path << " for write";
+            throw runtime_error("Failed to write "s + path.string());
+        }
+        out << c.payload_;
+    });
+
+    // The dependencies between the components and tasks
+    const auto dotName = clusterDir / Engine::config().dotfile;
+    ofstream out{dotName};
+    if (!out.is_open()) {
+        LOG_ERROR << logName() << "Failed to open " << dotName << " for write";
+        throw runtime_error("Failed to write "s + dotName.string());
+    }
+    writeDependencies(out);
+
+    return dummyReturnFuture();
+}
+
+string Component::renderPayload()
+{
+    switch(kind_) {
+    case Kind::JOB:
+        return toJson(job);
+    case Kind::DEPLOYMENT:
+        return toJson(deployment);
+    case Kind::STATEFULSET:
+        return toJson(statefulSet);
+    case Kind::DAEMONSET:
+        return toJson(daemonset);
+    case Kind::SERVICE:
+        return toJson(service);
+    case Kind::CONFIGMAP:
+        return toJson(configmap);
+    case Kind::SECRET:
+        return secret ? toJson(*secret) : string{};
+    case Kind::PERSISTENTVOLUME:
+        return toJson(persistentVolume);
+    case Kind::INGRESS:
+        return toJson(ingress);
+    case Kind::NAMESPACE:
+        return toJson(namespace_);
+    case Kind::ROLE:
+        return toJson(role);
+    case Kind::CLUSTERROLE:
+        return toJson(clusterrole);
+    case Kind::ROLEBINDING:
+        return toJson(rolebinding);
+    case Kind::CLUSTERROLEBINDING:
+        return toJson(clusterrolebinding);
+    case Kind::SERVICEACCOUNT:
+        return toJson(serviceaccount);
+    default:
+        return {};
+    }
+}
+
+std::future<void> Component::deploy()
+{
+    assert(isRoot());
+    if (Engine::config().maxConcurrentTasks && Engine::instance().history()) {
+        prioritizeTasks();
+    }
+    return execute();
+}
+
+void Component::prioritizeTasks()
+{
+    const CriticalPath path{*this, [](const Component& c) {
+        return c.estimatedDuration();
+    }};
+
+    for(const auto& node : path.nodes()) {
+        const_cast<Component *>(node.component)->priority_ = path.total() - node.latestStart;
+    }
+
+    LOG_DEBUG << logName() << "Prioritized the tasks from the duration history. Estimated duration: "
+              << fixed << setprecision(3) << path.total() << " seconds";
+}
+
+optional<double> Component::estimatedDuration() const
+{
+    if (auto history = Engine::instance().history()) {
+        if (auto stats = history->get(cluster_->name(), name, toString(kind_), getArg(Atom::IMAGE, {}))) {
+            return stats->average;
+        }
+    }
+    return {};
+}
+
+void Component::recordDuration()
+{
+    auto history = Engine::instance().history();
+    if (!history || Engine::mode() != Engine::Mode::DEPLOY
+            || !timeline_.started || !timeline_.tasksDone) {
+        return;
+    }
+
+    const auto seconds = chrono::duration<double>(*timeline_.tasksDone - *timeline_.started).count();
+    history->record(cluster().name(), name, toString(kind_), getArg(Atom::IMAGE, {}), max(seconds, 0.0));
+}
+
+std::future<void> Component::dumpDependencies()
+{
+    const auto dotName = name + "-" + Engine::config().dotfile;
+    std::ofstream out{dotName};
+
+    if (out.is_open()) {
+        LOG_INFO << "Dumping dependencies to: " << dotName;
+        writeDependencies(out);
+    }
+
+    return dummyReturnFuture();
+}
+
+void Component::writeDependencies(ostream &out)
+{
+    out << "digraph {" << endl;
+    out << "   subgraph components {" << endl;
+    out << R"(      label="Components";)" << endl;
+
+    forAllComponents([&](Component& c) {
+        for (const auto& dep : c.dependsOn_) {
+            if (auto d = dep.lock()) {
+                out << "      \"" << boost::trim_right_copy(c.logName())
+                    << "\" -> \"" << boost::trim_right_copy(d->logName()) << '"' << endl;
+            }
+        }
+    });
+
+    out << "   }" << endl;
+
+    if (tasks_) {
+        out << "   subgraph tasks {" << endl;
+        out << R"(      label="Tasks";)" << endl;
+
+        for(const auto& t : *tasks_) {
+            for (const auto& dw: t->dependencies()) {
+                if (auto d = dw.lock()) {
+                    out << "      \"" << boost::trim_right_copy(t->component().logName()) << '.' << t->name()
+                        << "\" -> \""
+                        << boost::trim_right_copy(d->component().logName()) << '.' << d->name()
+                        << '"' << endl;
+                }
+            }
+        }
+
+        out << "   }" << endl;
+    }
+
+    out << "}" << endl;
+}
+
+std::future<void> Component::remove()
+{
+    return execute();
+}
+
+namespace {
+
+enum class CollectionDelete {
+    OK,
+    NOT_SUPPORTED,
+    FAILED
+};
+
+CollectionDelete deleteCollection(Context& ctx, const string& url, const string& selector,
+                                  const string& logName)
+{
+    LOG_DEBUG << logName << "Deleting " << url << " with labelSelector " << selector;
+    try {
+        RequestBuilder{ctx}.Req(url, Request::Type::DELETE)
+                .Argument("labelSelector", selector)
+                .Argument("propagationPolicy", "Foreground")
+                .Execute();
+        return CollectionDelete::OK;
+    } catch(const RequestFailedWithErrorException& err) {
+        if (err.http_response.status_code == 404) {
+            return CollectionDelete::OK;
+        }
+        if (err.http_response.status_code == 405) {
+            // Some kinds, like Namespace, don't support deletecollection
+            return CollectionDelete::NOT_SUPPORTED;
+        }
+        LOG_WARN << logName << "Failed to delete " << url << ": "
+                 << err.http_response.status_code << ' ' << err.http_response.reason_phrase;
+    } catch(const exception& ex) {
+        LOG_WARN << logName << "Failed to delete " << url << ": " << ex.what();
+    }
+
+    return CollectionDelete::FAILED;
+}
+
+bool deleteOne(Context& ctx, const string& url, const string& logName)
+{
+    LOG_DEBUG << logName << "Sending DELETE " << url;
+    try {
+        RequestBuilder{ctx}.Req(url, Request::Type::DELETE)
+                .Argument("propagationPolicy", "Foreground")
+                .Execute();
+        return true;
+    } catch(const RequestFailedWithErrorException& err) {
+        if (err.http_response.status_code == 404) {
+            return true;
+        }
+        LOG_WARN << logName << "Failed to delete " << url << ": "
+                 << err.http_response.status_code << ' ' << err.http_response.reason_phrase;
+    } catch(const exception& ex) {
+        LOG_WARN << logName << "Failed to delete " << url << ": " << ex.what();
+    }
+
+    return false;
+}
+
+/* Wait until the collection has no objects matching `selector`, or
+ * none of `names` if they are given.
+ *
+ * With foreground propagation the objects remain until their dependents
+ * are gone, so we list what is left and watch for it to be deleted.
+ * The watch has a timeout, so that we re-list now and then in case we
+ * missed a notification.
+ *
+ * Returns false if we could not list the objects, or they remain after `deadline`.
+ */
+bool waitUntilGone(Context& ctx, const string& url, const string& selector,
+                   const set<string>& names,
+                   const optional<chrono::steady_clock::time_point>& deadline,
+                   const string& logName)
+{
+    static const string listAccept = "application/json;as=PartialObjectMetadataList;g=meta.k8s.io;v=v1,application/json";
+    static const string watchAccept = "application/json;as=PartialObjectMetadata;g=meta.k8s.io;v=v1,application/json";
+
+    serialize_properties_t sp;
+    sp.name_mapping = jsonFieldMappings();
+
+    while(true) {
+        set<string> remaining;
+        string resourceVersion;
+        try {
+            RequestBuilder builder{ctx};
+            builder.Get(url).Header("Accept", listAccept);
+            if (!selector.empty()) {
+                builder.Argument("labelSelector", selector);
+            }
+            auto reply = builder.Execute();
+
+            k8api::PartialObjectMetadataList list;
+            SerializeFromJson(list, *reply, jsonFieldMappings());
+            for(const auto& item : list.items) {
+                if (names.empty() || names.find(item.metadata.name) != names.end()) {
+                    remaining.insert(item.metadata.name);
+                }
+            }
+            resourceVersion = list.metadata.resourceVersion;
+        } catch(const exception& ex) {
+            LOG_WARN << logName << "Failed to list " << url << ": " << ex.what();
+            return false;
+        }
+
+        if (remaining.empty()) {
+            return true;
+        }
+
+        int64_t watchSeconds = 60;
+        if (deadline) {
+            const auto left = chrono::duration_cast<chrono::seconds>(*deadline - chrono::steady_clock::now()).count();
+            if (left <= 0) {
+                LOG_WARN << logName << "Timed out waiting for " << remaining.size()
+                         << " object(s) in " << url << " to be deleted";
+                return false;
+            }
+            watchSeconds = min<int64_t>(watchSeconds, left);
+        }
+
+        LOG_DEBUG << logName << "Waiting for " << remaining.size()
+                  << " object(s) in " << url << " to be deleted";
+
+        try {
+            auto prop = make_shared<Request::Properties>();
+            prop->recvTimeout = (watchSeconds + 30) * 1000;
+
+            RequestBuilder builder{ctx};
+            builder.Get(url)
+                    .Properties(prop)
+                    .Header("Accept", watchAccept)
+                    .Argument("watch", "true")
+                    .Argument("timeoutSeconds", to_string(watchSeconds))
+                    .Argument("resourceVersion", resourceVersion);
+            if (!selector.empty()) {
+                builder.Argument("labelSelector", selector);
+            }
+            auto reply = builder.Execute();
+
+            IteratorFromJsonSerializer<k8api::PartialObjectMetadataEvent> events{*reply, &sp, true};
+            for(const auto& event : events) {
+                if (event.type == "DELETED") {
+                    remaining.erase(event.object.metadata.name);
+                    if (remaining.empty()) {
+                        return true;
+                    }
+                } else if (event.type == "ERROR") {
+                    // Typically an expired resourceVersion. List again.
+                    break;
+                }
+            }
+        } catch(const exception& ex) {
+            LOG_DEBUG << logName << "Watch on " << url << " ended: " << ex.what();
+        }
+    }
 }
 
-Component::ptr_t Component::populateTree(ComponentDataDef &def, Cluster &cluster)
+// The uid from a DELETE reply, and a selector for our deployment label if
+// the object has it. The reply is either the object, or a Status.
+pair<string, string> getUidAndSelector(const string& json)
 {
-    if (auto root = populate(def, cluster, {})) {
-        root->init();
-        return root;
+    rapidjson::Document doc;
+    doc.Parse(json.c_str(), json.size());
+    if (doc.HasParseError() || !doc.IsObject()) {
+        return {};
     }
 
-    return {};
-}
-
-void Component::prepare()
-{
-    tasks_ = make_unique<tasks_t>();
-    switch(Engine::mode()) {
-    case Engine::Mode::DEPLOY:
-    case Engine::Mode::SHOW_DEPENDENCIES:
-        prepareDeploy();
-        addDeploymentTasks(*tasks_);
-        prepareTasks(*tasks_, false);
-        scanDependencies();
-        break;
-    case Engine::Mode::DELETE:
-        prepareDeploy();
-        addRemovementTasks(*tasks_);
-        prepareTasks(*tasks_, true);
-        scanDependencies();
-        break;
+    pair<string, string> rval;
+    for(const auto member : {"metadata", "details"}) {
+        if (doc.HasMember(member) && doc[member].IsObject()
+                && doc[member].HasMember("uid") && doc[member]["uid"].IsString()) {
+            rval.first = doc[member]["uid"].GetString();
+            break;
+        }
     }
-}
 
-void Component::prepareDeploy()
-{
-    for(auto& child : children_) {
-        child->prepareDeploy();
+    const auto& label = Atom{Atom::K8DEP_DEPLOYMENT}.str();
+    if (doc.HasMember("metadata") && doc["metadata"].IsObject()
+            && doc["metadata"].HasMember("labels") && doc["metadata"]["labels"].IsObject()) {
+        const auto& labels = doc["metadata"]["labels"];
+        if (labels.HasMember(label.c_str()) && labels[label.c_str()].IsString()) {
+            rval.second = label + "=" + labels[label.c_str()].GetString();
+        }
     }
+
+    return rval;
 }
 
-std::future<void> Component::deploy()
+} // anon ns
+
+std::future<void> Component::fastRemove()
 {
     assert(isRoot());
-    return execute();
-}
 
-std::future<void> Component::dumpDependencies()
-{
-    const auto dotName = name + "-" + Engine::config().dotfile;
-    std::ofstream out{dotName};
+    // Delete the namespaced objects first, then the cluster-wide objects
+    // (which may be used by the former), and the namespaces at the end.
+    // Each phase maps collection urls to the components in them.
+    using collections_t = map<string, vector<Component *>>;
+    array<collections_t, 3> phases;
 
-    if (out.is_open()) {
-        LOG_INFO << "Dumping dependencies to: " << dotName;
+    forAllComponents([&phases](Component& c) {
+        if (c.payload_.empty()) {
+            return;
+        }
+
+        auto url = c.getCreationUrl();
+        size_t phase = 0;
+        if (c.kind_ == Kind::NAMESPACE) {
+            phase = 2;
+        } else if (url.find("/namespaces/") == string::npos) {
+            phase = 1;
+        }
+        phases[phase][move(url)].push_back(&c);
 
-        out << "digraph {" << endl;
-        out << "   subgraph components {" << endl;
-        out << R"(      label="Components";)" << endl;
+        if (c.kind_ == Kind::STATEFULSET && !c.storage.empty()) {
+            // The claims made from the volumeClaimTemplates are labeled, but not ours
+            phases[0].try_emplace(c.cluster_->getUrl() + "/api/v1/namespaces/"
+                                  + c.getNamespace() + "/persistentvolumeclaims");
+        }
+    });
 
-        forAllComponents([&](Component& c) {
-            for (const auto& dep : c.dependsOn_) {
-                if (auto d = dep.lock()) {
-                    out << "      \"" << boost::trim_right_copy(c.logName())
-                        << "\" -> \"" << boost::trim_right_copy(d->logName()) << '"' << endl;
-                }
+    // The removal tasks that are not about a k8 object still have to run
+    vector<string> dnsNames;
+    if (cluster_->getDns()) {
+        forAllComponents([&dnsNames](Component& c) {
+            for(auto& host : c.dnsNames()) {
+                dnsNames.push_back(move(host));
             }
         });
+    }
 
-        out << "   }" << endl;
-
-        if (tasks_) {
-            out << "   subgraph tasks {" << endl;
-            out << R"(      label="Tasks";)" << endl;
-
-            for(const auto& t : *tasks_) {
-                for (const auto& dw: t->dependencies()) {
-                    if (auto d = dw.lock()) {
-                        out << "      \"" << boost::trim_right_copy(t->component().logName()) << '.' << t->name()
-                            << "\" -> \""
-                            << boost::trim_right_copy(d->component().logName()) << '.' << d->name()
-                            << '"' << endl;
+    executionPromise_ = make_unique<promise<void>>();
+    auto future = executionPromise_->get_future();
+
+    client().Process([this, phases=move(phases), dnsNames=move(dnsNames)](Context& ctx) {
+        startTime = chrono::steady_clock::now();
+        setState(State::RUNNING);
+
+        const auto selector = Atom{Atom::K8DEP_DEPLOYMENT}.str() + "=" + name;
+        size_t failed = 0;
+
+        optional<chrono::steady_clock::time_point> deadline;
+        if (const auto timeout = Engine::config().deleteTimeout) {
+            deadline = chrono::steady_clock::now() + chrono::seconds(timeout);
+        }
+
+        for(const auto& collections : phases) {
+            // Send all the delete requests for the phase before we wait,
+            // so that the cluster can work on them in parallel.
+            struct Wait {
+                const string *url;
+                string selector;
+                set<string> names;
+            };
+            vector<Wait> waits;
+
+            for(const auto& [url, components] : collections) {
+                switch(deleteCollection(ctx, url, selector, logName())) {
+                case CollectionDelete::OK:
+                    waits.push_back({&url, selector, {}});
+                    break;
+                case CollectionDelete::NOT_SUPPORTED: {
+                    Wait w{&url, {}, {}};
+                    for(auto c : components) {
+                        if (deleteOne(ctx, url + "/" + c->objectName_, logName())) {
+                            w.names.insert(c->objectName_);
+                        } else {
+                            ++failed;
+                        }
+                    }
+                    if (!w.names.empty()) {
+                        waits.push_back(move(w));
                     }
+                } break;
+                case CollectionDelete::FAILED:
+                    ++failed;
+                    break;
                 }
             }
 
-            out << "   }" << endl;
+            for(const auto& w : waits) {
+                if (!waitUntilGone(ctx, *w.url, w.selector, w.names, deadline, logName())) {
+                    ++failed;
+                }
+            }
         }
 
-        out << "}" << endl;
-    }
+        if (auto dns = cluster_->getDns()) {
+            for(const auto& host : dnsNames) {
+                try {
+                    LOG_DEBUG << logName() << "Removing dns entry for " << host;
+                    dns->deleteHostname(host, [](bool /*success*/) {
+                        ; // just ignore, like the -provision-dns removal task
+                    });
+                } catch(const exception& ex) {
+                    LOG_WARN << logName() << " Failed to delete DNS name for " << host;
+                    ++failed;
+                }
+            }
+        }
 
-    return dummyReturnFuture();
-}
+        if (failed) {
+            LOG_WARN << logName() << failed << " delete request(s) or wait(s) failed";
+        }
+        setState(failed ? State::FAILED : State::DONE);
+    });
 
-std::future<void> Component::remove()
-{
-    return execute();
+    return future;
 }
 
 std::future<void> Component::execute()
@@ -705,35 +1629,20 @@ void Component::scanDependencies()
         if (isClusterVal) {
             if (auto cluster = Engine::instance().getCluster(clusterIx)) {
 
-                // Give the cluster a chance to initialize it's components
-                cluster->getBasicComponentsReady().wait();
-
-                auto ref = make_unique<DependencyReference>();
-                ref->name = depName;
-
-                if (cluster->addStateListener(componentName,
-                                              [this, dep=ref.get()](const Component& component) {
-
-                     auto st = component.getState();
-
-                     LOG_TRACE << logName() << "State Listener called on " << dep->name << ", state=" << static_cast<int>(st);
-
-                     // Called from the other components io thread.
-                     // We need to continue in our own thread.
-                     schedule([this, dep, st] {
-
-                        LOG_TRACE << logName() << "State Listener called on " << dep->name
-                              << ", state was " << static_cast<int>(dep->state)
-                              << ", changing to " << static_cast<int>(st);
-                        dep->state = st;
-                        scheduleRunTasks();
-                  });
-                })) {
-                    // Add reference to it so we wait for it
-                    LOG_DEBUG << logName() << "Added dependency to " << ref->name;
-                    clusterDependencies_.emplace_back(move(ref));
+                if (cluster_->isPrepared()) {
+                    // Called by reconcile(). The other cluster is already prepared.
+                    addClusterDependency(*cluster, depName, componentName);
+                    continue;
                 }
 
+                // Give the cluster a chance to initialize it's components.
+                // We can not block here, as we run in our clusters io-thread.
+                cluster_->resolveAfter(cluster->getBasicComponentsReady(),
+                                       "components in cluster"s + to_string(clusterIx),
+                                       [this, cluster, depName=depName, componentName=componentName] {
+                    addClusterDependency(*cluster, depName, componentName);
+                });
+
             } else {
                 // TODO: Should we accept this and just complain??
                 LOG_ERROR << "No known cluster with ID " << clusterIx << " in " << depName;
@@ -759,6 +1668,61 @@ void Component::scanDependencies()
 
 }
 
+void Component::addClusterDependency(Cluster &cluster, const string &depName,
+                                     const string &componentName)
+{
+    if (auto cycle = Engine::instance().findDependencyCycle(cluster_->id(), name)) {
+        LOG_ERROR << logName() << "Circular dependency across clusters: " << *cycle;
+        throw runtime_error("Circular dependency across clusters: "s + *cycle);
+    }
+
+    auto ref = make_unique<DependencyReference>();
+    ref->name = depName;
+
+    // We may be replaced by reconcile() while the other component lives on
+    if (cluster.addStateListener(componentName,
+                                  [wself=weak_from_this(), dep=ref.get()](const Component& component) {
+
+         auto self = wself.lock();
+         if (!self) {
+             return;
+         }
+
+         auto st = component.getState();
+
+         LOG_TRACE << self->logName() << "State Listener called on " << dep->name << ", state=" << static_cast<int>(st);
+
+         // Called from the other components io thread.
+         // We need to continue in our own thread.
+         self->schedule([wself, dep, st] {
+            if (auto self = wself.lock()) {
+                LOG_TRACE << self->logName() << "State Listener called on " << dep->name
+                          << ", state was " << static_cast<int>(dep->state)
+                          << ", changing to " << static_cast<int>(st);
+                dep->state = st;
+                self->scheduleRunTasks();
+            }
+      });
+    })) {
+        if (cluster_->isPrepared()) {
+            // The other component may be done already
+            if (auto other = cluster.getComponent(componentName)) {
+                ref->state = other->getState();
+            }
+        }
+
+        // Add reference to it so we wait for it
+        LOG_DEBUG << logName() << "Added dependency to " << ref->name;
+        clusterDependencies_.emplace_back(move(ref));
+    } else if (cluster_->isPrepared()) {
+        // Called by reconcile(). Don't apply a tree that lost the dependency.
+        LOG_ERROR << logName() << "Dependency to unknown component " << depName;
+        throw runtime_error("Dependency to unknown component "s + depName);
+    } else {
+        LOG_WARN << logName() << "Dependency to unknown component " << depName;
+    }
+}
+
 bool Component::hasBlockedState() const noexcept
 {
     return state_ == State::BLOCKED
@@ -910,6 +1874,11 @@ void Component::runTasks() {
         return;
     }
 
+    if (removalDone_) {
+        runRemovalTasks();
+        return;
+    }
+
     // Re-run the loop as long as any task changes it's state
     while(cluster_->isExecuting() && ! isDone()) {
         LOG_TRACE << logName() << "runTasks: Iterating over Components";
@@ -923,16 +1892,26 @@ void Component::runTasks() {
         bool again = componentChanged;
         bool allDone = true;
         assert(tasks_);
+        const auto limit = Engine::config().maxConcurrentTasks;
+        vector<Task *> ready;
         for(auto task : *tasks_) {
             again = task->evaluate() ? true : again;
             if (task->state() == Task::TaskState::READY) {
-                task->execute();
-                again = true;
+                if (limit) {
+                    ready.push_back(task.get());
+                } else {
+                    task->execute();
+                    again = true;
+                }
             }
 
             allDone = task->isDone() ? allDone : false;
         }
 
+        if (!ready.empty() && startReadyTasks(ready, limit)) {
+            again = true;
+        }
+
         if (!again) {
             // TODO: Add timer so we can time out if we don't catch or get
             // events to move the states to DONE.
@@ -950,6 +1929,31 @@ void Component::runTasks() {
 
 }
 
+bool Component::startReadyTasks(std::vector<Task *> &ready, size_t limit)
+{
+    const auto active = static_cast<size_t>(count_if(tasks_->begin(), tasks_->end(), [](const auto& task) {
+        return task->state() == Task::TaskState::EXECUTING || task->state() == Task::TaskState::WAITING;
+    }));
+
+    if (active >= limit) {
+        LOG_TRACE << logName() << "runTasks: " << ready.size() << " task(s) are waiting for one of the "
+                  << active << " active tasks to finish";
+        return false;
+    }
+
+    // The longest poles first
+    stable_sort(ready.begin(), ready.end(), [](Task *left, Task *right) {
+        return left->component().priority_ > right->component().priority_;
+    });
+
+    const auto start = min(limit - active, ready.size());
+    for(size_t i = 0; i < start; ++i) {
+        ready[i]->execute();
+    }
+
+    return true;
+}
+
 void Component::setIsDone()
 {
     LOG_TRACE << logName() << "Component::setIsDone: Called. Current state is " << toString(state_);
@@ -967,8 +1971,9 @@ void Component::setIsDone()
             return;
         }
 
-        if (auto seconds = getIntArg("delay.after", 0); seconds && !delayAfterTimerExceuted_) {
+        if (auto seconds = parsedArgs_.delayAfter; seconds && !delayAfterTimerExceuted_) {
             delayAfterTimerExceuted_ = false;
+            startTimer(Timeline::DELAY_AFTER);
             setState(State::POST_TIMER);
             LOG_DEBUG << logName() << "Setting " << seconds << " seconds 'delay.after' timer.";
             schedule([this] {
@@ -997,7 +2002,8 @@ void Component::setCanRun()
             return;
         }
 
-        if (auto seconds = getIntArg("delay.before", 0); seconds && !delayBeforeTimerExceuted_) {
+        if (auto seconds = parsedArgs_.delayBefore; seconds && !delayBeforeTimerExceuted_) {
+            startTimer(Timeline::DELAY_BEFORE);
             setState(State::PRE_TIMER);
             LOG_DEBUG << logName() << "Setting " << seconds << " seconds 'delay.before' timer.";
             delayBeforeTimerExceuted_ = false;
@@ -1017,8 +2023,9 @@ void Component::setCanRun()
             return;
         }
 
-        if (auto seconds = getIntArg("delay.sequence", 0); seconds && !delaySequenceTimerExceuted_) {
+        if (auto seconds = parsedArgs_.delaySequence; seconds && !delaySequenceTimerExceuted_) {
             delaySequenceTimerExceuted_ = false;
+            startTimer(Timeline::DELAY_SEQUENCE);
             setState(State::PRE_TIMER);
             LOG_DEBUG << logName() << "Setting " << seconds << " seconds 'delay.sequence' timer.";
             addToChannel(name, [w=weak_from_this(), seconds] {
@@ -1051,15 +2058,32 @@ void Component::setState(Component::State state)
 
     if (state == State::DONE) {
         calculateElapsed();
+        recordDuration();
         LOG_INFO << logName() << "Done in " << std::fixed << std::setprecision(5) << (elapsed ? *elapsed : 0.0) << " seconds";
 
+        if (auto metrics = Metrics::instance(); metrics && elapsed) {
+            const auto kind = toString(kind_);
+            metrics->observe("k8deployer_component_done_seconds",
+                             {{"cluster", cluster().name()}, {"kind", kind}}, *elapsed);
+            metrics->set("k8deployer_component_seconds",
+                         {{"cluster", cluster().name()}, {"component", name}, {"kind", kind}, {"result", "done"}},
+                         *elapsed);
+        }
+
         if (executionPromise_) {
             executionPromise_->set_value();
             executionPromise_.reset();
+            Engine::notifyPhaseDone();
+        }
+
+        if (executionDone_) {
+            auto done = move(executionDone_);
+            executionDone_ = {};
+            done({});
         }
 
         if (Engine::instance().mode() == Engine::Mode::DEPLOY) {
-            if (auto url = getArg("openInBrowser")) {
+            if (auto url = getArg(Atom::OPEN_IN_BROWSER)) {
                 if (!Engine::config().webBrowser.empty()) {
                     auto cmd = Engine::config().webBrowser + " " + *url + " &";
                     LOG_DEBUG << logName() << "Executing: " << cmd;
@@ -1072,12 +2096,47 @@ void Component::setState(Component::State state)
     if (state == State::FAILED) {
         calculateElapsed();
         LOG_WARN << logName() << "Failed after " << std::fixed << std::setprecision(5) << (elapsed ? *elapsed : 0.0) << " seconds";
+
+        if (auto metrics = Metrics::instance(); metrics && elapsed) {
+            metrics->set("k8deployer_component_seconds",
+                         {{"cluster", cluster().name()}, {"component", name}, {"kind", toString(kind_)}, {"result", "failed"}},
+                         *elapsed);
+        }
+
+        if (executionPromise_) {
+            executionPromise_->set_exception(make_exception_ptr(
+                runtime_error{logName() + "Failed"}));
+            executionPromise_.reset();
+            Engine::notifyPhaseDone();
+        }
+
+        if (executionDone_) {
+            auto done = move(executionDone_);
+            executionDone_ = {};
+            done(make_exception_ptr(runtime_error{logName() + "Failed"}));
+        }
         if (auto parent = parent_.lock()) {
             parent->evaluate();
             scheduleRunTasks();
         }
     }
 
+    const auto now = chrono::steady_clock::now();
+    if (auto tracer = Tracer::instance()) {
+        tracer->span(cluster().name(), name, toString(state_), "component", stateSince_, now);
+    }
+    stateSince_ = now;
+
+    if (state != State::PRE_TIMER && state != State::POST_TIMER) {
+        stopTimer();
+    }
+    if ((state == State::PRE_TIMER || state == State::RUNNING) && !timeline_.started) {
+        timeline_.started = now;
+    }
+    if (state == State::DONE || state == State::FAILED) {
+        timeline_.done = now;
+    }
+
     state_ = state;
 
     if (state_ >= State::RUNNING && (state_ != State::PRE_TIMER && state_ != State::POST_TIMER)) {
@@ -1087,19 +2146,30 @@ void Component::setState(Component::State state)
         scheduleRunTasks();
     }
 
-    // Call state listeners
-    decltype(stateListeners_) copy;
-    {
-        lock_guard<mutex> lock_{mutex_};
-        copy = stateListeners_;
-    }
-    for(auto const& fn : copy) {
-        if (fn) {
-            fn(*this);
+    // Call state listeners.
+    // Listeners added while we iterate are not called for this change.
+    for(auto l = stateListeners_.load(memory_order_acquire); l != nullptr; l = l->next) {
+        if (l->fn) {
+            l->fn(*this);
         }
     }
 }
 
+void Component::startTimer(Timeline::Timer timer)
+{
+    stopTimer();
+    pendingTimer_ = timer;
+    timerSince_ = chrono::steady_clock::now();
+}
+
+void Component::stopTimer()
+{
+    if (timerSince_) {
+        timeline_.timers[pendingTimer_] += chrono::duration<double>(chrono::steady_clock::now() - *timerSince_).count();
+        timerSince_.reset();
+    }
+}
+
 void Component::forAllComponents(const std::function<void (Component &)>& fn)
 {
     getRoot().walkAndExecuteFn(fn);
@@ -1358,8 +2428,59 @@ std::future<void> dummyReturnFuture()
 
 void Component::validate()
 {
-    // TODO: Implement.
-    // Add sanity checks, like; A Deployment owns it's Service, not the other way around...
+    // TODO: Add sanity checks, like; A Deployment owns it's Service, not the other way around...
+
+    argErrors_.clear();
+    parsedArgs_ = {};
+    auto& pa = parsedArgs_;
+
+    auto parse = [&](Atom name, const auto& fn) {
+        if (auto value = findArg(name)) {
+            try {
+                fn(*value);
+            } catch(const exception& ex) {
+                argErrors_.push_back(logName() + "Invalid argument " + name.str()
+                                     + "=\"" + *value + "\": " + ex.what());
+            }
+        }
+    };
+
+    // If a resource is not specified, fall back to the common value
+    auto resource = [&](Atom name, Atom fallback, string& value) {
+        if (auto v = findArg(name); v && !v->empty()) {
+            value = *v;
+        } else if (auto v = findArg(fallback); v && !v->empty()) {
+            value = *v;
+        }
+    };
+
+    parse(Atom::DELAY_BEFORE, [&](const string& v) { pa.delayBefore = v.empty() ? 0 : stoi(v);});
+    parse(Atom::DELAY_AFTER, [&](const string& v) { pa.delayAfter = v.empty() ? 0 : stoi(v);});
+    parse(Atom::DELAY_SEQUENCE, [&](const string& v) { pa.delaySequence = v.empty() ? 0 : stoi(v);});
+
+    switch(kind_) {
+    case Kind::DEPLOYMENT:
+    case Kind::STATEFULSET:
+        parse(Atom::REPLICAS, [&](const string& v) { pa.replicas = stoull(v);});
+        parse(Atom::SERVICE_ENABLED, [&](const string&) { pa.serviceEnabled = getBoolArg(Atom::SERVICE_ENABLED);});
+        [[fallthrough]];
+    case Kind::JOB:
+    case Kind::DAEMONSET:
+        parse(Atom::POD_ARGS, [&](const string& v) { pa.podArgs = getArgAsStringList(v);});
+        parse(Atom::POD_COMMAND, [&](const string& v) { pa.podCommand = getArgAsStringList(v);});
+        parse(Atom::POD_ENV, [&](const string& v) { pa.podEnv = getArgAsEnvList(v);});
+        parse(Atom::POD_SCC_ADD, [&](const string& v) { pa.sccAdd = getArgAsStringList(v);});
+        resource(Atom::POD_LIMITS_MEMORY, Atom::POD_MEMORY, pa.limitsMemory);
+        resource(Atom::POD_LIMITS_CPU, Atom::POD_CPU, pa.limitsCpu);
+        resource(Atom::POD_REQUESTS_MEMORY, Atom::POD_MEMORY, pa.requestsMemory);
+        resource(Atom::POD_REQUESTS_CPU, Atom::POD_CPU, pa.requestsCpu);
+        [[fallthrough]];
+    case Kind::SERVICE:
+        parse(Atom::PORT, [&](const string& v) { pa.ports = parsePorts(v);});
+        break;
+    default:
+        ; // No typed arguments
+    }
 }
 
 bool Component::hasKindAsChild(Kind kind) const
@@ -1404,36 +2525,78 @@ Component::ptr_t Component::addChild(const string &name, Kind kind, const labels
     assert(cluster_);
     auto component = createComponent(def, shared_from_this(), *cluster_);
     component->init();
+    if (!component->argErrors_.empty()) {
+        LOG_ERROR << component->argErrors_.front();
+        throw runtime_error("Invalid argument in "s + component->name);
+    }
     children_.push_back(component);
     return component;
 }
 
 void Component::addStateListener(const std::function<void (const Component &)>& fn)
 {
-    lock_guard<mutex> lock_{mutex_};
-    stateListeners_.emplace_back(fn);
+    // Called from any thread
+    auto listener = new StateListener{fn, stateListeners_.load(memory_order_relaxed)};
+    while(!stateListeners_.compare_exchange_weak(listener->next, listener,
+                                                 memory_order_release,
+                                                 memory_order_relaxed))
+        ;
 }
 
-conf_t Component::mergeArgs() const
+void Component::mergeArgs()
 {
-    conf_t merged = args;
-    for(const auto node: getPathToRoot()) {
-        for(const auto& [k, v]: node->defaultArgs) {
-            // Inconsistency...
-            // For some values, we merge the strings, for others we only provide defaults.
-            if (k == "pod.args" || k == "pod.env") {
-                auto& m = merged[k];
-                if (!m.empty()) {
-                   m += " ";
-                }
-                m += v;
+    // Inconsistency...
+    // For some values, we merge the strings, for others we only provide defaults.
+    static const auto isConcatenated = [](Atom name) {
+        return name == Atom::POD_ARGS || name == Atom::POD_ENV;
+    };
+
+    static const auto append = [](string& to, const string& what) {
+        if (!what.empty()) {
+            if (!to.empty()) {
+               to += " ";
+            }
+            to += what;
+        }
+    };
+
+    const auto parent = parentPtr();
+    if (defaultArgs.empty() && parent && parent->defaults_) {
+        defaults_ = parent->defaults_;
+    } else {
+        auto defaults = (parent && parent->defaults_)
+                ? make_shared<args_t>(*parent->defaults_)
+                : make_shared<args_t>();
+
+        for(const auto& [name, v]: defaultArgs) {
+            const auto k = Atom::intern(name);
+            if (isConcatenated(k)) {
+                // Our own defaults goes before the inherited ones
+                auto value = v;
+                append(value, (*defaults)[k]);
+                (*defaults)[k] = move(value);
             } else {
-                merged.try_emplace(k, v);
+                (*defaults)[k] = v;
             }
         }
+
+        defaults_ = move(defaults);
+    }
+
+    ownArgs_.clear();
+    ownArgs_.reserve(args.size());
+    // conf_t is sorted by name, not by atom, so let the flat_map sort it once.
+    for(const auto& [name, v]: args) {
+        ownArgs_.emplace(Atom::intern(name), v);
     }
 
-    return merged;
+    for(auto& [k, v] : ownArgs_) {
+        if (isConcatenated(k)) {
+            if (auto it = defaults_->find(k); it != defaults_->end()) {
+                append(v, it->second);
+            }
+        }
+    }
 }
 
 std::vector<const Component*> Component::getPathToRoot() const
@@ -1445,6 +2608,19 @@ std::vector<const Component*> Component::getPathToRoot() const
     return path;
 }
 
+bool Component::hasSameArgs(const Component &other) const
+{
+    if (ownArgs_ != other.ownArgs_) {
+        return false;
+    }
+
+    if (defaults_ && other.defaults_) {
+        return *defaults_ == *other.defaults_;
+    }
+
+    return !defaults_ == !other.defaults_;
+}
+
 const Component *Component::parentPtr() const
 {
     if (auto parent = parent_.lock()) {
@@ -1460,8 +2636,41 @@ bool Component::Task::setState(Component::Task::TaskState state, bool scheduleRu
               << toString(state_) << " to " << toString(state);
 
     const bool changed = state_ != state;
+    const auto previous = state_;
     state_ = state;
 
+    if (changed) {
+        const auto now = chrono::steady_clock::now();
+        if (auto tracer = Tracer::instance()) {
+            tracer->span(component().cluster().name(), journalKey(), toString(previous), "task",
+                         stateSince_, now);
+        }
+
+        if (state == TaskState::DONE
+                && (previous == TaskState::EXECUTING || previous == TaskState::WAITING)) {
+            component().timeline_.tasksDone = now;
+        }
+
+        if (previous == TaskState::WAITING) {
+            auto& timeline = component().timeline_;
+            timeline.probing += chrono::duration<double>(now - stateSince_).count();
+            if (state == TaskState::DONE && pollScheduled_) {
+                // The object got ready some time after the probe before the last one
+                timeline.pollLatency = max(timeline.pollLatency,
+                                           chrono::duration<double>(now - *pollScheduled_).count());
+            }
+        }
+        stateSince_ = now;
+
+        if (auto journal = Engine::instance().journal()) {
+            journal->record(component().cluster().name(), journalKey(), toString(state));
+        }
+        if (auto metrics = Metrics::instance()) {
+            metrics->inc("k8deployer_task_transitions_total",
+                         {{"cluster", component().cluster().name()}, {"state", toString(state)}});
+        }
+    }
+
     if (changed && state == TaskState::EXECUTING) {
       component().startElapsedTimer();
     }
@@ -1540,6 +2749,7 @@ void Component::Task::schedulePoll()
     component().schedule([wself = weak_from_this()] {
         if (auto self = wself.lock()) {
             if (!self->pollTimer_) {
+                self->pollScheduled_ = chrono::steady_clock::now();
                 self->pollTimer_ = make_unique<boost::asio::deadline_timer>(
                             self->component().cluster().client().GetIoService(),
                             boost::posix_time::seconds{2});
@@ -1552,7 +2762,8 @@ void Component::Task::schedulePoll()
                             return;
                         }
 
-                        if (!self->component().probe([wself](auto state) {
+                        self->component().probeTrack_ = self->journalKey();
+                        const auto probing = self->component().probe([wself](auto state) {
                             if (auto self = wself.lock()) {
                                 if (self->mode() == Mode::REMOVE) {
                                    if (state == K8ObjectState::DONT_EXIST || state == K8ObjectState::DONE) {
@@ -1583,7 +2794,9 @@ void Component::Task::schedulePoll()
                                         self->component().scheduleRunTasks();
                                 }
                             }
-                        })) {
+                        });
+                        self->component().probeTrack_.clear();
+                        if (!probing) {
                             // Probes unavailable
                             LOG_DEBUG << self->component().logName() << "Probes not available";
                         }
@@ -1659,6 +2872,9 @@ string fileToJson(const string &pathToFile, bool assumeYaml,
         bool cleanUp = false;
 
         if (inputPreprocessor) {
+           // Process the input first, so we don't leave a tmp file behind if it throws
+           const auto processed = inputPreprocessor(slurp(pathToFile));
+
            auto tmpPath = std::filesystem::temp_directory_path();
            tmpPath /= "k8deployer-"s + to_string(getpid()) + "-" + to_string(++cnt) + ".yaml";
            inputPath = tmpPath.string();
@@ -1669,12 +2885,13 @@ string fileToJson(const string &pathToFile, bool assumeYaml,
               throw runtime_error{"Failed to pen tmp file for wtite"};
            }
            LOG_TRACE << "Writing tmp yaml file to " << inputPath;
-           tmp << inputPreprocessor(slurp(pathToFile));
+           tmp << processed;
            cleanUp = true;
         }
 
         // https://www.commandlinefu.com/commands/view/12218/convert-yaml-to-json
         // fix : https://stackoverflow.com/questions/69564817/typeerror-load-missing-1-required-positional-argument-loader-in-google-col
+        Profiler::Scope profile{Profiler::Phase::YAML};
         const auto expr = R"(import sys, yaml, json; json.dump(yaml.safe_load(open(")"s
                 + inputPath
                 + R"(","r").read()), sys.stdout, indent=4))"s;
@@ -1688,8 +2905,20 @@ string fileToJson(const string &pathToFile, bool assumeYaml,
             json += line;
         }
 
+        // Reap it ourself, so we get the CPU time for just this subprocess.
+        // The process-wide RUSAGE_CHILDREN would include the subprocesses
+        // for other clusters that are prepared at the same time.
         error_code ec;
-        process.wait(ec);
+        rusage usage = {};
+        int status = 0;
+        if (::wait4(process.id(), &status, 0, &usage) == process.id()) {
+            process.detach();
+            profile.addChildCpu(usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+                                + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6);
+        } else {
+            ec = {errno, system_category()};
+            process.wait(ec);
+        }
 
         if (cleanUp) {
             filesystem::remove(inputPath);
@@ -1713,6 +2942,118 @@ string fileToJson(const string &pathToFile, bool assumeYaml,
     return json;
 }
 
+void Component::sendApplyJson(string json, const string &url, std::weak_ptr<Task> task,
+                              const Request::Type requestType)
+{
+    client().Process([this, url, task, json=move(json), requestType](auto& ctx) {
+        std::string taskName = "***";
+        if (auto t = task.lock()) {
+            taskName = t->name();
+        }
+        LOG_DEBUG << logName() << "Applying task " << taskName << " to " << url;
+        LOG_TRACE << logName() << "Applying payload for task " << taskName << ": " << json;
+        std::string contentType = "application/json; charset=utf-8";
+        if (requestType == restc_cpp::Request::Type::PATCH) {
+            contentType = "application/merge-patch+json; charset=utf-8";
+        }
+
+        const auto verb = applyServerSide_ && requestType == Request::Type::POST
+                ? Request::Type::PATCH : requestType;
+        Metrics::ApiCall call{cluster().name(), Metrics::toVerb(verb), toString(kind_), name};
+        if (auto t = task.lock()) {
+            call.track(t->journalKey());
+        }
+        try {
+            auto reply = requestType == Request::Type::POST
+                ? sendCreate(ctx, url, json)
+                : restc_cpp::RequestBuilder{ctx}.Req(url, requestType)
+                   .Header("Content-Type", contentType)
+                   .Data(json)
+                   .Execute();
+            call.status(reply->GetResponseCode());
+
+            LOG_DEBUG << logName()
+                  << "Applying task " << taskName << " gave response: "
+                  << reply->GetResponseCode() << ' '
+                  << reply->GetHttpResponse().reason_phrase;
+
+            if (auto t = task.lock()) {
+                if (t->startProbeAfterApply /* && Engine::mode() != Engine::Mode::DELETE*/) {
+                    t->setState(Task::TaskState::WAITING);
+                    t->schedulePoll();
+                } else {
+                    // Assume that tasks that don't need polling are OK after create.
+                    t->setState(Task::TaskState::DONE);
+                }
+            }
+
+            return;
+        } catch(const restc_cpp::RequestFailedWithErrorException& err) {
+            call.status(err.http_response.status_code);
+            if (err.http_response.status_code == 404) {
+                if (auto t = task.lock()) {
+                    if (t->mode() == Mode::REMOVE) {
+                        LOG_DEBUG << logName()
+                                  << "Applying REMOVE task " << taskName << " to already deleted resource. Probably ok: "
+                                  << err.http_response.status_code << ' '
+                                  << err.http_response.reason_phrase;
+                        t->setState(Task::TaskState::DONE);
+                        return;
+                    }
+                }
+            }
+
+            if (err.http_response.status_code == 409) {
+                if (auto t = task.lock()) {
+                    if (t->mode() == Mode::CREATE && t->dontFailIfAlreadyExists) {
+                        LOG_DEBUG << logName()
+                                  << "Applying task " << taskName << " to existing resource. Probably ok: "
+                                  << err.http_response.status_code << ' '
+                                  << err.http_response.reason_phrase;
+                        t->setState(Task::TaskState::DONE);
+                        return;
+                    }
+                }
+            }
+
+            LOG_WARN << logName()
+                     << "Apply task " << taskName << ": Request failed: " << err.http_response.status_code
+                     << ' ' << err.http_response.reason_phrase
+                     << ": " << err.what();
+
+        } catch(const std::exception& ex) {
+            LOG_WARN << logName()
+                     << "Apply task " << taskName << ": Request failed: " << ex.what();
+        }
+
+        if (auto taskInstance = task.lock()) {
+            taskInstance->setState(Task::TaskState::FAILED);
+        }
+        setState(State::FAILED);
+
+    });
+}
+
+std::unique_ptr<Reply> Component::sendCreate(Context &ctx, const string &url, const string &json)
+{
+    if (applyServerSide_) {
+        LOG_TRACE << logName() << "Server-side apply to " << url << "/" << objectName_;
+
+        // Json is valid yaml
+        return RequestBuilder{ctx}.Req(url + "/" + objectName_, Request::Type::PATCH)
+           .Argument("fieldManager", "k8deployer")
+           .Argument("force", "true")
+           .Header("Content-Type", "application/apply-patch+yaml")
+           .Data(json)
+           .Execute();
+    }
+
+    return RequestBuilder{ctx}.Post(url)
+       .Header("Content-Type", "application/json; charset=utf-8")
+       .Data(json)
+       .Execute();
+}
+
 void Component::sendDelete(const string &url, std::weak_ptr<Component::Task> task,
                            bool ignoreErrors,
                            const initializer_list<std::pair<string, string>>& args)
@@ -1721,21 +3062,55 @@ void Component::sendDelete(const string &url, std::weak_ptr<Component::Task> tas
 
         LOG_DEBUG << logName() << "Sending DELETE " << url;
 
+        Metrics::ApiCall call{cluster().name(), "DELETE", toString(kind_), name};
+        if (auto t = task.lock()) {
+            call.track(t->journalKey());
+        }
         try {
             auto reply = restc_cpp::RequestBuilder{ctx}.Req(url, Request::Type::DELETE, args)
                .Execute();
+            call.status(reply->GetResponseCode());
 
             LOG_DEBUG << logName()
                   << "Delete gave response: "
                   << reply->GetResponseCode() << ' '
                   << reply->GetHttpResponse().reason_phrase;
 
-            // We don't get any event's related to deleting the deployment, so just update the states.
-            if (auto taskInstance = task.lock()) {
+            auto taskInstance = task.lock();
+            if (taskInstance && args.size() == 0) {
+                // The object may remain for a while, for example until its finalizers
+                // are done. Let the task wait until it's gone.
+                auto [uid, selector] = getUidAndSelector(reply->GetBodyAsString());
+                cluster().deletionTracker().track(url, move(uid), move(selector),
+                                                  [wself=weak_from_this(), task, ignoreErrors](bool gone) {
+                    auto self = wself.lock();
+                    auto taskInstance = task.lock();
+                    if (!self || !taskInstance) {
+                        return;
+                    }
+
+                    if (gone) {
+                        LOG_TRACE << self->logName() << "Deleted object is gone: " << taskInstance->name();
+                        taskInstance->setState(Task::TaskState::DONE);
+                    } else {
+                        LOG_WARN << self->logName() << "Deleted object is still there: " << taskInstance->name();
+                        taskInstance->setState(ignoreErrors ? Task::TaskState::DONE : Task::TaskState::FAILED);
+                        if (!ignoreErrors) {
+                            self->setState(State::FAILED);
+                        }
+                    }
+                    self->scheduleRunTasks();
+                });
+                return;
+            }
+
+            // Deleting a collection. We don't wait for the objects.
+            if (taskInstance) {
                 taskInstance->setState(Task::TaskState::DONE);
             }
             return;
         } catch(const restc_cpp::RequestFailedWithErrorException& err) {
+            call.status(err.http_response.status_code);
             if (err.http_response.status_code == 404) {
                 // Perfectly OK
                 if (auto taskInstance = task.lock()) {
@@ -0,0 +1,129 @@
+#include <map>
+#include <set>
+#include <sstream>
+#include <string_view>
+
+#include "k8deployer/ComponentDiff.h"
+
+using namespace std;
+
+namespace k8deployer {
+
+namespace {
+
+bool hasReadiness(Kind kind) {
+    switch(kind) {
+    case Kind::DEPLOYMENT:
+    case Kind::STATEFULSET:
+    case Kind::DAEMONSET:
+    case Kind::JOB:
+        return true;
+    default:
+        return false;
+    }
+}
+
+} // anon ns
+
+ComponentDiff::ComponentDiff(Component &previous, Component &current)
+{
+    // The names are owned by the components, which outlive the diff
+    using key_t = pair<Kind, string_view>;
+    map<key_t, Component *> before;
+    previous.forAllComponents([&before](Component& c) {
+        before.emplace(key_t{c.getKind(), c.name}, &c);
+    });
+
+    entries_.reserve(before.size() + 8);
+
+    // Workloads that will change their readiness
+    set<string_view> restarted;
+
+    current.forAllComponents([&](Component& c) {
+        auto it = before.find({c.getKind(), c.name});
+        if (it == before.end()) {
+            add(Action::CREATE, &c, nullptr);
+        } else {
+            auto prev = it->second;
+            before.erase(it);
+
+            const bool changed = c.payload().empty() && prev->payload().empty()
+                    ? !c.hasSameArgs(*prev)
+                    : c.payload() != prev->payload();
+
+            add(changed ? Action::UPDATE : Action::UNCHANGED, &c, prev);
+            if (!changed) {
+                return;
+            }
+        }
+
+        if (hasReadiness(c.getKind())) {
+            restarted.insert(c.name);
+        }
+    });
+
+    // Whatever is left in `before` was removed. Report it in tree order.
+    if (!before.empty()) {
+        previous.forAllComponents([&](Component& c) {
+            if (before.find({c.getKind(), c.name}) != before.end()) {
+                add(Action::DELETE, nullptr, &c);
+            }
+        });
+    }
+
+    if (restarted.empty()) {
+        return;
+    }
+
+    for(auto& e : entries_) {
+        if (e.action != Action::UNCHANGED) {
+            continue;
+        }
+
+        auto& c = *e.current;
+        bool reprobe = false;
+        for(const auto& dep : c.depends) {
+            if (restarted.find(dep) != restarted.end()) {
+                reprobe = true;
+                break;
+            }
+        }
+
+        if (!reprobe && c.parentRelation() == Component::ParentRelation::AFTER) {
+            if (auto parent = c.parentPtr()) {
+                reprobe = restarted.find(parent->name) != restarted.end();
+            }
+        }
+
+        if (reprobe) {
+            --counts_[static_cast<size_t>(Action::UNCHANGED)];
+            ++counts_[static_cast<size_t>(Action::REPROBE)];
+            e.action = Action::REPROBE;
+        }
+    }
+}
+
+string ComponentDiff::summary() const
+{
+    ostringstream out;
+    out << count(Action::CREATE) << " to create, "
+        << count(Action::UPDATE) << " to update, "
+        << count(Action::DELETE) << " to delete, "
+        << count(Action::REPROBE) << " to re-probe, "
+        << count(Action::UNCHANGED) << " unchanged";
+    return out.str();
+}
+
+string ComponentDiff::toString(ComponentDiff::Action action)
+{
+    static const array<string, 5> names = {"create", "update", "delete", "unchanged", "re-probe"};
+    return names.at(static_cast<size_t>(action));
+}
+
+void ComponentDiff::add(ComponentDiff::Action action, Component *current, Component *previous)
+{
+    entries_.push_back({action, current, previous});
+    ++counts_.at(static_cast<size_t>(action));
+}
+
+} // ns
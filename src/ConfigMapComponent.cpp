@@ -35,7 +35,7 @@ void ConfigMapComponent::prepareDeploy()
             configmap.metadata.namespace_ = getNamespace();
         }
 
-        if (auto fileNames = getArg("config.fromFile")) {
+        if (auto fileNames = getArg(Atom::CONFIG_FROM_FILE)) {
             vector<string> files;
             boost::split(files, *fileNames, boost::is_any_of(","));
             for(const auto fileName : files) {
@@ -96,10 +96,7 @@ void ConfigMapComponent::addRemovementTasks(Component::tasks_t &tasks)
 
 void ConfigMapComponent::doDeploy(std::weak_ptr<Component::Task> task)
 {
-    auto url = cluster_->getUrl()
-            + "/api/v1/namespaces/"
-            + getNamespace()
-            + "/configmaps";
+    const auto url = getCreationUrl();
 
     client().Process([this, url, task](Context& ctx) {
 
@@ -107,12 +104,10 @@ void ConfigMapComponent::doDeploy(std::weak_ptr<Component::Task> task)
                   << "Sending ConfigMap "
                   << configmap.metadata.name;
 
-        LOG_TRACE << "Payload: " << toJson(configmap);
+        LOG_TRACE << "Payload: " << payload_;
 
         try {
-            auto reply = RequestBuilder{ctx}.Post(url)
-               .Data(configmap, jsonFieldMappings())
-               .Execute();
+            auto reply = sendCreate(ctx, url, payload_);
 
             LOG_DEBUG << logName()
                   << "Applying gave response: "
@@ -211,4 +206,14 @@ void ConfigMapComponent::doRemove(std::weak_ptr<Component::Task> task)
     });
 }
 
+string ConfigMapComponent::getCreationUrl() const
+{
+    const auto url = cluster_->getUrl()
+            + "/api/v1/namespaces/"
+            + getNamespace()
+            + "/configmaps";
+
+    return url;
+}
+
 } // ns
@@ -0,0 +1,316 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <optional>
+
+#include <boost/algorithm/string.hpp>
+
+#include "k8deployer/Component.h"
+#include "k8deployer/CriticalPath.h"
+#include "k8deployer/logging.h"
+
+using namespace std;
+
+namespace k8deployer {
+
+namespace {
+
+constexpr auto none = numeric_limits<size_t>::max();
+
+string nodeName(const Component& c)
+{
+    return boost::trim_right_copy(c.logName());
+}
+
+} // anon ns
+
+CriticalPath::CriticalPath(Component &root)
+{
+    // Only the components that actually ran are in the graph
+    build(root, [](const Component& c) {
+        return c.timeline().started && c.timeline().done;
+    });
+
+    if (nodes_.empty()) {
+        return;
+    }
+
+    auto origin = *nodes_.front().component->timeline().started;
+    for(const auto& node : nodes_) {
+        origin = min(origin, *node.component->timeline().started);
+    }
+
+    for(auto& node : nodes_) {
+        const auto& t = node.component->timeline();
+        node.start = chrono::duration<double>(*t.started - origin).count();
+        node.done = chrono::duration<double>(*t.done - origin).count();
+    }
+
+    analyze();
+}
+
+CriticalPath::CriticalPath(Component &root, const estimate_t &estimate)
+    : estimated_{true}
+{
+    build(root, [](const Component&) {
+        return true;
+    });
+
+    if (nodes_.empty()) {
+        return;
+    }
+
+    schedule(estimate);
+    analyze();
+}
+
+void CriticalPath::build(Component &root, const std::function<bool (const Component &)> &include)
+{
+    map<const Component *, size_t> index;
+    root.forAllComponents([&](Component& c) {
+        if (include(c)) {
+            index[&c] = nodes_.size();
+            Node node;
+            node.component = &c;
+            nodes_.push_back(move(node));
+        }
+    });
+
+    root.forAllComponents([&](Component& c) {
+        const auto it = index.find(&c);
+        if (it == index.end()) {
+            return;
+        }
+
+        auto& node = nodes_[it->second];
+        for(const auto& dep : c.dependencies()) {
+            if (auto d = dep.lock()) {
+                if (const auto dit = index.find(d.get()); dit != index.end()) {
+                    node.startsAfter.push_back(dit->second);
+                }
+            }
+        }
+
+        for(const auto& child : c.getChildren()) {
+            if (const auto cit = index.find(child.get()); cit != index.end()) {
+                if (child->parentRelation() == Component::ParentRelation::BEFORE) {
+                    node.startsAfter.push_back(cit->second);
+                } else {
+                    node.doneAfter.push_back(cit->second);
+                }
+            }
+        }
+    });
+}
+
+void CriticalPath::schedule(const estimate_t &estimate)
+{
+    // Start each component as soon as its predecessors allow it
+    enum class Visit { NO, ACTIVE, DONE };
+    vector<Visit> visits(nodes_.size(), Visit::NO);
+
+    function<void (size_t)> visit = [&](size_t ix) {
+        if (visits[ix] != Visit::NO) {
+            // ACTIVE is a circular dependency. It's reported when the tasks are prepared.
+            return;
+        }
+        visits[ix] = Visit::ACTIVE;
+
+        auto& node = nodes_[ix];
+        for(const auto p : node.startsAfter) {
+            visit(p);
+            node.start = max(node.start, nodes_[p].done);
+        }
+
+        const auto duration = estimate(*node.component);
+        node.unknown = !duration;
+        node.done = node.start + duration.value_or(0.0);
+
+        for(const auto p : node.doneAfter) {
+            visit(p);
+            node.done = max(node.done, nodes_[p].done);
+        }
+
+        visits[ix] = Visit::DONE;
+    };
+
+    for(size_t i = 0; i < nodes_.size(); ++i) {
+        visit(i);
+    }
+}
+
+void CriticalPath::analyze()
+{
+    size_t last = 0;
+    for(size_t i = 0; i < nodes_.size(); ++i) {
+        if (nodes_[i].done > nodes_[last].done) {
+            last = i;
+        }
+    }
+    total_ = nodes_[last].done;
+
+    // Walk backwards to the predecessor that was done last
+    for(auto current = last; current != none;) {
+        nodes_[current].critical = true;
+        path_.push_back(current);
+
+        auto next = none;
+        const auto& node = nodes_[current];
+        for(const auto *preds : {&node.startsAfter, &node.doneAfter}) {
+            for(const auto p : *preds) {
+                if (!nodes_[p].critical && (next == none || nodes_[p].done > nodes_[next].done)) {
+                    next = p;
+                }
+            }
+        }
+        current = next;
+    }
+    reverse(path_.begin(), path_.end());
+
+    // Latest finish times. The successors are always done after their predecessors.
+    vector<size_t> order(nodes_.size());
+    for(size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    sort(order.begin(), order.end(), [this](size_t left, size_t right) {
+        return nodes_[left].done > nodes_[right].done;
+    });
+
+    vector<double> latest(nodes_.size(), total_);
+    for(const auto ix : order) {
+        const auto& node = nodes_[ix];
+        for(const auto p : node.startsAfter) {
+            latest[p] = min(latest[p], latest[ix] - (node.done - node.start));
+        }
+        for(const auto p : node.doneAfter) {
+            latest[p] = min(latest[p], latest[ix]);
+        }
+    }
+
+    for(size_t i = 0; i < nodes_.size(); ++i) {
+        auto& node = nodes_[i];
+        node.slack = node.critical ? 0.0 : max(0.0, latest[i] - node.done);
+        node.latestStart = node.start + node.slack;
+    }
+}
+
+void CriticalPath::report(const string &logName) const
+{
+    if (nodes_.empty()) {
+        LOG_INFO << logName << "Critical path: No components were executed";
+        return;
+    }
+
+    vector<size_t> order(nodes_.size());
+    for(size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    stable_sort(order.begin(), order.end(), [this](size_t left, size_t right) {
+        return nodes_[left].start < nodes_[right].start;
+    });
+
+    if (estimated_) {
+        LOG_INFO << logName << "Estimated critical path (* marks the components on it, "
+                 << "? the ones without history). Times in seconds:";
+        LOG_INFO << logName << "  " << left << setw(40) << "component" << setw(20) << "kind"
+                 << right << setw(9) << "start" << setw(9) << "done" << setw(9) << "duration"
+                 << setw(9) << "slack";
+
+        size_t unknown = 0;
+        for(const auto ix : order) {
+            const auto& n = nodes_[ix];
+            LOG_INFO << logName << (n.critical ? "* " : "  ")
+                     << left << setw(40) << n.component->name
+                     << setw(20) << Component::toString(n.component->getKind())
+                     << right << fixed << setprecision(3)
+                     << setw(9) << n.start << setw(9) << n.done << setw(9) << (n.done - n.start)
+                     << setw(9) << n.slack << (n.unknown ? " ?" : "");
+            unknown += n.unknown ? 1 : 0;
+        }
+
+        LOG_INFO << logName << "Estimated duration: " << fixed << setprecision(3) << total_
+                 << " seconds, with " << path_.size() << " component(s) on the critical path. "
+                 << unknown << " of " << nodes_.size() << " component(s) have no history.";
+        return;
+    }
+
+    LOG_INFO << logName << "Critical path (* marks the components on it). Times in seconds:";
+    LOG_INFO << logName << "  " << left << setw(40) << "component" << setw(20) << "kind"
+             << right << setw(9) << "start" << setw(9) << "done" << setw(9) << "duration"
+             << setw(9) << "slack" << setw(9) << "before" << setw(9) << "sequence"
+             << setw(9) << "after" << setw(9) << "probing" << setw(9) << "poll";
+
+    double delays = 0, probing = 0;
+    for(const auto ix : order) {
+        const auto& n = nodes_[ix];
+        const auto& t = n.component->timeline();
+        LOG_INFO << logName << (n.critical ? "* " : "  ")
+                 << left << setw(40) << n.component->name
+                 << setw(20) << Component::toString(n.component->getKind())
+                 << right << fixed << setprecision(3)
+                 << setw(9) << n.start << setw(9) << n.done << setw(9) << (n.done - n.start)
+                 << setw(9) << n.slack << setw(9) << t.timers[Component::Timeline::DELAY_BEFORE]
+                 << setw(9) << t.timers[Component::Timeline::DELAY_SEQUENCE]
+                 << setw(9) << t.timers[Component::Timeline::DELAY_AFTER]
+                 << setw(9) << t.probing << setw(9) << t.pollLatency;
+
+        if (n.critical) {
+            for(const auto seconds : t.timers) {
+                delays += seconds;
+            }
+            probing += t.pollLatency;
+        }
+    }
+
+    LOG_INFO << logName << "Critical path: " << path_.size() << " component(s) in "
+             << fixed << setprecision(3) << total_ << " seconds, of which "
+             << delays << " seconds in delay timers and up to " << probing
+             << " seconds waiting for the next poll";
+}
+
+void CriticalPath::writeDot(ostream &out) const
+{
+    out << "digraph {" << endl;
+
+    for(const auto& n : nodes_) {
+        out << "   \"" << nodeName(*n.component) << "\" [label=\"" << nodeName(*n.component)
+            << fixed << setprecision(3) << "\\n" << (n.done - n.start) << "s, slack "
+            << n.slack << "s\"";
+        if (n.critical) {
+            out << " color=red";
+        }
+        out << ']' << endl;
+    }
+
+    // The edges on the critical path are the ones between two consecutive nodes on it
+    auto isCritical = [this](size_t from, size_t to) {
+        for(size_t i = 1; i < path_.size(); ++i) {
+            if (path_[i - 1] == from && path_[i] == to) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    for(size_t i = 0; i < nodes_.size(); ++i) {
+        const auto& n = nodes_[i];
+        for(const auto *preds : {&n.startsAfter, &n.doneAfter}) {
+            for(const auto p : *preds) {
+                out << "   \"" << nodeName(*n.component) << "\" -> \""
+                    << nodeName(*nodes_[p].component) << '"';
+                if (isCritical(p, i)) {
+                    out << " [color=red penwidth=2]";
+                } else if (preds == &n.doneAfter) {
+                    out << " [style=dashed]";
+                }
+                out << endl;
+            }
+        }
+    }
+
+    out << "}" << endl;
+}
+
+} // ns
@@ -44,7 +44,7 @@ void DaemonSetComponent::addRemovementTasks(Component::tasks_t &tasks)
 
 void DaemonSetComponent::doDeploy(std::weak_ptr<Component::Task> task)
 {
-    sendApply(daemonset, getCreationUrl(), task);
+    sendApplyJson(payload_, getCreationUrl(), task);
 }
 
 void DaemonSetComponent::doRemove(std::weak_ptr<Component::Task> task)
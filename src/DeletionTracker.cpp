@@ -0,0 +1,384 @@
+#include <algorithm>
+#include <cassert>
+
+#include <boost/asio.hpp>
+
+#include "restc-cpp/IteratorFromJsonSerializer.h"
+#include "restc-cpp/RequestBuilder.h"
+
+#include "k8deployer/Cluster.h"
+#include "k8deployer/Component.h"
+#include "k8deployer/DeletionTracker.h"
+#include "k8deployer/Engine.h"
+#include "k8deployer/Metrics.h"
+#include "k8deployer/k8/k8api.h"
+#include "k8deployer/logging.h"
+
+using namespace std;
+using namespace restc_cpp;
+
+namespace k8deployer {
+
+namespace {
+
+const string listAccept = "application/json;as=PartialObjectMetadataList;g=meta.k8s.io;v=v1,application/json";
+const string watchAccept = "application/json;as=PartialObjectMetadata;g=meta.k8s.io;v=v1,application/json";
+
+constexpr auto firstPollDelay = chrono::milliseconds{500};
+constexpr auto maxPollDelay = chrono::milliseconds{30000};
+
+// Seconds for each watch. A watch for one object is renewed more often,
+// so that objects tracked later are included soon.
+constexpr int64_t watchSeconds = 60;
+constexpr int64_t watchOneSeconds = 10;
+
+// Upper limit for remembered DELETED notifications in a collection
+constexpr size_t maxRemembered = 1024;
+
+void callAll(vector<DeletionTracker::done_t>& fns, bool gone) {
+    for(auto& fn : fns) {
+        fn(gone);
+    }
+}
+
+} // anon ns
+
+DeletionTracker::DeletionTracker(Cluster &cluster)
+    : cluster_{cluster}
+{
+}
+
+bool DeletionTracker::Query::covers(const Waiter &waiter) const
+{
+    if (argument.empty()) {
+        return true;
+    }
+
+    if (argument == "fieldSelector") {
+        return value == "metadata.name=" + waiter.name;
+    }
+
+    return value == waiter.selector;
+}
+
+void DeletionTracker::track(const string &url, string uid, string selector, done_t done)
+{
+    assert(done);
+    const auto pos = url.rfind('/');
+    assert(pos != string::npos);
+    auto collectionUrl = url.substr(0, pos);
+    auto name = url.substr(pos + 1);
+
+    optional<chrono::steady_clock::time_point> deadline;
+    if (const auto timeout = Engine::config().deleteTimeout) {
+        deadline = chrono::steady_clock::now() + chrono::seconds(timeout);
+    }
+
+    // A collection is in the map as long as its watch (or poll) runs
+    bool start = false, alreadyGone = false;
+    {
+        lock_guard<mutex> lock{mutex_};
+        auto [it, added] = collections_.try_emplace(collectionUrl);
+        auto& c = it->second;
+        if (auto d = c.deleted.find(name); d != c.deleted.end()
+                && (uid.empty() || d->second == uid)) {
+            c.deleted.erase(d);
+            alreadyGone = true;
+        } else {
+            c.waiters.push_back({move(name), move(uid), move(selector), deadline, move(done)});
+            if (!c.query.covers(c.waiters.back())) {
+                c.stale = true;
+            }
+            start = added;
+        }
+    }
+
+    if (alreadyGone) {
+        done(true);
+    } else if (start) {
+        watch(collectionUrl);
+    }
+}
+
+void DeletionTracker::watch(const string &url)
+{
+    cluster_.client().Process([this, url](Context& ctx) {
+        serialize_properties_t sp;
+        sp.name_mapping = jsonFieldMappings();
+
+        while(true) {
+            Query query;
+            optional<chrono::milliseconds> timeLeft;
+            if (!nextQuery(url, query, timeLeft)) {
+                return;
+            }
+
+            // List first, so that we know about objects that are already
+            // gone, and where to start watching.
+            string resourceVersion;
+            try {
+                RequestBuilder builder{ctx};
+                builder.Get(url).Header("Accept", listAccept);
+                if (!query.argument.empty()) {
+                    builder.Argument(query.argument, query.value);
+                }
+                auto reply = builder.Execute();
+
+                k8api::PartialObjectMetadataList list;
+                SerializeFromJson(list, *reply, jsonFieldMappings());
+
+                existing_t existing;
+                for(const auto& item : list.items) {
+                    existing.emplace(item.metadata.name, item.metadata.uid);
+                }
+
+                if (!completeGone(url, query, existing)) {
+                    return;
+                }
+                resourceVersion = list.metadata.resourceVersion;
+            } catch(const exception& ex) {
+                LOG_DEBUG << cluster_.name() << ": Failed to list " << url << ": "
+                          << ex.what() << ". Will poll.";
+                poll(url, firstPollDelay);
+                return;
+            }
+
+            auto seconds = query.argument == "fieldSelector" ? watchOneSeconds : watchSeconds;
+            if (timeLeft) {
+                // Wake up in time to fail the waiters that time out
+                seconds = clamp<int64_t>(chrono::duration_cast<chrono::seconds>(*timeLeft).count() + 1,
+                                         1, seconds);
+            }
+
+            try {
+                auto prop = make_shared<Request::Properties>();
+                prop->recvTimeout = (seconds + 30) * 1000;
+
+                RequestBuilder builder{ctx};
+                builder.Get(url)
+                        .Properties(prop)
+                        .Header("Accept", watchAccept)
+                        .Argument("watch", "true")
+                        .Argument("timeoutSeconds", to_string(seconds))
+                        .Argument("resourceVersion", resourceVersion);
+                if (!query.argument.empty()) {
+                    builder.Argument(query.argument, query.value);
+                }
+                auto reply = builder.Execute();
+
+                IteratorFromJsonSerializer<k8api::PartialObjectMetadataEvent> events{*reply, &sp, true};
+                for(const auto& event : events) {
+                    if (auto metrics = Metrics::instance()) {
+                        metrics->inc("k8deployer_watch_events_total", {{"cluster", cluster_.name()}, {"watch", "deletions"}});
+                    }
+                    if (event.type == "DELETED") {
+                        if (!completeDeleted(url, event.object.metadata.name, event.object.metadata.uid)) {
+                            return;
+                        }
+                        if (isStale(url)) {
+                            // List again, to include the objects tracked since
+                            break;
+                        }
+                    } else if (event.type == "ERROR") {
+                        // Typically an expired resourceVersion. List again.
+                        break;
+                    }
+                }
+            } catch(const RequestFailedWithErrorException& err) {
+                LOG_DEBUG << cluster_.name() << ": Cannot watch " << url << ": "
+                          << err.http_response.status_code << ' ' << err.http_response.reason_phrase
+                          << ". Will poll.";
+                poll(url, firstPollDelay);
+                return;
+            } catch(const exception& ex) {
+                // Timeout or disconnect. List again.
+                LOG_TRACE << cluster_.name() << ": Watch on " << url << " ended: " << ex.what();
+            }
+        }
+    });
+}
+
+void DeletionTracker::poll(const string &url, chrono::milliseconds delay)
+{
+    auto timer = make_shared<boost::asio::deadline_timer>(
+                cluster_.getIoService(), boost::posix_time::milliseconds(delay.count()));
+
+    timer->async_wait([this, timer, url, delay](auto err) {
+        if (err) {
+            LOG_WARN << cluster_.name() << ": Got error from poll timer for " << url << ": " << err;
+            return;
+        }
+
+        cluster_.client().Process([this, url, delay](Context& ctx) {
+            Query query;
+            optional<chrono::milliseconds> timeLeft;
+            if (!nextQuery(url, query, timeLeft)) {
+                return;
+            }
+
+            try {
+                RequestBuilder builder{ctx};
+                builder.Get(url).Header("Accept", listAccept);
+                if (!query.argument.empty()) {
+                    builder.Argument(query.argument, query.value);
+                }
+                auto reply = builder.Execute();
+
+                k8api::PartialObjectMetadataList list;
+                SerializeFromJson(list, *reply, jsonFieldMappings());
+
+                existing_t existing;
+                for(const auto& item : list.items) {
+                    existing.emplace(item.metadata.name, item.metadata.uid);
+                }
+
+                if (!completeGone(url, query, existing)) {
+                    return;
+                }
+            } catch(const exception& ex) {
+                LOG_WARN << cluster_.name() << ": Failed to poll " << url << ": " << ex.what();
+            }
+
+            auto next = min(delay * 2, maxPollDelay);
+            if (timeLeft) {
+                next = min(next, max(*timeLeft, firstPollDelay));
+            }
+            poll(url, next);
+        });
+    });
+}
+
+bool DeletionTracker::nextQuery(const string &url, Query &query,
+                                optional<chrono::milliseconds> &timeLeft)
+{
+    vector<done_t> expired;
+    bool left = true;
+    {
+        lock_guard<mutex> lock{mutex_};
+        auto it = collections_.find(url);
+        if (it == collections_.end()) {
+            return false;
+        }
+
+        auto& c = it->second;
+        const auto now = chrono::steady_clock::now();
+        optional<chrono::steady_clock::time_point> next;
+        for(auto w = c.waiters.begin(); w != c.waiters.end();) {
+            if (w->deadline && *w->deadline <= now) {
+                LOG_WARN << cluster_.name() << ": Timed out waiting for " << url << '/' << w->name
+                         << " to be deleted";
+                expired.push_back(move(w->done));
+                w = c.waiters.erase(w);
+                continue;
+            }
+            if (w->deadline && (!next || *w->deadline < *next)) {
+                next = w->deadline;
+            }
+            ++w;
+        }
+
+        if (c.waiters.empty()) {
+            collections_.erase(it);
+            left = false;
+        } else {
+            query = {};
+            if (c.waiters.size() == 1) {
+                query = {"fieldSelector", "metadata.name=" + c.waiters.front().name};
+            } else if (const auto& selector = c.waiters.front().selector; !selector.empty()
+                       && all_of(c.waiters.begin(), c.waiters.end(), [&selector](const Waiter& w) {
+                            return w.selector == selector;
+                        })) {
+                query = {"labelSelector", selector};
+            }
+
+            c.query = query;
+            c.stale = false;
+            if (next) {
+                timeLeft = chrono::duration_cast<chrono::milliseconds>(*next - now);
+            }
+        }
+    }
+
+    callAll(expired, false);
+    return left;
+}
+
+bool DeletionTracker::isStale(const string &url)
+{
+    lock_guard<mutex> lock{mutex_};
+    if (auto it = collections_.find(url); it != collections_.end()) {
+        return it->second.stale;
+    }
+    return false;
+}
+
+size_t DeletionTracker::completeGone(const string &url, const Query& query, const existing_t &existing)
+{
+    vector<done_t> done;
+    size_t left = 0;
+    {
+        lock_guard<mutex> lock{mutex_};
+        auto it = collections_.find(url);
+        if (it == collections_.end()) {
+            return 0;
+        }
+
+        auto& waiters = it->second.waiters;
+        for(auto w = waiters.begin(); w != waiters.end();) {
+            const auto e = existing.find(w->name);
+            if (query.covers(*w) && (e == existing.end() || (!w->uid.empty() && e->second != w->uid))) {
+                done.push_back(move(w->done));
+                w = waiters.erase(w);
+            } else {
+                ++w;
+            }
+        }
+
+        left = waiters.size();
+        if (!left) {
+            collections_.erase(it);
+        }
+    }
+
+    callAll(done, true);
+    return left;
+}
+
+size_t DeletionTracker::completeDeleted(const string &url, const string &name, const string &uid)
+{
+    vector<done_t> done;
+    size_t left = 0;
+    {
+        lock_guard<mutex> lock{mutex_};
+        auto it = collections_.find(url);
+        if (it == collections_.end()) {
+            return 0;
+        }
+
+        auto& c = it->second;
+        const auto w = find_if(c.waiters.begin(), c.waiters.end(), [&](const Waiter& w) {
+            return w.name == name && (w.uid.empty() || w.uid == uid);
+        });
+
+        if (w != c.waiters.end()) {
+            done.push_back(move(w->done));
+            c.waiters.erase(w);
+        } else {
+            // The DELETE reply may not have reached track() yet
+            if (c.deleted.size() >= maxRemembered) {
+                c.deleted.clear();
+            }
+            c.deleted[name] = uid;
+        }
+
+        left = c.waiters.size();
+        if (!left) {
+            collections_.erase(it);
+        }
+    }
+
+    callAll(done, true);
+    return left;
+}
+
+} // ns
@@ -15,8 +15,8 @@ namespace k8deployer {
 
 void DeploymentComponent::prepareDeploy()
 {
-    if (auto replicas = getArg("replicas")) {
-        deployment.spec.replicas = stoull(*replicas);
+    if (auto replicas = parsedArgs_.replicas) {
+        deployment.spec.replicas = *replicas;
     }
 
     basicPrepareDeploy();
@@ -44,7 +44,7 @@ void DeploymentComponent::buildDependencies()
     labels.emplace("app", name); // Use the name as selector
 
     // Check for docker hub secrets
-    if (auto dh = getArg("imagePullSecrets.fromDockerLogin")) {
+    if (auto dh = getArg(Atom::IMAGE_PULL_SECRETS_FROM_DOCKER_LOGIN)) {
         LOG_DEBUG << logName() << "Adding Docker credentials.";
 
         conf_t svcargs;
@@ -62,7 +62,7 @@ void DeploymentComponent::buildDependencies()
     }
 
     std::string tlsSecretName;
-    if (auto tls = getArg("tlsSecret")) {
+    if (auto tls = getArg(Atom::TLSSECRET)) {
         LOG_DEBUG << logName() << "Adding tls secret.";
 
         conf_t tlsargs;
@@ -80,15 +80,15 @@ void DeploymentComponent::buildDependencies()
     }
 
     // A deployment normally needs a service
-    const auto serviceEnabled = getBoolArg("service.enabled");
+    const auto serviceEnabled = parsedArgs_.serviceEnabled;
     if (!hasKindAsChild(Kind::SERVICE) && ((serviceEnabled && *serviceEnabled) || !serviceEnabled)) {
         LOG_DEBUG << logName() << "Adding Service.";
 
-        auto ports = parsePorts(getArg("port", ""));
+        const auto& ports = parsedArgs_.ports;
 
         // Split the ports into the potential different service types we need.
-        std::multimap<std::string, decltype(ports)> service_ports;
-        std::string override = getArg("service.type", "");
+        std::multimap<std::string, port_info_list_t> service_ports;
+        std::string override = getArg(Atom::SERVICE_TYPE, "");
         for(const auto& p : ports) {
             if (!p.serviceType.empty()) {
                 override = p.serviceType;
@@ -118,7 +118,7 @@ void DeploymentComponent::buildDependencies()
             }
 
             if (!added) {
-                decltype (ports) pp;
+                port_info_list_t pp;
                 pp.push_back(p);
                 service_ports.insert({key, pp});
             }
@@ -174,7 +174,7 @@ void DeploymentComponent::buildDependencies()
             auto service = addChild(svc_name,
                                     Kind::SERVICE, labels, svcargs, "before");
 
-            if (auto ip = getArg("ingress.paths"); ip && !ip->empty()) {
+            if (auto ip = getArg(Atom::INGRESS_PATHS); ip && !ip->empty()) {
                 if (!do_ingress) {
                     LOG_DEBUG << logName() << "Skipping ingress for service type " << type;
                     break;
@@ -207,7 +207,7 @@ void DeploymentComponent::buildDependencies()
     }
 
     // Check for config-files --> ConfigMap
-    if (auto fileNames = getArg("config.fromFile")) {
+    if (auto fileNames = getArg(Atom::CONFIG_FROM_FILE)) {
         LOG_DEBUG << logName() << "Adding ConfigMap.";
 
         conf_t svcargs;
@@ -251,7 +251,7 @@ void DeploymentComponent::buildDependencies()
 
 void DeploymentComponent::doDeploy(std::weak_ptr<Task> task)
 {
-    sendApply(deployment, getCreationUrl(), task);
+    sendApplyJson(payload_, getCreationUrl(), task);
 }
 
 void DeploymentComponent::doRemove(std::weak_ptr<Component::Task> task)
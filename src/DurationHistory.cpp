@@ -0,0 +1,155 @@
+#include <chrono>
+#include <iomanip>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+
+#include "k8deployer/DurationHistory.h"
+#include "k8deployer/logging.h"
+
+using namespace std;
+
+namespace k8deployer {
+
+namespace {
+
+// How much a new sample moves the average
+constexpr double weight = 0.3;
+
+} // anon ns
+
+DurationHistory::DurationHistory(const filesystem::path &dir)
+    : summaryPath_{dir / "durations.summary"}, logPath_{dir / "durations.log"}
+{
+    filesystem::create_directories(dir);
+    LOG_INFO << "Using the duration history in: " << dir;
+
+    load();
+    compact();
+}
+
+void DurationHistory::record(const string &cluster, const string &component,
+                             const string &kind, const string &image, double seconds)
+{
+    const auto now = chrono::duration_cast<chrono::milliseconds>(
+                chrono::system_clock::now().time_since_epoch()).count();
+    const auto key = toKey(cluster, component, kind, image);
+
+    lock_guard<mutex> lock{mutex_};
+    add(key, seconds);
+    log_ << now << '\t' << key << '\t' << fixed << setprecision(3) << seconds << endl;
+}
+
+optional<DurationHistory::Stats> DurationHistory::get(const string &cluster, const string &component,
+                                                      const string &kind, const string &image) const
+{
+    lock_guard<mutex> lock{mutex_};
+    if (auto it = stats_.find(toKey(cluster, component, kind, image)); it != stats_.end()) {
+        return it->second;
+    }
+    return {};
+}
+
+void DurationHistory::compact()
+{
+    lock_guard<mutex> lock{mutex_};
+    writeSummary();
+
+    // Everything in the log is now in the summary
+    log_.close();
+    log_.open(logPath_, ios_base::out | ios_base::trunc);
+    if (!log_) {
+        throw runtime_error("Failed to open "s + logPath_.string());
+    }
+}
+
+string DurationHistory::toKey(const string &cluster, const string &component,
+                              const string &kind, const string &image)
+{
+    return cluster + '\t' + component + '\t' + kind + '\t' + image;
+}
+
+void DurationHistory::add(const string &key, double seconds)
+{
+    auto& s = stats_[key];
+    s.average = s.samples ? s.average + weight * (seconds - s.average) : seconds;
+    s.last = seconds;
+    s.max = max(s.max, seconds);
+    ++s.samples;
+}
+
+void DurationHistory::load()
+{
+    string line;
+    vector<string> cols;
+
+    if (ifstream summary{summaryPath_}; summary.is_open()) {
+        while(getline(summary, line)) {
+            boost::split(cols, line, boost::is_any_of("\t"));
+            if (cols.size() != 8) {
+                LOG_WARN << "Ignoring malformed line in " << summaryPath_ << ": " << line;
+                continue;
+            }
+
+            try {
+                auto& s = stats_[toKey(cols[0], cols[1], cols[2], cols[3])];
+                s.samples = stoul(cols[4]);
+                s.average = stod(cols[5]);
+                s.last = stod(cols[6]);
+                s.max = stod(cols[7]);
+            } catch(const exception&) {
+                LOG_WARN << "Ignoring malformed line in " << summaryPath_ << ": " << line;
+            }
+        }
+    }
+
+    size_t samples = 0;
+    if (ifstream log{logPath_}; log.is_open()) {
+        while(getline(log, line)) {
+            boost::split(cols, line, boost::is_any_of("\t"));
+            if (cols.size() != 6) {
+                // Probably the last line, from a write that was interrupted
+                LOG_WARN << "Ignoring malformed line in " << logPath_ << ": " << line;
+                continue;
+            }
+
+            try {
+                add(toKey(cols[1], cols[2], cols[3], cols[4]), stod(cols[5]));
+                ++samples;
+            } catch(const exception&) {
+                LOG_WARN << "Ignoring malformed line in " << logPath_ << ": " << line;
+            }
+        }
+    }
+
+    LOG_DEBUG << "Loaded the duration history for " << stats_.size() << " components, and "
+              << samples << " new sample(s)";
+}
+
+void DurationHistory::writeSummary()
+{
+    auto tmp = summaryPath_;
+    tmp += ".tmp";
+
+    {
+        ofstream out{tmp, ios_base::out | ios_base::trunc};
+        if (!out) {
+            throw runtime_error("Failed to open "s + tmp.string());
+        }
+
+        out << fixed << setprecision(3);
+        for(const auto& [key, s] : stats_) {
+            out << key << '\t' << s.samples << '\t' << s.average << '\t' << s.last
+                << '\t' << s.max << '\n';
+        }
+
+        if (!out) {
+            throw runtime_error("Failed to write "s + tmp.string());
+        }
+    }
+
+    filesystem::rename(tmp, summaryPath_);
+}
+
+} // ns
@@ -1,4 +1,11 @@
+#include <algorithm>
+#include <array>
 #include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <set>
+#include <sstream>
 
 #include <boost/fusion/adapted.hpp>
 #include <boost/process.hpp>
@@ -9,6 +16,12 @@
 #include "k8deployer/logging.h"
 #include "k8deployer/Engine.h"
 #include "k8deployer/Component.h"
+#include "k8deployer/FileWatcher.h"
+#include "k8deployer/IoServicePool.h"
+#include "k8deployer/Journal.h"
+#include "k8deployer/RolloutController.h"
+#include "k8deployer/Tracer.h"
+#include "k8deployer/WorkerPool.h"
 
 using namespace std;
 using namespace chrono_literals;
@@ -30,6 +43,11 @@ Engine::Engine(const Config &config)
         mode_ = Mode::DELETE;
     } else if (cfg_.command == "depends") {
         mode_ = Mode::SHOW_DEPENDENCIES;
+    } else if (cfg_.command == "watch") {
+        mode_ = Mode::DEPLOY;
+        watch_ = true;
+    } else if (cfg_.command == "render") {
+        mode_ = Mode::RENDER;
     } else {
         LOG_ERROR << "Unknown command: " << cfg_.command ;
         throw runtime_error("Unknown command "s + cfg_.command);
@@ -41,8 +59,73 @@ Engine::Engine(const Config &config)
 
 void Engine::run()
 {
+    if (cfg_.fleetMode) {
+        ioPool_ = make_unique<IoServicePool>(cfg_.fleetThreads);
+        blockingPool_ = make_unique<WorkerPool>(cfg_.fleetThreads);
+        LOG_INFO << "Fleet mode: " << cfg_.kubeconfigs.size() << " clusters share "
+                 << ioPool_->size() << " io-threads.";
+    }
+
+    if (cfg_.prepareThreads != 1) {
+        preparePool_ = make_unique<WorkerPool>(cfg_.prepareThreads);
+    }
+
+    if (cfg_.metricsPort || !cfg_.metricsFile.empty()) {
+        metrics_ = make_unique<Metrics>();
+        if (cfg_.metricsPort) {
+            if (cfg_.metricsPort > 0xffff) {
+                throw runtime_error("Invalid --metrics-port: "s + to_string(cfg_.metricsPort));
+            }
+            metrics_->serve(static_cast<uint16_t>(cfg_.metricsPort));
+        }
+    }
+
+    if (!cfg_.traceFile.empty()) {
+        tracer_ = make_unique<Tracer>(cfg_.traceFile);
+    }
+
+    if (cfg_.profile) {
+        profiler_ = make_unique<Profiler>();
+    }
+
+    if (cfg_.resume && (cfg_.journalDir.empty() || mode_ != Mode::DEPLOY)) {
+        throw runtime_error("--resume requires the deploy command and --journal-dir");
+    }
+
+    if (!cfg_.journalDir.empty() && mode_ == Mode::DEPLOY) {
+        journal_ = make_unique<Journal>(cfg_.journalDir, cfg_.resume);
+    }
+
+    if (!cfg_.historyDb.empty() && (mode_ == Mode::DEPLOY || mode_ == Mode::SHOW_DEPENDENCIES)) {
+        history_ = make_unique<DurationHistory>(cfg_.historyDb);
+    }
+
+    if (!cfg_.logDir.empty() && mode_ == Mode::DEPLOY) {
+        LogWriter::Options options;
+        options.maxQueued = cfg_.logQueueSize;
+        options.overflow = LogWriter::toOverflow(cfg_.logOverflow);
+        options.compression = LogSegment::toCompression(cfg_.logCompression);
+        options.rotateBytes = cfg_.logRotateSize * 1024 * 1024;
+        options.rotateAge = chrono::seconds{cfg_.logRotateSeconds};
+        options.keepSegments = cfg_.logKeepSegments;
+        logWriter_ = make_unique<LogWriter>(options);
+    }
+
+    auto clusterArgs = cfg_.kubeconfigs;
+    if (cfg_.virtualClusters) {
+        if (mode_ != Mode::RENDER) {
+            throw runtime_error("--virtual-clusters can only be used with the render command");
+        }
+
+        // Clusters without a kubeconfig, defined only by their variables
+        clusterArgs.clear();
+        for(size_t i = 0; i < cfg_.virtualClusters; ++i) {
+            clusterArgs.push_back(":name=virtual"s + to_string(i));
+        }
+    }
+
     // Create cluster instances
-    for(auto& k: cfg_.kubeconfigs) {
+    for(auto& k: clusterArgs) {
         clusters_.emplace_back(make_unique<Cluster>(cfg_, k, clusters_.size()));
     }
 
@@ -53,60 +136,448 @@ void Engine::run()
         }
     }
 
-    std::deque<future<void>> futures;
+    rollout_ = make_unique<RolloutController>(cfg_, clusters_.size());
+    if (cfg_.syncStart) {
+        if (rollout_->enabled()) {
+            throw runtime_error("--sync-start can not be combined with rollout waves or --max-parallel-clusters");
+        }
+        runSynchronized();
+    } else {
+        runPipelined();
+    }
+
+    if (watch_) {
+        watchForChanges();
+    }
+
+    LOG_INFO << "Done. Shutting down background threads and async IO.";
+    if (ioPool_) {
+        ioPool_->stop();
+    } else {
+        for(auto& cluster : clusters_) {
+            try {
+                if (cluster->hasClient()) {
+                    cluster->client().GetIoService().stop();
+                }
+            } catch (const exception& ex) {
+                LOG_WARN << "Caugtht exception from asio shutdown: " << ex.what();
+            }
+        }
+    }
 
     for(auto& cluster : clusters_) {
-        futures.push_back(cluster->prepare());
+        if (cluster->hasClient()) {
+            // The clients in fleet mode don't own any threads we can wait for
+            cluster->client().CloseWhenReady(!ioPool_);
+        }
     }
 
-    for(auto& f : futures) {
-        // TODO: Catch exceptions and deal with setup errore before we start doing something
-        f.get();
+    reportTimings();
+    if (profiler_) {
+        profiler_->report();
     }
+    reportCriticalPaths();
+    rollout_->report();
 
-//    // Let the events backlog be safely ignored...
-//    // TODO: Use the futures above to hold the clusters back until the event backlog is received
-//    this_thread::sleep_for(5s);
-    futures.clear();
+    if (history_ && mode_ == Mode::DEPLOY) {
+        try {
+            history_->compact();
+        } catch(const exception& ex) {
+            LOG_WARN << "Failed to compact the duration history: " << ex.what();
+        }
+    }
+    writeMetrics();
 
+    if (rollout_->aborted()) {
+        throw runtime_error("The rollout was aborted");
+    }
+
+    if (const auto failed = count_if(runs_.begin(), runs_.end(), [](const auto& r) {
+            return r.phase == Phase::FAILED;}) ) {
+        throw runtime_error(to_string(failed) + " cluster(s) failed");
+    }
+}
+
+void Engine::runSynchronized()
+{
+    // All the clusters must complete one phase before any of them
+    // can start on the next one.
     for(auto& cluster : clusters_) {
-        futures.push_back(cluster->execute());
+        runs_.emplace_back(cluster.get());
+    }
+
+    for(auto& r : runs_) {
+        r.start(Phase::PREPARING);
+        r.future = r.cluster->prepare();
+    }
+
+    for(auto& r : runs_) {
+        // TODO: Catch exceptions and deal with setup errore before we start doing something
+        r.future.get();
+        r.done();
+    }
+
+    for(auto& r : runs_) {
+        r.start(Phase::EXECUTING);
+        r.future = r.cluster->execute();
     }
 
-    for(auto& f : futures) {
+    for(auto& r : runs_) {
         // TODO: Catch exceptions and deal with errors, potentially, try to roll back
-        f.get();
+        r.future.get();
+        r.done();
     }
 
-    for(auto& cluster : clusters_) {
-        futures.push_back(cluster->pendingWork());
+    if (watch_) {
+        // The logs are followed in the background while we watch
+        for(auto& r : runs_) {
+            r.phase = Phase::DONE;
+        }
+        return;
     }
 
     bool pendingWork = false;
-    for(auto& f : futures) {
-       pendingWork |= f.wait_for(0ms) == future_status::ready;
+    for(auto& r : runs_) {
+        r.start(Phase::PENDING_WORK);
+        r.future = r.cluster->pendingWork();
+        pendingWork |= r.future.wait_for(0ms) != future_status::ready;
     }
 
     if (pendingWork) {
         LOG_INFO << "Continuing with pending work for now...";
     }
 
-    for(auto& f : futures) {
+    for(auto& r : runs_) {
         // TODO: Catch exceptions and deal with errors, potentially, try to roll back
-        f.get();
+        r.future.get();
+        r.done();
+        r.phase = Phase::DONE;
     }
+}
 
-    LOG_INFO << "Done. Shutting down background threads and async IO.";
+void Engine::runPipelined()
+{
+    // Each cluster moves to the next phase as soon as it is ready.
+    // Dependencies between the clusters are resolved by the clusters
+    // themselves, so we don't need global barriers.
+    // The rollout controller may hold prepared clusters back.
     for(auto& cluster : clusters_) {
+        runs_.emplace_back(cluster.get());
+    }
+
+    // In fleet mode, limit the number of threads loading kubeconfigs at the same time
+    const size_t maxStarting = ioPool_ ? ioPool_->size() : clusters_.size();
+    size_t starting = 0;
+
+    auto fail = [this](ClusterRun& r, const exception& ex) {
+        r.done();
+        LOG_ERROR << r.cluster->name() << " Failed while " << toString(r.phase)
+                  << ": " << ex.what();
+        if (r.phase == Phase::PREPARING || r.phase == Phase::EXECUTING) {
+            rollout_->onDone(r.cluster->id(), false);
+        }
+        r.phase = Phase::FAILED;
+    };
+
+    while(true) {
+        uint64_t generation = 0;
+        {
+            lock_guard<mutex> lock{phaseMutex_};
+            generation = phaseGeneration_;
+        }
+
+        size_t active = 0;
+        bool advanced = false;
+        for(auto& r : runs_) {
+            if (r.phase == Phase::DONE || r.phase == Phase::FAILED || r.phase == Phase::SKIPPED) {
+                continue;
+            }
+
+            ++active;
+
+            if ((r.phase == Phase::STARTING || r.phase == Phase::PREPARED)
+                    && rollout_->isSkipped(r.cluster->id())) {
+                LOG_WARN << r.cluster->name() << " Skipped, as the rollout was aborted.";
+                r.phase = Phase::SKIPPED;
+                advanced = true;
+                continue;
+            }
+
+            if (r.phase == Phase::STARTING) {
+                if (starting < maxStarting) {
+                    // The first part of prepare (loading the kubeconfig) is
+                    // synchronous, so don't let one slow cluster delay the others.
+                    ++starting;
+                    advanced = true;
+                    r.start(Phase::PREPARING);
+                    promise<future<void>> prepared;
+                    r.starting = prepared.get_future();
+                    r.starter = thread([cluster = r.cluster, prepared = move(prepared)]() mutable {
+                        try {
+                            prepared.set_value(cluster->prepare());
+                        } catch(...) {
+                            prepared.set_exception(current_exception());
+                        }
+                        notifyPhaseDone();
+                    });
+                }
+                continue;
+            }
+
+            if (r.phase == Phase::PREPARED) {
+                if (rollout_->mayStart(r.cluster->id())) {
+                    advanced = true;
+                    rollout_->onStarted(r.cluster->id());
+                    r.start(Phase::EXECUTING);
+                    try {
+                        r.future = r.cluster->execute();
+                    } catch(const exception& ex) {
+                        fail(r, ex);
+                    }
+                }
+                continue;
+            }
+
+            if (r.starting.valid()) {
+                if (r.starting.wait_for(0ms) != future_status::ready) {
+                    continue;
+                }
+
+                --starting;
+                advanced = true;
+                r.starter.join();
+                try {
+                    r.future = r.starting.get();
+                } catch(const exception& ex) {
+                    fail(r, ex);
+                }
+                continue;
+            }
+
+            if (r.future.wait_for(0ms) != future_status::ready) {
+                continue;
+            }
+
+            advanced = true;
+            try {
+                r.future.get();
+                r.done();
+
+                switch(r.phase) {
+                case Phase::PREPARING:
+                    // Fail now, not when it holds a slot and waits for a cluster that can't start
+                    rollout_->checkDependencies(r.cluster->id(), r.cluster->clusterDependencies());
+                    r.phase = Phase::PREPARED;
+                    break;
+                case Phase::EXECUTING:
+                    rollout_->onDone(r.cluster->id(), true);
+                    if (watch_) {
+                        // The logs are followed in the background while we watch
+                        r.phase = Phase::DONE;
+                        break;
+                    }
+                    r.start(Phase::PENDING_WORK);
+                    r.future = r.cluster->pendingWork();
+                    if (r.future.wait_for(0ms) != future_status::ready) {
+                        LOG_INFO << r.cluster->name() << " Continuing with pending work for now...";
+                    }
+                    break;
+                default:
+                    r.phase = Phase::DONE;
+                }
+            } catch(const exception& ex) {
+                fail(r, ex);
+            }
+        }
+
+        if (!active) {
+            break;
+        }
+
+        if (!advanced) {
+            // Sleep until a cluster completes a phase
+            unique_lock<mutex> lock{phaseMutex_};
+            phaseDone_.wait(lock, [&] {
+                return phaseGeneration_ != generation;
+            });
+        }
+    }
+}
+
+void Engine::watchForChanges()
+{
+    vector<Cluster *> clusters;
+    for(const auto& r : runs_) {
+        if (r.phase == Phase::DONE) {
+            clusters.push_back(r.cluster);
+        } else {
+            LOG_WARN << r.cluster->name() << " Not watched, as it is " << toString(r.phase);
+        }
+    }
+
+    if (clusters.empty()) {
+        LOG_ERROR << "No clusters to watch.";
+        return;
+    }
+
+    // Leave on ^C, so the logs, journal, trace and reports are closed as after a deploy
+    FileWatcher watcher;
+    watcher.stopOnSignals();
+    while(true) {
+        // Components may have been added with new files
+        for(auto cluster : clusters) {
+            for(const auto& file : cluster->sourceFiles()) {
+                watcher.add(file);
+            }
+        }
+
+        LOG_INFO << "Watching for changes. Press ^C to quit.";
+        const auto changed = watcher.wait();
+        if (changed.empty()) {
+            LOG_INFO << "Stopped watching for changes.";
+            return;
+        }
+        for(const auto& file : changed) {
+            LOG_INFO << "Changed: " << file;
+        }
+
+        // A cluster adds listeners to the components in the clusters it
+        // depends on while it prepares its new tree, so it must not be
+        // reconciled while one of them rebuilds its tree. Reconcile in
+        // dependency order. The clusters in one step are independent.
+        map<Cluster *, set<Cluster *>> pending;
+        for(auto cluster : clusters) {
+            auto& deps = pending[cluster];
+            for(const auto ix : cluster->clusterDependencies()) {
+                if (auto other = getCluster(ix); other
+                        && find(clusters.begin(), clusters.end(), other) != clusters.end()) {
+                    deps.insert(other);
+                }
+            }
+        }
+
+        const auto started = chrono::steady_clock::now();
+        size_t failed = 0;
+        while(!pending.empty()) {
+            vector<Cluster *> step;
+            for(const auto& [cluster, deps] : pending) {
+                if (deps.empty()) {
+                    step.push_back(cluster);
+                }
+            }
+
+            if (step.empty()) {
+                // The clusters depend on each other. One at the time is safe,
+                // as the listeners are moved to the components that replace them.
+                step.push_back(pending.begin()->first);
+            }
+
+            vector<future<void>> futures;
+            for(auto cluster : step) {
+                futures.push_back(cluster->reconcile());
+            }
+
+            for(size_t i = 0; i < futures.size(); ++i) {
+                try {
+                    futures[i].get();
+                } catch(const exception& ex) {
+                    LOG_ERROR << step[i]->name() << " Failed to apply the changes: " << ex.what();
+                    ++failed;
+                }
+            }
+
+            for(auto cluster : step) {
+                pending.erase(cluster);
+            }
+            for(auto& [_, deps] : pending) {
+                for(auto cluster : step) {
+                    deps.erase(cluster);
+                }
+            }
+        }
+
+        LOG_INFO << "Applied the changes in "
+                 << std::fixed << std::setprecision(3)
+                 << chrono::duration<double>(chrono::steady_clock::now() - started).count()
+                 << " seconds. " << failed << " cluster(s) failed.";
+    }
+}
+
+void Engine::writeMetrics() const
+{
+    if (!metrics_ || cfg_.metricsFile.empty()) {
+        return;
+    }
+
+    try {
+        metrics_->writeTextfile(cfg_.metricsFile);
+    } catch(const exception& ex) {
+        LOG_WARN << "Failed to write the metrics: " << ex.what();
+    }
+}
+
+void Engine::reportTimings() const
+{
+    for(const auto& r : runs_) {
+        LOG_INFO << r.cluster->name() << " " << toString(r.phase)
+                 << std::fixed << std::setprecision(3)
+                 << ". prepare: " << r.elapsed[0]
+                 << "s, execute: " << r.elapsed[1]
+                 << "s, pending work: " << r.elapsed[2] << "s";
+    }
+}
+
+void Engine::reportCriticalPaths() const
+{
+    if (!cfg_.criticalPath || mode_ != Mode::DEPLOY) {
+        return;
+    }
+
+    for(const auto& r : runs_) {
+        if (r.phase == Phase::SKIPPED) {
+            continue;
+        }
         try {
-            cluster->client().GetIoService().stop();
-        } catch (const exception& ex) {
-            LOG_WARN << "Caugtht exception from asio shutdown: " << ex.what();
+            r.cluster->reportCriticalPath();
+        } catch(const exception& ex) {
+            LOG_WARN << r.cluster->name() << " Failed to report the critical path: " << ex.what();
         }
     }
+}
 
-    for(auto& cluster : clusters_) {
-        cluster->client().CloseWhenReady();
+string Engine::toString(Engine::Phase phase)
+{
+    static const array<string, 8> names = {"starting", "preparing", "prepared", "executing",
+                                           "pending work", "done", "failed", "skipped"};
+    return names.at(static_cast<size_t>(phase));
+}
+
+void Engine::ClusterRun::start(Engine::Phase p)
+{
+    phase = p;
+    started = chrono::steady_clock::now();
+}
+
+void Engine::ClusterRun::done()
+{
+    const auto now = chrono::steady_clock::now();
+    const auto duration = chrono::duration<double>(now - started).count();
+    if (auto tracer = Tracer::instance()) {
+        tracer->span(cluster->name(), {}, toString(phase), "cluster", started, now);
+    }
+
+    switch(phase) {
+    case Phase::PREPARING:
+        elapsed[0] = duration;
+        break;
+    case Phase::EXECUTING:
+        elapsed[1] = duration;
+        break;
+    case Phase::PENDING_WORK:
+        elapsed[2] = duration;
+        break;
+    default:
+        ;
     }
 }
 
@@ -145,7 +616,13 @@ std::tuple<bool, size_t, string> Engine::parseClusterVar(const string &name)
 string Engine::getClusterVar(size_t clusterIx, const string &varName)
 {
     if (auto c = getCluster(clusterIx)) {
-        c->getVarsReadyStage().wait();
+        // We are called from an io-thread, so we can not wait for it here.
+        // Cluster::prepare() defers reading the definitions until
+        // the clusters they reference have their variables ready.
+        if (!c->getVarsReadyStage().isReady()) {
+            LOG_TRACE << "The variables for cluster" << clusterIx << " are not ready";
+            throw VariablesNotReady{clusterIx};
+        }
         if (auto v = c->getVar(varName)) {
             return *v;
         }
@@ -155,6 +632,72 @@ string Engine::getClusterVar(size_t clusterIx, const string &varName)
     throw runtime_error{"No such cluster or var: "};
 }
 
+void Engine::notifyPhaseDone() noexcept
+{
+    if (auto self = instance_) {
+        {
+            lock_guard<mutex> lock{self->phaseMutex_};
+            ++self->phaseGeneration_;
+        }
+        self->phaseDone_.notify_all();
+    }
+}
+
+std::optional<string> Engine::findDependencyCycle(size_t clusterIx, const string &componentName)
+{
+    using node_t = pair<size_t, string>;
+    const node_t start{clusterIx, componentName};
+    set<node_t> visited;
+    vector<node_t> path;
+
+    // Depth first search along the declared dependencies.
+    // Clusters that don't have their components yet are skipped. If they
+    // are part of a cycle, it will be found when they resolve their own
+    // dependencies.
+    function<bool (const node_t&)> visit = [&](const node_t& node) {
+        auto cluster = getCluster(node.first);
+        if (!cluster || !cluster->getBasicComponentsReady().isReady()) {
+            return false;
+        }
+
+        auto component = cluster->getComponent(node.second);
+        if (!component) {
+            return false;
+        }
+
+        path.push_back(node);
+        for(const auto& dep : component->depends) {
+            auto [isClusterVal, ix, name] = parseClusterVar(dep);
+            node_t next{isClusterVal ? ix : node.first, name};
+            if (next == start) {
+                path.push_back(next);
+                return true;
+            }
+
+            if (visited.insert(next).second && visit(next)) {
+                return true;
+            }
+        }
+        path.pop_back();
+        return false;
+    };
+
+    if (!visit(start)) {
+        return {};
+    }
+
+    ostringstream out;
+    size_t cnt = 0;
+    for(const auto& [ix, name] : path) {
+        if (cnt++) {
+            out << " -> ";
+        }
+        out << "cluster" << ix << ':' << name;
+    }
+
+    return out.str();
+}
+
 void Engine::startPortForwardig()
 {
 //    for(auto& cluster : clusters_) {
@@ -173,4 +716,5 @@ void Engine::startPortForwardig()
 //        throw runtime_error("Failed to start proxying");
 //    }
 }
-}
+
+} // ns
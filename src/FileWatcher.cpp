@@ -0,0 +1,180 @@
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "k8deployer/FileWatcher.h"
+#include "k8deployer/logging.h"
+
+using namespace std;
+
+namespace k8deployer {
+
+namespace {
+
+// Self-pipe for stopOnSignals(). The handler only writes to it.
+int signalPipe_[2] = {-1, -1};
+struct sigaction previousInt_ = {};
+struct sigaction previousTerm_ = {};
+
+extern "C" void onStopSignal(int)
+{
+    const auto saved = errno;
+    const char ch = 's';
+    [[maybe_unused]] const auto rval = ::write(signalPipe_[1], &ch, 1);
+    errno = saved;
+}
+
+} // anon ns
+
+FileWatcher::FileWatcher()
+{
+    fd_ = inotify_init1(IN_CLOEXEC);
+    if (fd_ < 0) {
+        LOG_ERROR << "inotify_init1 failed: " << strerror(errno);
+        throw runtime_error("Failed to initialize inotify");
+    }
+}
+
+FileWatcher::~FileWatcher()
+{
+    restoreSignals();
+
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+void FileWatcher::add(const string &path)
+{
+    const auto abs = filesystem::absolute(path).lexically_normal();
+    if (!files_.emplace(abs.string(), path).second) {
+        return; // Already watched
+    }
+
+    const auto dir = abs.parent_path().string();
+    const int wd = inotify_add_watch(fd_, dir.c_str(),
+                                     IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+    if (wd < 0) {
+        LOG_ERROR << "Failed to watch " << dir << ": " << strerror(errno);
+        throw runtime_error("Failed to watch "s + dir);
+    }
+
+    // The same directory gives the same wd
+    dirs_[wd] = dir;
+    LOG_DEBUG << "Watching " << abs.string();
+}
+
+void FileWatcher::stopOnSignals()
+{
+    if (handlingSignals_) {
+        return;
+    }
+
+    assert(signalPipe_[0] == -1);
+    if (::pipe2(signalPipe_, O_CLOEXEC | O_NONBLOCK) != 0) {
+        LOG_ERROR << "pipe2 failed: " << strerror(errno);
+        throw runtime_error("Failed to create the signal pipe");
+    }
+
+    struct sigaction sa = {};
+    sa.sa_handler = onStopSignal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, &previousInt_);
+    sigaction(SIGTERM, &sa, &previousTerm_);
+    handlingSignals_ = true;
+}
+
+void FileWatcher::restoreSignals()
+{
+    if (!handlingSignals_) {
+        return;
+    }
+
+    sigaction(SIGINT, &previousInt_, nullptr);
+    sigaction(SIGTERM, &previousTerm_, nullptr);
+    ::close(signalPipe_[0]);
+    ::close(signalPipe_[1]);
+    signalPipe_[0] = signalPipe_[1] = -1;
+    handlingSignals_ = false;
+}
+
+std::set<string> FileWatcher::wait(std::chrono::milliseconds settle)
+{
+    set<string> changed;
+
+    while(changed.empty()) {
+        pollfd pfds[2] = {{fd_, POLLIN, 0}, {signalPipe_[0], POLLIN, 0}};
+        const auto rval = ::poll(pfds, handlingSignals_ ? 2 : 1, -1);
+        if (rval < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR << "Failed to poll inotify: " << strerror(errno);
+            throw runtime_error("Failed to poll inotify");
+        }
+
+        if (handlingSignals_ && (pfds[1].revents & POLLIN)) {
+            LOG_DEBUG << "Got a signal to stop watching.";
+            return {};
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            readEvents(changed);
+        }
+    }
+
+    // Wait for the dust to settle
+    while(true) {
+        pollfd pfd = {fd_, POLLIN, 0};
+        const auto rval = ::poll(&pfd, 1, static_cast<int>(settle.count()));
+        if (rval < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rval <= 0) {
+            break;
+        }
+        readEvents(changed);
+    }
+
+    return changed;
+}
+
+void FileWatcher::readEvents(std::set<string> &changed)
+{
+    alignas(inotify_event) char buffer[4096];
+    const auto len = ::read(fd_, buffer, sizeof(buffer));
+    if (len < 0) {
+        if (errno == EINTR) {
+            return;
+        }
+        LOG_ERROR << "Failed to read from inotify: " << strerror(errno);
+        throw runtime_error("Failed to read from inotify");
+    }
+
+    for(const char *p = buffer; p < buffer + len; ) {
+        const auto *ev = reinterpret_cast<const inotify_event *>(p);
+        p += sizeof(inotify_event) + ev->len;
+
+        if (!ev->len) {
+            continue;
+        }
+
+        if (auto dir = dirs_.find(ev->wd); dir != dirs_.end()) {
+            const auto path = (filesystem::path{dir->second} / ev->name).string();
+            if (auto it = files_.find(path); it != files_.end()) {
+                LOG_TRACE << "File changed: " << path;
+                changed.insert(it->second);
+            }
+        }
+    }
+}
+
+} // ns
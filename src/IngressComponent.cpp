@@ -52,7 +52,7 @@ void IngressComponent::prepareDeploy()
         }
     }
 
-    if (auto defs = getArg("ingress.paths")) {
+    if (auto defs = getArg(Atom::INGRESS_PATHS)) {
 
         // Format [hostname:]/path[...][/*][ new-path-definition]...
         // If a path ends with "/*" pathType=Prefix, else pathType=Exact
@@ -319,7 +319,7 @@ void IngressComponent::doDeploy(std::weak_ptr<Component::Task> task)
     if (auto t = task.lock()) {
         t->startProbeAfterApply = true;
     }
-    sendApply(ingress, getCreationUrl(), task);
+    sendApplyJson(payload_, getCreationUrl(), task);
 }
 
 void IngressComponent::doRemove(std::weak_ptr<Component::Task> task)
@@ -335,6 +335,19 @@ string IngressComponent::getCreationUrl() const
     return url;
 }
 
+std::vector<string> IngressComponent::dnsNames() const
+{
+    std::vector<string> names;
+    if (ingress.spec) {
+        for(const auto& rule : ingress.spec->rules) {
+            if (!rule.host.empty()) {
+                names.push_back(rule.host);
+            }
+        }
+    }
+    return names;
+}
+
 
 
 } // ns
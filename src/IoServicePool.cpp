@@ -0,0 +1,59 @@
+#include "k8deployer/IoServicePool.h"
+#include "k8deployer/logging.h"
+
+using namespace std;
+
+namespace k8deployer {
+
+IoServicePool::IoServicePool(size_t numThreads)
+{
+    if (numThreads == 0) {
+        numThreads = max<size_t>(thread::hardware_concurrency(), 1);
+    }
+
+    LOG_DEBUG << "Starting " << numThreads << " shared io-threads";
+
+    for(size_t i = 0; i < numThreads; ++i) {
+        auto w = make_unique<Worker>();
+        w->work.emplace(w->ios);
+        w->thread = thread([w = w.get(), i] {
+            LOG_TRACE << "io-thread #" << i << " is starting";
+            while(true) {
+                try {
+                    w->ios.run();
+                    break;
+                } catch(const exception& ex) {
+                    LOG_ERROR << "Caught exception in shared io-thread #" << i << ": " << ex.what();
+                }
+            }
+            LOG_TRACE << "io-thread #" << i << " is done";
+        });
+        workers_.push_back(move(w));
+    }
+}
+
+IoServicePool::~IoServicePool()
+{
+    stop();
+}
+
+boost::asio::io_service &IoServicePool::next()
+{
+    return workers_.at(next_++ % workers_.size())->ios;
+}
+
+void IoServicePool::stop()
+{
+    for(auto& w : workers_) {
+        w->work.reset();
+        w->ios.stop();
+    }
+
+    for(auto& w : workers_) {
+        if (w->thread.joinable()) {
+            w->thread.join();
+        }
+    }
+}
+
+} // ns
@@ -93,11 +93,7 @@ void JobComponent::addRemovementTasks(Component::tasks_t &tasks)
 
 void JobComponent::doDeploy(std::weak_ptr<Task> task)
 {
-    const auto url = cluster_->getUrl()
-            + "/apis/batch/v1/namespaces/"s
-            + job.metadata.namespace_
-            + "/jobs";
-    sendApply(job, url, task);
+    sendApplyJson(payload_, getCreationUrl(), task);
 }
 
 void JobComponent::doRemove(std::weak_ptr<Component::Task> task)
@@ -110,4 +106,14 @@ void JobComponent::doRemove(std::weak_ptr<Component::Task> task)
     sendDelete(url, task, true);
 }
 
+string JobComponent::getCreationUrl() const
+{
+    const auto url = cluster_->getUrl()
+            + "/apis/batch/v1/namespaces/"s
+            + job.metadata.namespace_
+            + "/jobs";
+
+    return url;
+}
+
 } // ns
@@ -0,0 +1,178 @@
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <boost/algorithm/string.hpp>
+
+#include "k8deployer/Journal.h"
+#include "k8deployer/logging.h"
+
+using namespace std;
+using namespace chrono_literals;
+
+namespace k8deployer {
+
+Journal::Journal(const string &dir, bool append)
+    : dir_{dir}, append_{append}
+{
+    filesystem::create_directories(dir_);
+    LOG_INFO << "Using journal directory: " << dir_;
+
+    thread_ = thread([this] {
+        run();
+    });
+}
+
+Journal::~Journal()
+{
+    {
+        lock_guard<mutex> lock{mutex_};
+        done_ = true;
+    }
+
+    cond_.notify_all();
+    thread_.join();
+
+    for(const auto& [cluster, fd] : files_) {
+        ::close(fd);
+    }
+}
+
+void Journal::record(const string &cluster, string key, string state)
+{
+    const auto now = chrono::duration_cast<chrono::milliseconds>(
+                chrono::system_clock::now().time_since_epoch()).count();
+
+    auto line = to_string(now);
+    line += '\t';
+    line += key;
+    line += '\t';
+    line += state;
+    line += '\n';
+
+    bool wasEmpty = false;
+    {
+        lock_guard<mutex> lock{mutex_};
+        wasEmpty = pending_.empty();
+        pending_.push_back({cluster, move(line)});
+    }
+
+    if (wasEmpty) {
+        cond_.notify_one();
+    }
+}
+
+Journal::states_t Journal::load(const string &cluster) const
+{
+    states_t states;
+    ifstream in{path(cluster)};
+    if (!in.is_open()) {
+        return states;
+    }
+
+    string line;
+    size_t lines = 0;
+    while(getline(in, line)) {
+        vector<string> cols;
+        boost::split(cols, line, boost::is_any_of("\t"));
+        if (cols.size() != 3) {
+            // Probably the last line, from a write that was interrupted
+            LOG_WARN << "Ignoring malformed line in the journal for " << cluster << ": " << line;
+            continue;
+        }
+
+        states[cols[1]] = cols[2];
+        ++lines;
+    }
+
+    LOG_DEBUG << "Loaded " << lines << " entries for " << states.size()
+              << " tasks from the journal for " << cluster;
+    return states;
+}
+
+void Journal::run()
+{
+    vector<Entry> entries;
+
+    while(true) {
+        {
+            unique_lock<mutex> lock{mutex_};
+            cond_.wait(lock, [this] {
+                return done_ || !pending_.empty();
+            });
+
+            if (pending_.empty()) {
+                return; // done
+            }
+
+            swap(entries, pending_);
+        }
+
+        write(entries);
+        entries.clear();
+
+        // Let a burst of state-changes go into the same batch
+        this_thread::sleep_for(50ms);
+    }
+}
+
+void Journal::write(std::vector<Entry>& entries)
+{
+    // Group the entries by cluster, in the order they were recorded
+    map<string, vector<iovec>> batches;
+    for(auto& e : entries) {
+        batches[e.cluster].push_back({e.line.data(), e.line.size()});
+    }
+
+    for(auto& [cluster, iov] : batches) {
+        auto it = files_.find(cluster);
+        if (it == files_.end()) {
+            const auto name = path(cluster);
+            const int fd = ::open(name.c_str(),
+                                  O_CREAT | O_CLOEXEC | (append_ ? (O_RDWR | O_APPEND) : (O_WRONLY | O_TRUNC)),
+                                  0644);
+            if (fd < 0) {
+                LOG_ERROR << "Failed to open journal " << name << ": " << strerror(errno);
+                continue;
+            }
+
+            // Don't continue on a line that was cut off when we were interrupted
+            if (append_) {
+                char last = '\n';
+                if (const auto size = ::lseek(fd, 0, SEEK_END); size > 0) {
+                    if (::pread(fd, &last, 1, size - 1) == 1 && last != '\n') {
+                        [[maybe_unused]] auto rval = ::write(fd, "\n", 1);
+                    }
+                }
+            }
+
+            it = files_.emplace(cluster, fd).first;
+        }
+
+        const int fd = it->second;
+        for(size_t i = 0; i < iov.size(); i += IOV_MAX) {
+            const auto count = static_cast<int>(min<size_t>(iov.size() - i, IOV_MAX));
+            if (::writev(fd, iov.data() + i, count) < 0) {
+                LOG_ERROR << "Failed to write to the journal for " << cluster << ": " << strerror(errno);
+                break;
+            }
+        }
+
+        if (::fdatasync(fd) != 0) {
+            LOG_WARN << "fdatasync failed on the journal for " << cluster << ": " << strerror(errno);
+        }
+    }
+}
+
+string Journal::path(const string &cluster) const
+{
+    return (filesystem::path{dir_} / (cluster + ".journal")).string();
+}
+
+} // ns
@@ -0,0 +1,337 @@
+#include <algorithm>
+#include <cstdlib>
+
+#include <boost/asio.hpp>
+
+#include "restc-cpp/RequestBuilder.h"
+
+#include "k8deployer/Cluster.h"
+#include "k8deployer/Component.h"
+#include "k8deployer/Engine.h"
+#include "k8deployer/LogFollower.h"
+#include "k8deployer/LogStore.h"
+#include "k8deployer/logging.h"
+
+using namespace std;
+using namespace restc_cpp;
+using namespace chrono_literals;
+
+namespace k8deployer {
+
+namespace {
+
+constexpr auto firstBackoff = 1000ms;
+constexpr auto maxBackoff = 30000ms;
+
+/* RFC3339Nano timestamps have no trailing zeros in the fraction, so they
+ * don't compare as strings. Pad the fraction to nanoseconds.
+ */
+string normalize(string_view ts)
+{
+    string key{ts.substr(0, min<size_t>(ts.size(), 19))}; // 2006-01-02T15:04:05
+    key += '.';
+
+    size_t digits = 0;
+    if (ts.size() > 20 && ts[19] == '.') {
+        for(size_t i = 20; i < ts.size() && isdigit(static_cast<unsigned char>(ts[i])); ++i, ++digits) {
+            key += ts[i];
+        }
+    }
+
+    key.append(9 - min<size_t>(digits, 9), '0');
+    return key;
+}
+
+} // anon ns
+
+LogFollower::LogFollower(Cluster &cluster, Target target, done_t onDone)
+    : cluster_{cluster}, target_{move(target)}, onDone_{move(onDone)}
+{
+}
+
+void LogFollower::start()
+{
+    cluster_.client().Process([self = shared_from_this()](Context& ctx) {
+        self->run(ctx);
+    });
+}
+
+void LogFollower::run(Context &ctx)
+{
+    auto& writer = *Engine::instance().logWriter();
+    const auto& path = target_.path;
+    out_ = writer.open(path, target_.truncate);
+    if (Engine::config().logStore) {
+        store_ = writer.open(LogStore::storePath(path), target_.truncate, true);
+    }
+
+    LOG_INFO << cluster_.name() << " Opening log: " << path.string();
+
+    if (!Engine::config().logViewer.empty()) {
+        const auto cmd = Engine::config().logViewer + " " + path.string() + " &";
+        LOG_TRACE << cluster_.name() << " Executing: " << cmd;
+        system(cmd.c_str());
+    }
+
+    auto backoff = firstBackoff;
+    while(cluster_.state() != Cluster::State::ERROR) {
+        try {
+            if (follow(ctx, false)) {
+                backoff = firstBackoff;
+            }
+        } catch(const RequestFailedWithErrorException& err) {
+            LOG_DEBUG << cluster_.name() << " Failed to get log " << path.string() << ": "
+                      << err.http_response.status_code << ' ' << err.http_response.reason_phrase;
+        } catch(const exception& ex) {
+            LOG_DEBUG << cluster_.name() << " Log stream for " << path.string() << " ended: " << ex.what();
+        }
+
+        // Find out why the stream ended
+        bool podExists = true;
+        optional<k8api::ContainerStatus> status;
+        bool knowStatus = false;
+        try {
+            status = getStatus(ctx, podExists);
+            knowStatus = true;
+        } catch(const exception& ex) {
+            LOG_DEBUG << cluster_.name() << " Failed to get the status of pod "
+                      << target_.pod << ": " << ex.what();
+        }
+
+        if (!podExists || (knowStatus && !status)) {
+            break;
+        }
+
+        if (status && !status->containerID.empty() && status->containerID != target_.containerId) {
+            LOG_DEBUG << cluster_.name() << " Container " << target_.container << " in pod "
+                      << target_.pod << " was restarted.";
+            try {
+                // Whatever we did not get from the old instance
+                follow(ctx, true);
+            } catch(const exception& ex) {
+                LOG_DEBUG << cluster_.name() << " Failed to get the previous log for "
+                          << path.string() << ": " << ex.what();
+            }
+
+            if (!partial_.empty()) {
+                partial_ += '\n';
+                writeLine(ctx, partial_);
+            }
+            writeLine(ctx, "[k8deployer: container restarted]\n");
+
+            target_.containerId = status->containerID;
+            resetPosition();
+            stopped_ = false;
+            backoff = firstBackoff;
+            continue;
+        }
+
+        if (stopped_ || (status && !status->state.terminated.finishedAt.empty())) {
+            // Done. If it's restarted later, we get a new follower.
+            break;
+        }
+
+        LOG_DEBUG << cluster_.name() << " Reconnecting to log " << path.string()
+                  << " in " << backoff.count() << " ms";
+        sleep(ctx, backoff);
+        backoff = min(backoff * 2, maxBackoff);
+    }
+
+    if (!partial_.empty()) {
+        partial_ += '\n';
+        writeLine(ctx, partial_);
+        partial_.clear();
+    }
+
+    writer.close(out_);
+    if (store_) {
+        writer.close(store_);
+    }
+    LOG_INFO << cluster_.name() << " Closing log: " << path.string();
+
+    if (onDone_) {
+        onDone_();
+    }
+}
+
+bool LogFollower::follow(Context &ctx, bool previous)
+{
+    const auto url = cluster_.getUrl() + "/api/v1/namespaces/" + target_.ns
+            + "/pods/" + target_.pod + "/log";
+
+    auto prop = make_shared<Request::Properties>();
+    prop->recvTimeout = (60 * 60 * 24) * 1000;
+
+    RequestBuilder builder{ctx};
+    builder.Get(url)
+            .Properties(prop)
+            .Argument("container", target_.container)
+            .Argument("timestamps", "true")
+            .Header("X-Client", "k8deployer");
+
+    if (previous) {
+        builder.Argument("previous", "true");
+    } else {
+        builder.Argument("follow", "true");
+    }
+
+    if (!lastTimestamp_.empty()) {
+        // The server may send some lines we already have. They are skipped.
+        builder.Argument("sinceTime", lastTimestamp_);
+    }
+
+    auto reply = builder.Execute();
+
+    skipAtLastKey_ = linesAtLastKey_;
+    partial_.clear();
+
+    bool gotLines = false;
+    string out, records;
+    while(true) {
+        const auto& b = reply->GetSomeData();
+        if (boost::asio::buffer_size(b) == 0) {
+            LOG_TRACE << cluster_.name() << " End of log: " << target_.path.string();
+            break;
+        }
+
+        out.clear();
+        records.clear();
+        processLines({boost::asio::buffer_cast<const char*>(b), boost::asio::buffer_size(b)}, out, records);
+        if (!out.empty()) {
+            gotLines = true;
+            write(ctx, *out_, out);
+        }
+        if (store_ && !records.empty()) {
+            write(ctx, *store_, records);
+        }
+    }
+
+    return gotLines;
+}
+
+void LogFollower::write(Context &ctx, LogWriter::Stream& stream, string_view data)
+{
+    auto& writer = *Engine::instance().logWriter();
+    while(!writer.write(stream, data)) {
+        sleep(ctx, 20ms);
+    }
+}
+
+void LogFollower::writeLine(Context &ctx, string_view line)
+{
+    write(ctx, *out_, line);
+    if (store_) {
+        string record;
+        LogStore::addRecord(lastMs_, line, record);
+        write(ctx, *store_, record);
+    }
+}
+
+void LogFollower::processLines(string_view data, string &out, string& records)
+{
+    while(!data.empty()) {
+        const auto eol = data.find('\n');
+        if (eol == string_view::npos) {
+            partial_.append(data);
+            return;
+        }
+
+        const auto line = data.substr(0, eol + 1);
+        if (partial_.empty()) {
+            addLine(line, out, records);
+        } else {
+            partial_.append(line);
+            addLine(partial_, out, records);
+            partial_.clear();
+        }
+
+        data.remove_prefix(eol + 1);
+    }
+}
+
+void LogFollower::addLine(string_view line, string &out, string& records)
+{
+    const auto space = line.find(' ');
+    if (space == string_view::npos) {
+        // No timestamp. Should not happen.
+        out.append(line);
+        if (store_) {
+            LogStore::addRecord(lastMs_, line, records);
+        }
+        return;
+    }
+
+    const auto ts = line.substr(0, space);
+    const auto key = normalize(ts);
+
+    if (!lastKey_.empty() && key < lastKey_) {
+        return; // We have it already
+    }
+
+    if (key == lastKey_) {
+        if (skipAtLastKey_) {
+            --skipAtLastKey_;
+            return;
+        }
+        ++linesAtLastKey_;
+    } else {
+        lastKey_ = key;
+        lastTimestamp_ = ts;
+        linesAtLastKey_ = 1;
+        skipAtLastKey_ = 0;
+    }
+
+    out.append(line.substr(space + 1));
+    if (store_) {
+        if (const auto ms = LogStore::toMs(ts)) {
+            lastMs_ = ms;
+        }
+        LogStore::addRecord(lastMs_, line.substr(space + 1), records);
+    }
+}
+
+std::optional<k8api::ContainerStatus> LogFollower::getStatus(Context &ctx, bool &podExists)
+{
+    const auto url = cluster_.getUrl() + "/api/v1/namespaces/" + target_.ns
+            + "/pods/" + target_.pod;
+
+    k8api::Pod pod;
+    try {
+        auto reply = RequestBuilder{ctx}.Get(url)
+                .Header("X-Client", "k8deployer")
+                .Execute();
+        SerializeFromJson(pod, *reply, jsonFieldMappings());
+    } catch(const RequestFailedWithErrorException& err) {
+        if (err.http_response.status_code == 404) {
+            podExists = false;
+            return {};
+        }
+        throw;
+    }
+
+    for(const auto& s : pod.status.containerStatuses) {
+        if (s.name == target_.container) {
+            return s;
+        }
+    }
+
+    return {};
+}
+
+void LogFollower::sleep(Context &ctx, chrono::milliseconds duration)
+{
+    boost::asio::deadline_timer timer{ctx.GetClient().GetIoService(),
+                                      boost::posix_time::milliseconds{duration.count()}};
+    timer.async_wait(ctx.GetYield());
+}
+
+void LogFollower::resetPosition()
+{
+    lastTimestamp_.clear();
+    lastKey_.clear();
+    linesAtLastKey_ = 0;
+    skipAtLastKey_ = 0;
+    partial_.clear();
+}
+
+} // ns
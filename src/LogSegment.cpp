@@ -0,0 +1,254 @@
+#include <cassert>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <zlib.h>
+#ifdef K8DEPLOYER_WITH_ZSTD
+#   include <zstd.h>
+#endif
+
+#include "k8deployer/LogSegment.h"
+#include "k8deployer/logging.h"
+
+using namespace std;
+
+namespace k8deployer {
+
+namespace {
+
+constexpr size_t outBufferSize = 64 * 1024;
+
+class PlainSegment : public LogSegment {
+public:
+    PlainSegment(const filesystem::path& path)
+        : LogSegment(path) {}
+
+    bool write(const std::vector<iovec>& iov) override {
+        for(size_t i = 0; i < iov.size(); i += IOV_MAX) {
+            const auto count = min<size_t>(iov.size() - i, IOV_MAX);
+            size_t expected = 0;
+            for(size_t j = i; j < i + count; ++j) {
+                expected += iov[j].iov_len;
+            }
+
+            const auto bytes = ::writev(fd_, iov.data() + i, static_cast<int>(count));
+            if (bytes < 0 || static_cast<size_t>(bytes) != expected) {
+                LOG_WARN << "Failed to write to log-file " << path_ << ": "
+                         << (bytes < 0 ? strerror(errno) : "Short write");
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+class GzipSegment : public LogSegment {
+public:
+    GzipSegment(const filesystem::path& path)
+        : LogSegment(path), out_(outBufferSize)
+    {
+        // 16 + max window bits gives a gzip header and trailer
+        if (deflateInit2(&zs_, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            throw runtime_error("Failed to initialize zlib for "s + path.string());
+        }
+    }
+
+    ~GzipSegment() override {
+        deflateEnd(&zs_);
+    }
+
+    bool write(const std::vector<iovec>& iov) override {
+        for(const auto& v : iov) {
+            zs_.next_in = static_cast<Bytef *>(v.iov_base);
+            zs_.avail_in = static_cast<uInt>(v.iov_len);
+            if (!deflateAll(Z_NO_FLUSH)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool flush() override {
+        return deflateAll(Z_SYNC_FLUSH);
+    }
+
+    bool finish() override {
+        return deflateAll(Z_FINISH);
+    }
+
+private:
+    bool deflateAll(int mode) {
+        do {
+            zs_.next_out = out_.data();
+            zs_.avail_out = static_cast<uInt>(out_.size());
+            const auto result = deflate(&zs_, mode);
+            if (result == Z_STREAM_ERROR) {
+                LOG_WARN << "Failed to compress log-file " << path_;
+                return false;
+            }
+            if (!writeAll(out_.data(), out_.size() - zs_.avail_out)) {
+                return false;
+            }
+        } while (zs_.avail_out == 0);
+
+        assert(zs_.avail_in == 0);
+        return true;
+    }
+
+    z_stream zs_ = {};
+    std::vector<Bytef> out_;
+};
+
+#ifdef K8DEPLOYER_WITH_ZSTD
+class ZstdSegment : public LogSegment {
+public:
+    ZstdSegment(const filesystem::path& path)
+        : LogSegment(path), ctx_{ZSTD_createCCtx()}, out_(ZSTD_CStreamOutSize())
+    {
+        if (!ctx_) {
+            throw runtime_error("Failed to initialize zstd for "s + path.string());
+        }
+    }
+
+    ~ZstdSegment() override {
+        ZSTD_freeCCtx(ctx_);
+    }
+
+    bool write(const std::vector<iovec>& iov) override {
+        for(const auto& v : iov) {
+            ZSTD_inBuffer in{v.iov_base, v.iov_len, 0};
+            if (!compress(in, ZSTD_e_continue)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool flush() override {
+        ZSTD_inBuffer in{nullptr, 0, 0};
+        return compress(in, ZSTD_e_flush);
+    }
+
+    bool finish() override {
+        ZSTD_inBuffer in{nullptr, 0, 0};
+        return compress(in, ZSTD_e_end);
+    }
+
+private:
+    bool compress(ZSTD_inBuffer& in, ZSTD_EndDirective mode) {
+        while(true) {
+            ZSTD_outBuffer out{out_.data(), out_.size(), 0};
+            const auto remaining = ZSTD_compressStream2(ctx_, &out, &in, mode);
+            if (ZSTD_isError(remaining)) {
+                LOG_WARN << "Failed to compress log-file " << path_ << ": " << ZSTD_getErrorName(remaining);
+                return false;
+            }
+            if (!writeAll(out_.data(), out.pos)) {
+                return false;
+            }
+
+            const bool done = mode == ZSTD_e_continue ? in.pos == in.size : remaining == 0;
+            if (done) {
+                return true;
+            }
+        }
+    }
+
+    ZSTD_CCtx *ctx_;
+    std::vector<char> out_;
+};
+#endif
+
+} // anon ns
+
+LogSegment::LogSegment(const filesystem::path &path)
+    : path_{path}
+{
+    fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        throw runtime_error("Failed to open "s + path.string() + ": " + strerror(errno));
+    }
+}
+
+LogSegment::~LogSegment()
+{
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+std::unique_ptr<LogSegment> LogSegment::open(const filesystem::path &path, Compression compression)
+{
+    switch(compression) {
+    case Compression::NONE:
+        return make_unique<PlainSegment>(path);
+    case Compression::GZIP:
+        return make_unique<GzipSegment>(path);
+    case Compression::ZSTD:
+#ifdef K8DEPLOYER_WITH_ZSTD
+        return make_unique<ZstdSegment>(path);
+#else
+        break;
+#endif
+    }
+
+    throw runtime_error("zstd compression is not enabled in this build");
+}
+
+string LogSegment::extension(Compression compression)
+{
+    switch(compression) {
+    case Compression::NONE:
+        return {};
+    case Compression::GZIP:
+        return ".gz";
+    case Compression::ZSTD:
+        return ".zst";
+    }
+
+    return {};
+}
+
+LogSegment::Compression LogSegment::toCompression(const string &name)
+{
+    if (name == "none") {
+        return Compression::NONE;
+    }
+
+    if (name == "gzip") {
+        return Compression::GZIP;
+    }
+
+    if (name == "zstd") {
+#ifndef K8DEPLOYER_WITH_ZSTD
+        throw runtime_error("zstd compression is not enabled in this build. Use -DWITH_ZSTD=ON");
+#endif
+        return Compression::ZSTD;
+    }
+
+    throw runtime_error("Unknown log compression (use none, gzip or zstd): "s + name);
+}
+
+bool LogSegment::writeAll(const void *data, size_t bytes)
+{
+    auto p = static_cast<const char *>(data);
+    while(bytes) {
+        const auto written = ::write(fd_, p, bytes);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_WARN << "Failed to write to log-file " << path_ << ": " << strerror(errno);
+            return false;
+        }
+        p += written;
+        bytes -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+} // ns
@@ -0,0 +1,394 @@
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <queue>
+#include <regex>
+#include <stdexcept>
+#include <vector>
+
+#include "k8deployer/LogStore.h"
+#include "k8deployer/logging.h"
+
+using namespace std;
+
+namespace k8deployer {
+
+namespace {
+
+constexpr size_t msDigits = 13;
+constexpr size_t readSize = 1024 * 1024;
+
+filesystem::path indexPathOf(const filesystem::path& path)
+{
+    auto p = path;
+    p += ".index";
+    return p;
+}
+
+// Reads the records from the store file(s) for one container log
+class Source {
+public:
+    // `segments` are in time order
+    Source(vector<filesystem::path> segments, string tag)
+        : segments_{move(segments)}, tag_{move(tag)} {
+        assert(!segments_.empty());
+    }
+
+    const string& tag() const noexcept {
+        return tag_;
+    }
+
+    // Open the segment and position that has the last indexed record before `fromMs`
+    bool open(uint64_t fromMs) {
+        for(size_t i = 1; i < segments_.size(); ++i) {
+            ifstream index{indexPathOf(segments_[i])};
+            uint64_t ms = 0, offset = 0;
+            if (!(index >> ms >> offset) || ms >= fromMs) {
+                break;
+            }
+            current_ = i;
+        }
+
+        uint64_t start = 0;
+        {
+            ifstream index{indexPathOf(segments_[current_])};
+            uint64_t ms = 0, offset = 0;
+            while(index >> ms >> offset) {
+                if (ms >= fromMs) {
+                    break;
+                }
+                start = offset;
+            }
+        }
+
+        buffer_.resize(readSize);
+        return openSegment(start);
+    }
+
+    /*! Get the next record.
+     *
+     * `line` is valid until next() is called again.
+     */
+    bool next(uint64_t& ms, string_view& line) {
+        while(true) {
+            if (auto eol = static_cast<const char *>(memchr(buffer_.data() + pos_, '\n', end_ - pos_))) {
+                const string_view record{buffer_.data() + pos_, static_cast<size_t>(eol - buffer_.data()) - pos_ + 1};
+                pos_ += record.size();
+                if (parse(record, ms, line)) {
+                    return true;
+                }
+                continue;
+            }
+
+            if (!fill()) {
+                if (pos_ == end_ && current_ + 1 < segments_.size()) {
+                    // Continue with the next segment
+                    ++current_;
+                    if (!openSegment(0)) {
+                        return false;
+                    }
+                    continue;
+                }
+
+                if (pos_ < end_) {
+                    // The last line is incomplete. The log may still be written to.
+                    const string_view record{buffer_.data() + pos_, end_ - pos_};
+                    pos_ = end_;
+                    return parse(record, ms, line);
+                }
+                return false;
+            }
+        }
+    }
+
+private:
+    bool openSegment(uint64_t start) {
+        const auto& path = segments_[current_];
+        file_.close();
+        file_.clear();
+        file_.open(path, ios_base::in | ios_base::binary);
+        if (!file_) {
+            LOG_WARN << "Failed to open " << path;
+            return false;
+        }
+
+        file_.seekg(static_cast<streamoff>(start));
+        LOG_TRACE << "Reading " << path << " from offset " << start;
+        return true;
+    }
+
+    bool fill() {
+        if (!file_) {
+            return false;
+        }
+
+        // Keep the incomplete line
+        const auto remaining = end_ - pos_;
+        if (remaining == buffer_.size()) {
+            buffer_.resize(buffer_.size() * 2);
+        }
+        memmove(buffer_.data(), buffer_.data() + pos_, remaining);
+        pos_ = 0;
+        end_ = remaining;
+
+        file_.read(buffer_.data() + end_, static_cast<streamsize>(buffer_.size() - end_));
+        const auto bytes = static_cast<size_t>(file_.gcount());
+        end_ += bytes;
+        return bytes > 0;
+    }
+
+    bool parse(string_view record, uint64_t& ms, string_view& line) {
+        if (record.size() <= msDigits || record[msDigits] != ' ') {
+            return false;
+        }
+
+        uint64_t value = 0;
+        for(size_t i = 0; i < msDigits; ++i) {
+            if (!isdigit(static_cast<unsigned char>(record[i]))) {
+                return false;
+            }
+            value = value * 10 + (record[i] - '0');
+        }
+
+        ms = value;
+        line = record.substr(msDigits + 1);
+        return true;
+    }
+
+    const vector<filesystem::path> segments_;
+    size_t current_ = 0;
+    const string tag_;
+    ifstream file_;
+    vector<char> buffer_;
+    size_t pos_ = 0;
+    size_t end_ = 0;
+};
+
+// Plain text is much faster to look for than a regex
+bool isPlainText(const string& pattern) {
+    return pattern.find_first_of(".[]{}()\\*+?^$|") == string::npos;
+}
+
+int parseNumber(string_view text, size_t pos, size_t digits) {
+    int value = 0;
+    for(size_t i = pos; i < pos + digits; ++i) {
+        if (i >= text.size() || !isdigit(static_cast<unsigned char>(text[i]))) {
+            return -1;
+        }
+        value = value * 10 + (text[i] - '0');
+    }
+    return value;
+}
+
+} // anon ns
+
+LogStore::LogStore(filesystem::path root)
+    : root_{move(root)}
+{
+}
+
+size_t LogStore::query(const Query &query, ostream &out) const
+{
+    if (!filesystem::is_directory(root_)) {
+        throw runtime_error("Not a directory: "s + root_.string());
+    }
+
+    const regex sourceFilter{query.source.empty() ? ".*" : query.source, regex::optimize};
+    const bool plainGrep = isPlainText(query.grep);
+    regex grep;
+    if (!plainGrep) {
+        grep = regex{query.grep, regex::optimize};
+    }
+
+    // The store files for each container log. `<pod>.tlog` is before its
+    // segments, like `<pod>.tlog.000001`.
+    map<filesystem::path, map<size_t, filesystem::path>> stores;
+    for(const auto& entry : filesystem::recursive_directory_iterator(root_)) {
+        if (!entry.is_regular_file()) {
+            continue;
+        }
+
+        const auto& path = entry.path();
+        if (path.extension() == ".tlog") {
+            stores[path][0] = path;
+            continue;
+        }
+
+        // A segment
+        const auto number = path.extension().string();
+        if (number.size() > 1 && path.stem().extension() == ".tlog"
+                && all_of(number.begin() + 1, number.end(), [](char ch) {
+                    return isdigit(static_cast<unsigned char>(ch));
+                })) {
+            stores[path.parent_path() / path.stem()][stoull(number.substr(1))] = path;
+        }
+    }
+
+    vector<unique_ptr<Source>> sources;
+    for(auto& [path, files] : stores) {
+        auto tag = filesystem::relative(path, root_).replace_extension().generic_string();
+        if (!regex_search(tag, sourceFilter)) {
+            continue;
+        }
+
+        vector<filesystem::path> segments;
+        for(auto& [_, file] : files) {
+            segments.push_back(move(file));
+        }
+
+        auto source = make_unique<Source>(move(segments), move(tag));
+        if (source->open(query.fromMs)) {
+            sources.push_back(move(source));
+        }
+    }
+
+    LOG_DEBUG << "Querying " << sources.size() << " container logs in " << root_;
+
+    struct Current {
+        uint64_t ms = 0;
+        size_t source = 0;
+        string_view line;
+
+        bool operator > (const Current& other) const noexcept {
+            return ms != other.ms ? ms > other.ms : source > other.source;
+        }
+    };
+
+    priority_queue<Current, vector<Current>, greater<Current>> queue;
+
+    // Queue the next line from the source that is in the time range
+    auto advance = [&](size_t ix) {
+        Current c;
+        c.source = ix;
+        while(sources[ix]->next(c.ms, c.line)) {
+            if (c.ms < query.fromMs) {
+                continue;
+            }
+            if (c.ms > query.toMs) {
+                // The lines are in time order, so there is nothing more to get
+                return;
+            }
+            queue.push(c);
+            return;
+        }
+    };
+
+    for(size_t i = 0; i < sources.size(); ++i) {
+        advance(i);
+    }
+
+    size_t lines = 0;
+    while(!queue.empty()) {
+        const auto c = queue.top();
+        queue.pop();
+
+        auto line = c.line;
+        if (!line.empty() && line.back() == '\n') {
+            line.remove_suffix(1);
+        }
+
+        const bool matches = query.grep.empty()
+                || (plainGrep ? line.find(query.grep) != string_view::npos
+                              : regex_search(line.begin(), line.end(), grep));
+        if (matches) {
+            out << formatTime(c.ms) << ' ' << sources[c.source]->tag() << ' ' << line << '\n';
+            ++lines;
+        }
+
+        advance(c.source);
+    }
+
+    return lines;
+}
+
+filesystem::path LogStore::storePath(const filesystem::path &logPath)
+{
+    auto p = logPath;
+    p.replace_extension(".tlog");
+    return p;
+}
+
+void LogStore::addRecord(uint64_t ms, string_view line, string &out)
+{
+    char prefix[msDigits + 2] = {};
+    snprintf(prefix, sizeof(prefix), "%013llu ", static_cast<unsigned long long>(ms));
+    out.append(prefix, msDigits + 1);
+    out.append(line);
+}
+
+uint64_t LogStore::toMs(string_view time)
+{
+    // 2006-01-02T15:04:05
+    if (time.size() < 19 || time[4] != '-' || time[7] != '-'
+            || (time[10] != 'T' && time[10] != ' ') || time[13] != ':' || time[16] != ':') {
+        return 0;
+    }
+
+    tm t = {};
+    t.tm_year = parseNumber(time, 0, 4) - 1900;
+    t.tm_mon = parseNumber(time, 5, 2) - 1;
+    t.tm_mday = parseNumber(time, 8, 2);
+    t.tm_hour = parseNumber(time, 11, 2);
+    t.tm_min = parseNumber(time, 14, 2);
+    t.tm_sec = parseNumber(time, 17, 2);
+    if (t.tm_year < 70 || t.tm_mon < 0 || t.tm_mday < 0 || t.tm_hour < 0 || t.tm_min < 0 || t.tm_sec < 0) {
+        return 0;
+    }
+
+    int64_t ms = static_cast<int64_t>(timegm(&t)) * 1000;
+
+    size_t pos = 19;
+    if (pos < time.size() && time[pos] == '.') {
+        int64_t scale = 100;
+        for(++pos; pos < time.size() && isdigit(static_cast<unsigned char>(time[pos])); ++pos) {
+            ms += (time[pos] - '0') * scale;
+            scale /= 10;
+        }
+    }
+
+    // Time zone offset, like +02:00
+    if (pos + 6 <= time.size() && (time[pos] == '+' || time[pos] == '-')) {
+        const auto hours = parseNumber(time, pos + 1, 2);
+        const auto minutes = parseNumber(time, pos + 4, 2);
+        if (hours < 0 || minutes < 0) {
+            return 0;
+        }
+        const int64_t offset = (hours * 60 + minutes) * 60 * 1000;
+        ms += time[pos] == '+' ? -offset : offset;
+    }
+
+    return ms > 0 ? static_cast<uint64_t>(ms) : 0;
+}
+
+uint64_t LogStore::parseTime(const string &time)
+{
+    if (!time.empty() && all_of(time.begin(), time.end(), [](char ch) { return isdigit(static_cast<unsigned char>(ch)); })) {
+        return stoull(time);
+    }
+
+    if (const auto ms = toMs(time)) {
+        return ms;
+    }
+
+    throw runtime_error("Invalid time (use RFC3339 or milliseconds since the epoch): "s + time);
+}
+
+string LogStore::formatTime(uint64_t ms)
+{
+    const auto seconds = static_cast<time_t>(ms / 1000);
+    tm t = {};
+    gmtime_r(&seconds, &t);
+
+    char buffer[32] = {};
+    snprintf(buffer, sizeof(buffer), "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ",
+             t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec,
+             static_cast<int>(ms % 1000));
+    return buffer;
+}
+
+} // ns
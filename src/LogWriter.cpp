@@ -0,0 +1,580 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+#include "k8deployer/LogStore.h"
+#include "k8deployer/LogWriter.h"
+#include "k8deployer/logging.h"
+
+using namespace std;
+using namespace chrono_literals;
+
+namespace k8deployer {
+
+namespace {
+
+// We append small pieces to the last chunk in the queue, up to this size
+constexpr size_t chunkSize = 64 * 1024;
+
+// Don't keep more than this many chunks for reuse
+constexpr size_t maxSpare = 64;
+
+// How often we make compressed data readable in the file
+constexpr auto flushInterval = 1s;
+
+uint64_t nowMs() {
+    return chrono::duration_cast<chrono::milliseconds>(
+                chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// The number of a segment, like 3 for `pod.log.000003.gz`. 0 if it has none.
+size_t segmentNumberOf(const string& file, const string& prefix)
+{
+    size_t number = 0;
+    if (file.compare(0, prefix.size(), prefix) == 0) {
+        for(auto i = prefix.size(); i < file.size() && isdigit(static_cast<unsigned char>(file[i])); ++i) {
+            number = number * 10 + (file[i] - '0');
+        }
+    }
+    return number;
+}
+
+} // anon ns
+
+class LogWriter::Stream : public std::enable_shared_from_this<Stream> {
+public:
+    Stream(std::filesystem::path path, bool truncate, bool timeIndexed)
+        : path{move(path)}, timeIndexed{timeIndexed}, truncate{truncate} {}
+
+    ~Stream() {
+        closeSegment();
+    }
+
+    std::filesystem::path indexPath() const {
+        auto p = path;
+        p += ".index";
+        return p;
+    }
+
+    // Complete the current segment, and add it to the index if we use one
+    void closeSegment() {
+        if (!segment) {
+            return;
+        }
+
+        segment->finish();
+        if (indexed) {
+            ofstream index{indexPath(), ios_base::app};
+            index << segment->path().filename().string()
+                  << '\t' << segmentFirst
+                  << '\t' << (offset - segmentFirst)
+                  << '\t' << segmentFirstMs
+                  << '\t' << lastMs
+                  << '\n';
+        }
+
+        LOG_DEBUG << "Closed log-file " << segment->path() << " after "
+                  << (offset - segmentFirst) << " bytes";
+        segment.reset();
+    }
+
+    const std::filesystem::path path;
+    const bool timeIndexed;
+
+    // Protected by LogWriter::mutex_
+    std::vector<std::string> chunks;
+    size_t queued = 0;
+    size_t dropped = 0;
+    bool isReady = false; // In LogWriter::ready_
+    bool closing = false;
+
+    // Only used by the writer thread
+    bool truncate = false;
+    bool failed = false;
+    bool indexed = false;
+    bool unflushed = false;
+    std::unique_ptr<LogSegment> segment;
+    size_t segmentNumber = 0;
+    uint64_t offset = 0; // Uncompressed bytes in the log
+    uint64_t segmentFirst = 0; // Offset to the first byte in the segment
+    uint64_t segmentFirstMs = 0;
+    uint64_t lastMs = 0;
+    chrono::steady_clock::time_point lastFlush;
+    ofstream timeIndex;
+    uint64_t nextTimeIndex = 0; // Offset where we want the next entry
+};
+
+LogWriter::LogWriter(const Options& options)
+    : options_{options}, maxQueued_{max<size_t>(options.maxQueued, chunkSize)}
+{
+    thread_ = thread([this] {
+        run();
+    });
+}
+
+LogWriter::~LogWriter()
+{
+    {
+        lock_guard<mutex> lock{mutex_};
+        done_ = true;
+    }
+
+    cond_.notify_all();
+    thread_.join();
+}
+
+LogWriter::stream_t LogWriter::open(const filesystem::path &path, bool truncate, bool timeIndexed)
+{
+    return make_shared<Stream>(path, truncate, timeIndexed);
+}
+
+bool LogWriter::write(Stream &stream, string_view data)
+{
+    if (data.empty()) {
+        return true;
+    }
+
+    bool notify = false;
+    {
+        lock_guard<mutex> lock{mutex_};
+        // If nothing is queued, we take it even if it's larger than the limit.
+        // Else a WAIT would never end.
+        if (stream.queued && stream.queued + data.size() > maxQueued_) {
+            if (options_.overflow == Overflow::WAIT) {
+                return false;
+            }
+            stream.dropped += data.size();
+            return true;
+        }
+
+        auto append = [&](string_view what) {
+            if (stream.chunks.empty() || stream.chunks.back().size() + what.size() > chunkSize) {
+                if (!spare_.empty()) {
+                    stream.chunks.push_back(move(spare_.back()));
+                    spare_.pop_back();
+                } else {
+                    stream.chunks.emplace_back();
+                    stream.chunks.back().reserve(min(chunkSize, max(what.size(), chunkSize / 16)));
+                }
+            }
+            stream.chunks.back().append(what);
+            stream.queued += what.size();
+        };
+
+        if (stream.dropped) {
+            const auto note = "[k8deployer: dropped "s + to_string(stream.dropped)
+                    + " bytes of log because the disk was too slow]\n";
+            if (stream.timeIndexed) {
+                string record;
+                LogStore::addRecord(nowMs(), note, record);
+                append(record);
+            } else {
+                append("\n"s + note);
+            }
+            stream.dropped = 0;
+        }
+
+        append(data);
+
+        if (!stream.isReady) {
+            stream.isReady = true;
+            notify = ready_.empty();
+            ready_.push_back(stream.shared_from_this());
+        }
+    }
+
+    if (notify) {
+        cond_.notify_one();
+    }
+    return true;
+}
+
+void LogWriter::close(const stream_t &stream)
+{
+    {
+        lock_guard<mutex> lock{mutex_};
+        stream->closing = true;
+        if (!stream->isReady) {
+            stream->isReady = true;
+            ready_.push_back(stream);
+        }
+    }
+
+    cond_.notify_one();
+}
+
+LogWriter::Overflow LogWriter::toOverflow(const string &name)
+{
+    if (name == "wait") {
+        return Overflow::WAIT;
+    }
+
+    if (name == "drop") {
+        return Overflow::DROP;
+    }
+
+    throw runtime_error("Unknown log overflow policy (use wait or drop): "s + name);
+}
+
+void LogWriter::run()
+{
+    vector<stream_t> streams;
+    vector<vector<string>> chunks;
+
+    while(true) {
+        {
+            unique_lock<mutex> lock{mutex_};
+            auto haveWork = [this] {
+                return done_ || !ready_.empty();
+            };
+
+            if (unflushed_.empty()) {
+                cond_.wait(lock, haveWork);
+            } else {
+                cond_.wait_for(lock, flushInterval, haveWork);
+            }
+
+            if (ready_.empty() && done_) {
+                break;
+            }
+
+            swap(streams, ready_);
+            chunks.resize(streams.size());
+            for(size_t i = 0; i < streams.size(); ++i) {
+                auto& s = *streams[i];
+                swap(chunks[i], s.chunks);
+                s.isReady = false;
+            }
+        }
+
+        vector<string> written;
+        for(size_t i = 0; i < streams.size(); ++i) {
+            auto& s = *streams[i];
+            flush(s, chunks[i]);
+
+            bool closing = false;
+            size_t bytes = 0;
+            for(auto& c : chunks[i]) {
+                bytes += c.size();
+                c.clear();
+                written.push_back(move(c));
+            }
+            chunks[i].clear();
+
+            {
+                lock_guard<mutex> lock{mutex_};
+                s.queued -= bytes;
+                closing = s.closing && s.chunks.empty();
+            }
+
+            if (closing) {
+                s.closeSegment();
+                s.unflushed = false;
+            } else if (s.unflushed && s.segment
+                       && find(unflushed_.begin(), unflushed_.end(), streams[i]) == unflushed_.end()) {
+                unflushed_.push_back(streams[i]);
+            }
+        }
+
+        streams.clear();
+
+        // Make compressed data readable in streams that have been quiet for a while
+        const auto now = chrono::steady_clock::now();
+        for(auto it = unflushed_.begin(); it != unflushed_.end();) {
+            auto& s = **it;
+            if (!s.unflushed || !s.segment) {
+                it = unflushed_.erase(it);
+            } else if (now - s.lastFlush >= flushInterval) {
+                s.segment->flush();
+                s.lastFlush = now;
+                s.unflushed = false;
+                it = unflushed_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        {
+            lock_guard<mutex> lock{mutex_};
+            for(auto& c : written) {
+                if (spare_.size() >= maxSpare) {
+                    break;
+                }
+                spare_.push_back(move(c));
+            }
+        }
+
+        // Let the streams fill up a bit before the next batch
+        this_thread::sleep_for(20ms);
+    }
+
+    for(auto& s : unflushed_) {
+        s->closeSegment();
+    }
+    unflushed_.clear();
+}
+
+void LogWriter::flush(Stream &stream, vector<string> &chunks)
+{
+    if (stream.failed || chunks.empty()) {
+        return;
+    }
+
+    vector<iovec> iov;
+    iov.reserve(chunks.size());
+
+    // Write as many chunks as there is room for in the segment, then rotate
+    for(size_t i = 0; i < chunks.size();) {
+        try {
+            if (!stream.segment) {
+                openSegment(stream);
+            } else if (needsRotation(stream)) {
+                stream.closeSegment();
+                openSegment(stream);
+            }
+        } catch(const exception& ex) {
+            LOG_WARN << "Failed to open log-file for " << stream.path << ": " << ex.what();
+            stream.failed = true;
+            return;
+        }
+
+        const auto used = stream.offset - stream.segmentFirst;
+        const auto room = options_.rotateBytes && rotates(stream)
+                ? options_.rotateBytes - min<uint64_t>(options_.rotateBytes, used)
+                : numeric_limits<uint64_t>::max();
+
+        iov.clear();
+        uint64_t bytes = 0;
+        do {
+            if (stream.timeIndexed) {
+                addToTimeIndex(stream, chunks[i], stream.offset + bytes);
+            }
+            iov.push_back({chunks[i].data(), chunks[i].size()});
+            bytes += chunks[i].size();
+            ++i;
+        } while(i < chunks.size() && bytes < room);
+
+        if (!stream.segment->write(iov)) {
+            stream.failed = true;
+            stream.segment.reset();
+            return;
+        }
+
+        stream.offset += bytes;
+        stream.lastMs = nowMs();
+    }
+
+    if (usesSegments(stream) && options_.compression != LogSegment::Compression::NONE) {
+        stream.unflushed = true;
+    }
+}
+
+void LogWriter::openSegment(Stream &stream)
+{
+    if (stream.truncate) {
+        stream.truncate = false;
+
+        // Remove the old log and its segments
+        const auto prefix = stream.path.filename().string() + ".";
+        error_code ec;
+        filesystem::remove(stream.path, ec);
+        if (filesystem::is_directory(stream.path.parent_path())) {
+            for(const auto& entry : filesystem::directory_iterator(stream.path.parent_path())) {
+                const auto name = entry.path().filename().string();
+                if (name.size() > prefix.size() && name.compare(0, prefix.size(), prefix) == 0) {
+                    const auto rest = name.substr(prefix.size());
+                    if (isdigit(static_cast<unsigned char>(rest.front())) || rest == "index" || rest == "gz" || rest == "zst") {
+                        filesystem::remove(entry.path(), ec);
+                    }
+                }
+            }
+        }
+    }
+
+    if (stream.timeIndexed) {
+        openTimeIndexedSegment(stream);
+        return;
+    }
+
+    if (!usesSegments(stream)) {
+        stream.segment = LogSegment::open(stream.path, options_.compression);
+        return;
+    }
+
+    stream.indexed = true;
+    if (stream.segmentNumber == 0) {
+        // Continue after the segments in an existing index.
+        // The oldest segments may have been removed from it.
+        const auto prefix = stream.path.filename().string() + ".";
+        ifstream index{stream.indexPath()};
+        string line;
+        while(getline(index, line)) {
+            string file;
+            uint64_t first = 0, bytes = 0;
+            istringstream cols{line};
+            if (getline(cols, file, '\t') && cols >> first >> bytes) {
+                stream.segmentNumber = max(stream.segmentNumber + 1, segmentNumberOf(file, prefix));
+                stream.offset = first + bytes;
+            }
+        }
+    }
+
+    const auto number = ++stream.segmentNumber;
+    stream.segment = LogSegment::open(segmentPath(stream, number), options_.compression);
+    stream.segmentFirst = stream.offset;
+    stream.segmentFirstMs = nowMs();
+    stream.lastFlush = chrono::steady_clock::now();
+
+    if (options_.keepSegments && number > options_.keepSegments) {
+        removeSegment(stream, number - options_.keepSegments);
+    }
+
+    LOG_TRACE << "Opened log segment " << stream.segment->path();
+}
+
+void LogWriter::openTimeIndexedSegment(Stream &stream)
+{
+    if (!rotates(stream)) {
+        stream.segment = LogSegment::open(stream.path, LogSegment::Compression::NONE);
+        stream.offset = filesystem::file_size(stream.path);
+        stream.nextTimeIndex = stream.offset;
+        stream.timeIndex.open(stream.indexPath(), ios_base::app);
+        return;
+    }
+
+    // Each segment has its own time index, with offsets in that segment
+    if (stream.segmentNumber == 0 && filesystem::is_directory(stream.path.parent_path())) {
+        // Continue after the existing segments
+        const auto prefix = stream.path.filename().string() + ".";
+        for(const auto& entry : filesystem::directory_iterator(stream.path.parent_path())) {
+            stream.segmentNumber = max(stream.segmentNumber,
+                                       segmentNumberOf(entry.path().filename().string(), prefix));
+        }
+    }
+
+    const auto number = ++stream.segmentNumber;
+    const auto path = segmentPath(stream, number);
+    stream.segment = LogSegment::open(path, LogSegment::Compression::NONE);
+    stream.offset = 0;
+    stream.segmentFirst = 0;
+    stream.segmentFirstMs = nowMs();
+    stream.nextTimeIndex = 0;
+
+    auto indexPath = path;
+    indexPath += ".index";
+    stream.timeIndex.close();
+    stream.timeIndex.clear();
+    stream.timeIndex.open(indexPath, ios_base::trunc);
+
+    if (options_.keepSegments && number > options_.keepSegments) {
+        removeSegment(stream, number - options_.keepSegments);
+    }
+
+    LOG_TRACE << "Opened log store segment " << path;
+}
+
+void LogWriter::removeSegment(const Stream &stream, size_t number)
+{
+    const auto path = segmentPath(stream, number);
+    error_code ec;
+    filesystem::remove(path, ec);
+
+    if (stream.timeIndexed) {
+        auto indexPath = path;
+        indexPath += ".index";
+        filesystem::remove(indexPath, ec);
+        LOG_TRACE << "Removed log store segment " << path;
+        return;
+    }
+
+    // Rewrite the index without it, and replace the old index in one step
+    const auto indexPath = stream.indexPath();
+    auto tmpPath = indexPath;
+    tmpPath += ".tmp";
+    const auto prefix = path.filename().string() + '\t';
+    {
+        ifstream in{indexPath};
+        ofstream out{tmpPath, ios_base::trunc};
+        string line;
+        while(getline(in, line)) {
+            if (line.compare(0, prefix.size(), prefix) != 0) {
+                out << line << '\n';
+            }
+        }
+    }
+
+    filesystem::rename(tmpPath, indexPath, ec);
+    if (ec) {
+        LOG_WARN << "Failed to update the index " << indexPath << ": " << ec.message();
+    }
+
+    LOG_TRACE << "Removed log segment " << path;
+}
+
+void LogWriter::addToTimeIndex(Stream &stream, string_view chunk, uint64_t offset)
+{
+    if (offset < stream.nextTimeIndex || chunk.size() < 13) {
+        return;
+    }
+
+    // The chunk starts with a record
+    uint64_t ms = 0;
+    for(size_t i = 0; i < 13; ++i) {
+        if (!isdigit(static_cast<unsigned char>(chunk[i]))) {
+            return;
+        }
+        ms = ms * 10 + (chunk[i] - '0');
+    }
+
+    stream.timeIndex << ms << '\t' << offset << '\n';
+    stream.timeIndex.flush();
+    stream.nextTimeIndex = offset + LogStore::indexInterval;
+}
+
+bool LogWriter::needsRotation(const Stream &stream) const
+{
+    if (!rotates(stream)) {
+        return false;
+    }
+
+    if (options_.rotateBytes && stream.offset - stream.segmentFirst >= options_.rotateBytes) {
+        return true;
+    }
+
+    if (options_.rotateAge.count()) {
+        const auto ageMs = static_cast<uint64_t>(chrono::duration_cast<chrono::milliseconds>(options_.rotateAge).count());
+        return nowMs() - stream.segmentFirstMs >= ageMs;
+    }
+
+    return false;
+}
+
+bool LogWriter::usesSegments(const Stream& stream) const noexcept
+{
+    return !stream.timeIndexed
+            && (options_.compression != LogSegment::Compression::NONE || rotates(stream));
+}
+
+bool LogWriter::rotates(const Stream& /*stream*/) const noexcept
+{
+    return options_.rotateBytes || options_.rotateAge.count();
+}
+
+filesystem::path LogWriter::segmentPath(const Stream &stream, size_t number) const
+{
+    auto p = stream.path;
+    if (rotates(stream)) {
+        char buffer[16] = {};
+        snprintf(buffer, sizeof(buffer), ".%06zu", number);
+        p += buffer;
+    }
+    if (!stream.timeIndexed) {
+        p += LogSegment::extension(options_.compression);
+    }
+    return p;
+}
+
+} // ns
@@ -0,0 +1,390 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+
+#include <boost/asio.hpp>
+
+#include "k8deployer/Metrics.h"
+#include "k8deployer/Profiler.h"
+#include "k8deployer/Tracer.h"
+#include "k8deployer/logging.h"
+
+using namespace std;
+
+namespace k8deployer {
+
+namespace {
+
+Metrics *instance_ = {};
+
+const vector<double> requestBuckets = {0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+const vector<double> componentBuckets = {0.5, 1, 2, 5, 10, 30, 60, 120, 300, 600, 1800};
+
+void appendNumber(string& out, double value)
+{
+    char buffer[32] = {};
+    if (value == floor(value) && fabs(value) < 1e15) {
+        snprintf(buffer, sizeof(buffer), "%.0f", value);
+    } else {
+        snprintf(buffer, sizeof(buffer), "%.9g", value);
+    }
+    out += buffer;
+}
+
+string toLabels(Metrics::labels_t labels)
+{
+    string out;
+    for(const auto& [name, value] : labels) {
+        if (!out.empty()) {
+            out += ',';
+        }
+        out.append(name);
+        out += "=\"";
+        for(const auto ch : value) {
+            switch(ch) {
+            case '\\':
+                out += "\\\\";
+                break;
+            case '"':
+                out += "\\\"";
+                break;
+            case '\n':
+                out += "\\n";
+                break;
+            default:
+                out += ch;
+            }
+        }
+        out += '"';
+    }
+    return out;
+}
+
+} // anon ns
+
+struct Metrics::Family {
+    string_view name;
+    string_view type;
+    string_view help;
+    const vector<double> *buckets = {};
+};
+
+struct Metrics::Server {
+    Server(Metrics& metrics, uint16_t port)
+        : metrics{metrics}
+        , acceptor{ios, {boost::asio::ip::address_v4::loopback(), port}}
+    {
+        accept();
+        thread = std::thread([this] {
+            ios.run();
+        });
+    }
+
+    ~Server() {
+        ios.stop();
+        thread.join();
+    }
+
+    void accept() {
+        auto socket = make_shared<boost::asio::ip::tcp::socket>(ios);
+        acceptor.async_accept(*socket, [this, socket](const boost::system::error_code& ec) {
+            if (ec == boost::asio::error::operation_aborted) {
+                return;
+            }
+            if (ec) {
+                LOG_WARN << "Metrics: Failed to accept a connection: " << ec.message();
+            } else {
+                respond(socket);
+            }
+            accept();
+        });
+    }
+
+    void respond(shared_ptr<boost::asio::ip::tcp::socket> socket) {
+        auto request = make_shared<boost::asio::streambuf>();
+        boost::asio::async_read_until(*socket, *request, "\r\n\r\n",
+                                      [this, socket, request](const boost::system::error_code& ec, size_t) {
+            if (ec) {
+                return;
+            }
+
+            string method, target;
+            istream{request.get()} >> method >> target;
+
+            string status = "200 OK", body;
+            if (method != "GET") {
+                status = "405 Method Not Allowed";
+            } else if (target == "/metrics" || target == "/") {
+                body = metrics.render();
+            } else {
+                status = "404 Not Found";
+            }
+
+            auto reply = make_shared<string>("HTTP/1.1 " + status + "\r\n"
+                    "Content-Type: text/plain; version=0.0.4\r\n"
+                    "Content-Length: " + to_string(body.size()) + "\r\n"
+                    "Connection: close\r\n\r\n" + body);
+
+            boost::asio::async_write(*socket, boost::asio::buffer(*reply),
+                                     [socket, reply](const boost::system::error_code&, size_t) {
+                boost::system::error_code ignored;
+                socket->shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+            });
+        });
+    }
+
+    Metrics& metrics;
+    boost::asio::io_service ios;
+    boost::asio::ip::tcp::acceptor acceptor;
+    std::thread thread;
+};
+
+Metrics::ApiCall::ApiCall(const string &cluster, string_view verb, string_view kind,
+                          string_view component)
+    : metrics_{Metrics::instance()}, tracer_{Tracer::instance()}
+{
+    if (auto profiler = Profiler::instance(); profiler && verb != "GET") {
+        profiler->onWrite(cluster);
+    }
+
+    if (metrics_ || tracer_) {
+        cluster_ = cluster;
+        verb_ = verb;
+        kind_ = kind;
+        track_ = component;
+        started_ = chrono::steady_clock::now();
+    }
+
+    if (metrics_) {
+        metrics_->add("k8deployer_api_requests_in_flight", {{"cluster", cluster_}}, 1);
+    }
+}
+
+Metrics::ApiCall::~ApiCall()
+{
+    record("error");
+}
+
+void Metrics::ApiCall::status(unsigned code)
+{
+    record(to_string(code));
+}
+
+void Metrics::ApiCall::record(string_view status)
+{
+    const auto now = chrono::steady_clock::now();
+    if (tracer_) {
+        tracer_->span(cluster_, track_, traceName_.empty() ? verb_ + " " + kind_ : traceName_,
+                      "http", started_, now, "status "s + string{status});
+        tracer_ = {};
+    }
+
+    if (!metrics_) {
+        return;
+    }
+
+    const auto duration = chrono::duration<double>(now - started_).count();
+    metrics_->add("k8deployer_api_requests_in_flight", {{"cluster", cluster_}}, -1);
+    metrics_->inc("k8deployer_api_requests_total",
+                  {{"cluster", cluster_}, {"verb", verb_}, {"kind", kind_}, {"status", status}});
+    metrics_->observe("k8deployer_api_request_duration_seconds",
+                      {{"cluster", cluster_}, {"verb", verb_}, {"kind", kind_}}, duration);
+
+    // Only once
+    metrics_ = {};
+}
+
+Metrics::Metrics()
+{
+    assert(instance_ == nullptr);
+    instance_ = this;
+}
+
+Metrics::~Metrics()
+{
+    server_.reset();
+    instance_ = nullptr;
+}
+
+Metrics *Metrics::instance() noexcept
+{
+    return instance_;
+}
+
+void Metrics::inc(string_view name, labels_t labels, double value)
+{
+    const auto& f = family(name);
+    assert(f.type == "counter");
+    lock_guard<mutex> lock{mutex_};
+    series(f, labels).value += value;
+}
+
+void Metrics::add(string_view name, labels_t labels, double delta)
+{
+    const auto& f = family(name);
+    assert(f.type == "gauge");
+    lock_guard<mutex> lock{mutex_};
+    series(f, labels).value += delta;
+}
+
+void Metrics::set(string_view name, labels_t labels, double value)
+{
+    const auto& f = family(name);
+    assert(f.type == "gauge");
+    lock_guard<mutex> lock{mutex_};
+    series(f, labels).value = value;
+}
+
+void Metrics::observe(string_view name, labels_t labels, double value)
+{
+    const auto& f = family(name);
+    assert(f.buckets);
+    lock_guard<mutex> lock{mutex_};
+    auto& s = series(f, labels);
+    s.buckets.resize(f.buckets->size());
+    const auto bucket = lower_bound(f.buckets->begin(), f.buckets->end(), value) - f.buckets->begin();
+    if (static_cast<size_t>(bucket) < s.buckets.size()) {
+        ++s.buckets[bucket];
+    }
+    s.sum += value;
+    ++s.count;
+}
+
+string Metrics::render() const
+{
+    string out;
+    lock_guard<mutex> lock{mutex_};
+
+    for(const auto& [name, all] : series_) {
+        const auto& f = family(name);
+        out.append("# HELP ").append(f.name).append(" ").append(f.help).append("\n");
+        out.append("# TYPE ").append(f.name).append(" ").append(f.type).append("\n");
+
+        for(const auto& [labels, s] : all) {
+            if (!f.buckets) {
+                out.append(f.name);
+                if (!labels.empty()) {
+                    out.append("{").append(labels).append("}");
+                }
+                out += ' ';
+                appendNumber(out, s.value);
+                out += '\n';
+                continue;
+            }
+
+            const auto prefix = labels.empty() ? string{"{"} : "{" + labels + ",";
+            uint64_t cumulative = 0;
+            for(size_t i = 0; i < f.buckets->size(); ++i) {
+                cumulative += i < s.buckets.size() ? s.buckets[i] : 0;
+                out.append(f.name).append("_bucket").append(prefix).append("le=\"");
+                appendNumber(out, (*f.buckets)[i]);
+                out.append("\"} ");
+                appendNumber(out, static_cast<double>(cumulative));
+                out += '\n';
+            }
+            out.append(f.name).append("_bucket").append(prefix).append("le=\"+Inf\"} ");
+            appendNumber(out, static_cast<double>(s.count));
+            out += '\n';
+
+            const auto suffix = labels.empty() ? string{} : "{" + labels + "}";
+            out.append(f.name).append("_sum").append(suffix).append(" ");
+            appendNumber(out, s.sum);
+            out += '\n';
+            out.append(f.name).append("_count").append(suffix).append(" ");
+            appendNumber(out, static_cast<double>(s.count));
+            out += '\n';
+        }
+    }
+
+    return out;
+}
+
+void Metrics::writeTextfile(const filesystem::path &path) const
+{
+    auto tmp = path;
+    tmp += ".tmp";
+
+    {
+        ofstream file{tmp, ios_base::out | ios_base::trunc};
+        if (!file) {
+            throw runtime_error("Failed to open metrics file: "s + tmp.string());
+        }
+        file << render();
+        if (!file) {
+            throw runtime_error("Failed to write metrics file: "s + tmp.string());
+        }
+    }
+
+    filesystem::rename(tmp, path);
+    LOG_DEBUG << "Wrote metrics to " << path;
+}
+
+void Metrics::serve(uint16_t port)
+{
+    server_ = make_unique<Server>(*this, port);
+    LOG_INFO << "Serving metrics on http://127.0.0.1:" << port << "/metrics";
+}
+
+string_view Metrics::toVerb(restc_cpp::Request::Type type) noexcept
+{
+    switch(type) {
+    case restc_cpp::Request::Type::GET:
+        return "GET";
+    case restc_cpp::Request::Type::POST:
+        return "POST";
+    case restc_cpp::Request::Type::PUT:
+        return "PUT";
+    case restc_cpp::Request::Type::DELETE:
+        return "DELETE";
+    case restc_cpp::Request::Type::PATCH:
+        return "PATCH";
+    default:
+        return "OTHER";
+    }
+}
+
+const Metrics::Family &Metrics::family(string_view name)
+{
+    static const Family families[] = {
+        {"k8deployer_api_requests_total", "counter",
+         "Requests to the kubernetes API by verb, kind and HTTP status", {}},
+        {"k8deployer_api_request_duration_seconds", "histogram",
+         "Time until the reply from the kubernetes API", &requestBuckets},
+        {"k8deployer_api_requests_in_flight", "gauge",
+         "Requests to the kubernetes API waiting for a reply", {}},
+        {"k8deployer_watch_events_total", "counter",
+         "Events received from watches", {}},
+        {"k8deployer_task_transitions_total", "counter",
+         "Task state changes by the new state", {}},
+        {"k8deployer_probes_total", "counter",
+         "Probes of objects by kind and result", {}},
+        {"k8deployer_component_done_seconds", "histogram",
+         "Time from a component starts executing until it is done", &componentBuckets},
+        {"k8deployer_component_seconds", "gauge",
+         "Time from the component started executing until it was done or failed", {}},
+    };
+
+    for(const auto& f : families) {
+        if (f.name == name) {
+            return f;
+        }
+    }
+
+    throw logic_error("Unknown metric: "s + string{name});
+}
+
+Metrics::Series &Metrics::series(const Family& family, labels_t labels)
+{
+    auto it = series_.find(family.name);
+    if (it == series_.end()) {
+        it = series_.emplace(string{family.name}, map<string, Series>{}).first;
+    }
+
+    return it->second[toLabels(labels)];
+}
+
+} // ns
@@ -99,7 +99,7 @@ void NamespaceComponent::doDeploy(std::weak_ptr<Component::Task> task)
         t->startProbeAfterApply = true;
         t->dontFailIfAlreadyExists = true;
     }
-    sendApply(namespace_, getCreationUrl(), task);
+    sendApplyJson(payload_, getCreationUrl(), task);
 }
 
 void NamespaceComponent::doRemove(std::weak_ptr<Component::Task> task)
@@ -1,3 +1,5 @@
+#include <mutex>
+
 #include "k8deployer/NfsStorage.h"
 #include "k8deployer/logging.h"
 #include "k8deployer/Component.h"
@@ -62,8 +64,13 @@ k8api::PersistentVolume NfsStorage::createNewVolume(const string &storageSize,
               << "Creating directory for NFS mount point: "
               << localPath << " --> " << vs_.server << ':' << nfsPath;
 
+    // Volumes are created from the prepare-threads, and from the clusters
+    // that are prepared at the same time, often below the same parents.
+    static mutex dirMutex;
+    lock_guard<mutex> lock{dirMutex};
     if (!boost::filesystem::is_directory(localPath)) {
-        if (!boost::filesystem::create_directories(localPath, ec)) {
+        if (!boost::filesystem::create_directories(localPath, ec)
+                && !boost::filesystem::is_directory(localPath)) {
             LOG_ERROR << "Failed to create NFS directory: " << localPath << ": " << ec;
             throw runtime_error(ec.message());
         }
@@ -24,7 +24,13 @@ PersistentVolumeComponent::PersistentVolumeComponent(const Component::ptr_t &par
 void PersistentVolumeComponent::prepareDeploy()
 {
     if (auto st = cluster_->getStorage()) {
-        persistentVolume = st->createNewVolume(getArg("pv.capacity", "1Gi"), *this);
+        if (auto previous = cluster_->previousComponent(kind_, name)) {
+            // Keep the volume we already use, even if --randomize-paths is set
+            persistentVolume = previous->persistentVolume;
+            persistentVolume.spec.capacity["storage"] = getArg("pv.capacity", "1Gi");
+        } else {
+            persistentVolume = st->createNewVolume(getArg("pv.capacity", "1Gi"), *this);
+        }
     }
 
     if (configmap.metadata.name.empty()) {
@@ -104,7 +110,7 @@ void PersistentVolumeComponent::doDeploy(std::weak_ptr<Component::Task> task)
     if (auto t = task.lock()) {
         t->startProbeAfterApply = true;
     }
-    sendApply(persistentVolume, getCreationUrl(), task);
+    sendApplyJson(payload_, getCreationUrl(), task);
 }
 
 void PersistentVolumeComponent::doRemove(std::weak_ptr<Component::Task> task)
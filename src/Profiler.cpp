@@ -0,0 +1,161 @@
+#include <cassert>
+#include <ctime>
+#include <iomanip>
+
+#include "k8deployer/AllocationCounter.h"
+#include "k8deployer/Profiler.h"
+#include "k8deployer/logging.h"
+
+using namespace std;
+
+namespace k8deployer {
+
+namespace {
+
+Profiler *instance_ = {};
+
+// The cluster of the closest Scope that named one, in this thread
+thread_local const string *currentCluster_ = {};
+
+double threadCpu()
+{
+    timespec ts = {};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+} // anon ns
+
+Profiler::Scope::Scope(Profiler::Phase phase, const string &cluster)
+    : profiler_{Profiler::instance()}, phase_{phase}
+{
+    if (!profiler_) {
+        return;
+    }
+
+    outerCluster_ = currentCluster_;
+    if (!cluster.empty()) {
+        cluster_ = cluster;
+        currentCluster_ = &cluster_;
+    } else if (currentCluster_) {
+        cluster_ = *currentCluster_;
+    }
+
+    allocations_ = AllocationCounter::thisThread();
+    cpu_ = threadCpu();
+    started_ = chrono::steady_clock::now();
+}
+
+Profiler::Scope::~Scope()
+{
+    if (!profiler_) {
+        return;
+    }
+
+    Stats stats;
+    stats.count = 1;
+    stats.wall = chrono::duration<double>(chrono::steady_clock::now() - started_).count();
+    stats.cpu = threadCpu() - cpu_ + childrenCpu_;
+    stats.allocations = AllocationCounter::thisThread() - allocations_;
+
+    currentCluster_ = outerCluster_;
+    profiler_->add(cluster_, phase_, stats);
+}
+
+Profiler::Profiler()
+{
+    assert(instance_ == nullptr);
+    instance_ = this;
+}
+
+Profiler::~Profiler()
+{
+    instance_ = nullptr;
+}
+
+Profiler *Profiler::instance() noexcept
+{
+    return instance_;
+}
+
+void Profiler::onWrite(const string &cluster)
+{
+    const auto elapsed = chrono::duration<double>(chrono::steady_clock::now() - started_).count();
+
+    lock_guard<mutex> lock{mutex_};
+    auto& c = clusters_[cluster];
+    if (c.firstWrite < 0) {
+        c.firstWrite = elapsed;
+    }
+}
+
+void Profiler::report() const
+{
+    lock_guard<mutex> lock{mutex_};
+
+    ClusterStats all;
+    const auto clusters = clusters_.size() - clusters_.count({});
+    for(const auto& [name, c] : clusters_) {
+        for(size_t i = 0; i < all.phases.size(); ++i) {
+            all.phases[i].count += c.phases[i].count;
+            all.phases[i].wall += c.phases[i].wall;
+            all.phases[i].cpu += c.phases[i].cpu;
+            all.phases[i].allocations += c.phases[i].allocations;
+        }
+        if (c.firstWrite >= 0 && (all.firstWrite < 0 || c.firstWrite > all.firstWrite)) {
+            // The last cluster to get started
+            all.firstWrite = c.firstWrite;
+        }
+    }
+
+    report("All " + to_string(clusters) + " cluster(s)", all, "Last cluster to write to the API started after ");
+    for(const auto& [name, c] : clusters_) {
+        report(name.empty() ? "No cluster" : name, c, "First API write after ");
+    }
+}
+
+string_view Profiler::toString(Profiler::Phase phase) noexcept
+{
+    static constexpr array<string_view, static_cast<size_t>(Phase::COUNT_)> names = {
+        "kubeconfig", "yaml subprocess", "connection setup", "read definitions",
+        "expand variables", "deserialize", "populate tree", "prepare", "prepare tasks",
+        "scan dependencies", "diff"};
+    return names.at(static_cast<size_t>(phase));
+}
+
+void Profiler::add(const string &cluster, Profiler::Phase phase, const Profiler::Stats &stats)
+{
+    lock_guard<mutex> lock{mutex_};
+    auto& s = clusters_[cluster].phases.at(static_cast<size_t>(phase));
+    s.count += stats.count;
+    s.wall += stats.wall;
+    s.cpu += stats.cpu;
+    s.allocations += stats.allocations;
+}
+
+void Profiler::report(const string &title, const Profiler::ClusterStats &stats,
+                      string_view firstWrite) const
+{
+    LOG_INFO << "Profile: " << title << ". Seconds, and heap allocations:";
+    LOG_INFO << "Profile:   " << left << setw(20) << "phase" << right << setw(7) << "count"
+             << setw(10) << "wall" << setw(10) << "cpu" << setw(14) << "allocations";
+
+    for(size_t i = 0; i < stats.phases.size(); ++i) {
+        const auto& s = stats.phases[i];
+        if (!s.count) {
+            continue;
+        }
+
+        LOG_INFO << "Profile:   " << left << setw(20) << toString(static_cast<Phase>(i))
+                 << right << setw(7) << s.count << fixed << setprecision(3)
+                 << setw(10) << s.wall << setw(10) << s.cpu << setw(14)
+                 << (AllocationCounter::enabled() ? to_string(s.allocations) : "-"s);
+    }
+
+    if (stats.firstWrite >= 0) {
+        LOG_INFO << "Profile:   " << firstWrite << fixed << setprecision(3)
+                 << stats.firstWrite << " seconds";
+    }
+}
+
+} // ns
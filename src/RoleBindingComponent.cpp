@@ -70,7 +70,7 @@ void RoleBindingComponent::addRemovementTasks(Component::tasks_t &tasks)
 
 void RoleBindingComponent::doDeploy(std::weak_ptr<Component::Task> task)
 {
-    sendApply(rolebinding, getCreationUrl(), task);
+    sendApplyJson(payload_, getCreationUrl(), task);
 }
 
 void RoleBindingComponent::doRemove(std::weak_ptr<Component::Task> task)
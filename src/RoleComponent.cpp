@@ -70,7 +70,7 @@ void RoleComponent::addRemovementTasks(Component::tasks_t &tasks)
 
 void RoleComponent::doDeploy(std::weak_ptr<Component::Task> task)
 {
-    sendApply(role, getCreationUrl(), task);
+    sendApplyJson(payload_, getCreationUrl(), task);
 }
 
 void RoleComponent::doRemove(std::weak_ptr<Component::Task> task)
@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <iomanip>
+
+#include "k8deployer/RolloutController.h"
+#include "k8deployer/logging.h"
+
+using namespace std;
+
+namespace k8deployer {
+
+RolloutController::RolloutController(const Config &cfg, size_t numClusters)
+    : maxParallel_{cfg.maxParallelClusters}
+    , clusterWave_(numClusters)
+    , started_(numClusters)
+{
+    enabled_ = cfg.maxParallelClusters || cfg.rolloutCanary || cfg.rolloutBatchPercent;
+
+    const size_t canary = min(cfg.rolloutCanary, numClusters);
+    size_t batch = numClusters - canary;
+    if (cfg.rolloutBatchPercent) {
+        if (cfg.rolloutBatchPercent > 100) {
+            throw runtime_error("--rollout-batch-percent must be between 0 and 100");
+        }
+        batch = max<size_t>(1, static_cast<size_t>(
+                                ceil(numClusters * cfg.rolloutBatchPercent / 100.0)));
+    }
+
+    size_t ix = 0;
+    auto addWave = [&](size_t count) {
+        Wave w;
+        for(size_t i = 0; i < count && ix < numClusters; ++i, ++ix) {
+            clusterWave_[ix] = waves_.size();
+            w.clusters.push_back(ix);
+        }
+        if (!w.clusters.empty()) {
+            waves_.push_back(move(w));
+        }
+    };
+
+    if (canary) {
+        addWave(canary);
+    }
+
+    while(ix < numClusters) {
+        addWave(batch);
+    }
+
+    if (enabled_) {
+        LOG_INFO << "Rolling out to " << numClusters << " clusters in "
+                 << waves_.size() << " wave(s)"
+                 << (canary ? " starting with " + to_string(canary) + " canary cluster(s)" : ""s)
+                 << (maxParallel_ ? ", max " + to_string(maxParallel_) + " in parallel." : "."s);
+    }
+}
+
+bool RolloutController::mayStart(size_t clusterIx)
+{
+    if (!enabled_) {
+        return true;
+    }
+
+    advance();
+
+    if (aborted_ || current_ >= waves_.size() || waveOf(clusterIx) != current_) {
+        return false;
+    }
+
+    return maxParallel_ == 0 || running_ < maxParallel_;
+}
+
+void RolloutController::checkDependencies(size_t clusterIx, const std::set<size_t> &dependsOn)
+{
+    if (!enabled_) {
+        return;
+    }
+
+    const auto myWave = waveOf(clusterIx);
+    bool sameWave = false;
+    for(const auto ix : dependsOn) {
+        if (ix >= clusterWave_.size()) {
+            continue; // Reported when the dependency is resolved
+        }
+
+        const auto wave = waveOf(ix);
+        if (wave > myWave) {
+            throw runtime_error{"cluster"s + to_string(clusterIx) + " depends on cluster"
+                                + to_string(ix) + ", which is in rollout wave "
+                                + to_string(wave + 1) + ", after its own wave "
+                                + to_string(myWave + 1)
+                                + ". Clusters can only depend on clusters in the same or earlier waves."};
+        }
+        sameWave |= wave == myWave;
+    }
+
+    if (!sameWave) {
+        return;
+    }
+
+    // A cluster that waits for another cluster in the wave holds its slot.
+    // As long as one slot is left for the others, the wave can complete.
+    auto& wave = waves_.at(myWave);
+    if (maxParallel_ && wave.waiting + 1 >= maxParallel_) {
+        throw runtime_error{"cluster"s + to_string(clusterIx)
+                            + " depends on a cluster in the same rollout wave, and with --max-parallel-clusters="
+                            + to_string(maxParallel_) + " the clusters waiting for other clusters in the wave "
+                            + "could hold all the slots. Raise --max-parallel-clusters, or move the "
+                            + "dependencies to an earlier wave."};
+    }
+    ++wave.waiting;
+}
+
+void RolloutController::onStarted(size_t clusterIx)
+{
+    started_.at(clusterIx) = true;
+    ++running_;
+}
+
+void RolloutController::onDone(size_t clusterIx, bool success)
+{
+    auto& wave = waves_.at(waveOf(clusterIx));
+    if (started_.at(clusterIx)) {
+        assert(running_ > 0);
+        --running_;
+    }
+
+    if (success) {
+        ++wave.done;
+    } else {
+        ++wave.failed;
+    }
+
+    if (wave.isFinished()) {
+        wave.endTime = clock_t::now();
+    }
+
+    advance();
+}
+
+bool RolloutController::isSkipped(size_t clusterIx) const
+{
+    return aborted_ && !waves_.at(waveOf(clusterIx)).started;
+}
+
+void RolloutController::advance()
+{
+    while (current_ < waves_.size()) {
+        auto& wave = waves_[current_];
+
+        if (!wave.started) {
+            wave.started = true;
+            wave.startTime = clock_t::now();
+            LOG_INFO << "Starting rollout wave " << (current_ + 1) << " of "
+                     << waves_.size() << " with " << wave.clusters.size() << " cluster(s)";
+        }
+
+        if (!wave.isFinished()) {
+            return;
+        }
+
+        if (wave.failed) {
+            LOG_ERROR << "Rollout wave " << (current_ + 1) << " had " << wave.failed
+                      << " failed cluster(s). Aborting the rollout.";
+            aborted_ = true;
+            current_ = waves_.size();
+            return;
+        }
+
+        ++current_;
+    }
+}
+
+size_t RolloutController::waveOf(size_t clusterIx) const
+{
+    return clusterWave_.at(clusterIx);
+}
+
+void RolloutController::report() const
+{
+    if (!enabled_) {
+        return;
+    }
+
+    size_t done = 0;
+    for(size_t i = 0; i < waves_.size(); ++i) {
+        const auto& w = waves_[i];
+        done += w.done;
+        if (!w.started) {
+            LOG_INFO << "Rollout wave " << (i + 1) << ": " << w.clusters.size()
+                     << " cluster(s) skipped";
+            continue;
+        }
+
+        const auto end = w.isFinished() ? w.endTime : clock_t::now();
+        LOG_INFO << "Rollout wave " << (i + 1) << ": " << w.done << " of "
+                 << w.clusters.size() << " cluster(s) done, " << w.failed << " failed, in "
+                 << fixed << setprecision(3)
+                 << chrono::duration<double>(end - w.startTime).count() << " seconds";
+    }
+
+    const auto minutes = chrono::duration<double>(clock_t::now() - startTime_).count() / 60.0;
+    LOG_INFO << "Rollout throughput: " << fixed << setprecision(2)
+             << (minutes > 0 ? done / minutes : 0.0) << " clusters/minute";
+}
+
+} // ns
@@ -53,7 +53,7 @@ void SecretComponent::prepareDeploy()
             type = Type::DHCRED;
         }
 
-        if (auto dockerSecret = getArg("imagePullSecrets.fromDockerLogin")
+        if (auto dockerSecret = getArg(Atom::IMAGE_PULL_SECRETS_FROM_DOCKER_LOGIN)
                 ; dockerSecret && (type == Type::DHCRED || type == Type::UNKNOWN)) {
             fromFile_ = *dockerSecret;
             if (!filesystem::is_regular_file(fromFile_)) {
@@ -66,7 +66,7 @@ void SecretComponent::prepareDeploy()
             secret->data[".dockerconfigjson"] = Base64Encode(slurp(fromFile_));
             secret->type = "kubernetes.io/dockerconfigjson";
 
-        } else if (auto tlsSecret = getArgAsKv(getArg("tlsSecret", {}))
+        } else if (auto tlsSecret = getArgAsKv(getArg(Atom::TLSSECRET, {}))
                    ; !tlsSecret.empty() && (type == Type::TLS || type == Type::UNKNOWN)) {
             if (tlsSecret.find("key") == tlsSecret.end()) {
                 LOG_ERROR << "tlsSecret: Missing `key=` entry for secret " << name;
@@ -129,10 +129,7 @@ void SecretComponent::addRemovementTasks(Component::tasks_t &tasks)
 
 void SecretComponent::doDeploy(std::weak_ptr<Component::Task> task)
 {
-    auto url = cluster_->getUrl()
-            + "/api/v1/namespaces/"
-            + getNamespace()
-            + "/secrets";
+    const auto url = getCreationUrl();
 
     client().Process([this, url, task](Context& ctx) {
 
@@ -141,12 +138,10 @@ void SecretComponent::doDeploy(std::weak_ptr<Component::Task> task)
                   << secret->metadata.name;
 
         assert(secret);
-        LOG_TRACE << "Payload: " << toJson(*secret);
+        LOG_TRACE << "Payload: " << payload_;
 
         try {
-            auto reply = RequestBuilder{ctx}.Post(url)
-               .Data(secret, jsonFieldMappings())
-               .Execute();
+            auto reply = sendCreate(ctx, url, payload_);
 
             LOG_DEBUG << logName()
                   << "Applying gave response: "
@@ -236,4 +231,14 @@ void SecretComponent::doRemove(std::weak_ptr<Component::Task> task)
     });
 }
 
+string SecretComponent::getCreationUrl() const
+{
+    const auto url = cluster_->getUrl()
+            + "/api/v1/namespaces/"
+            + getNamespace()
+            + "/secrets";
+
+    return url;
+}
+
 } // ns
@@ -70,7 +70,7 @@ void ServiceAccountComponent::addRemovementTasks(Component::tasks_t &tasks)
 
 void ServiceAccountComponent::doDeploy(std::weak_ptr<Component::Task> task)
 {
-    sendApply(serviceaccount, getCreationUrl(), task);
+    sendApplyJson(payload_, getCreationUrl(), task);
 }
 
 void ServiceAccountComponent::doRemove(std::weak_ptr<Component::Task> task)
@@ -27,7 +27,7 @@ void ServiceComponent::prepareDeploy()
 
     service.metadata.labels.try_emplace(selector.first, selector.second);
     service.spec.selector.try_emplace(selector.first, selector.second);
-    service.spec.type = getArg("service.type", service.spec.type);
+    service.spec.type = getArg(Atom::SERVICE_TYPE, service.spec.type);
 
 //    if (service.spec.type.empty()) {
 //        if (getIntArg("service.nodePort", 0) > 0 && getArg("service.type", "").empty()) {
@@ -42,7 +42,7 @@ void ServiceComponent::prepareDeploy()
             if (service.spec.ports.empty()) {
 
                 // This should be the same port spec used to construct the container
-                auto all_ports = parsePorts(getArg("port", ""));
+                const auto& all_ports = parsedArgs_.ports;
 
                 // Try to use the known ports from all the containers in the pod
                 size_t cnt = 0;
@@ -62,7 +62,7 @@ void ServiceComponent::prepareDeploy()
                             sport.targetPort = pi->getName();
                             if (pi->nodePort) {
                               sport.nodePort = *pi->nodePort;
-                              if (!getArg("service.type")) {
+                              if (!getArg(Atom::SERVICE_TYPE)) {
                                   service.spec.type  = "NodePort";
                               }
                             }
@@ -144,10 +144,7 @@ void ServiceComponent::addRemovementTasks(Component::tasks_t &tasks)
 
 void ServiceComponent::doDeploy(std::weak_ptr<Component::Task> task)
 {
-    auto url = cluster_->getUrl()
-            + "/api/v1/namespaces/"
-            + getNamespace()
-            + "/services";
+    const auto url = getCreationUrl();
 
     client().Process([this, url, task](Context& ctx) {
 
@@ -155,12 +152,10 @@ void ServiceComponent::doDeploy(std::weak_ptr<Component::Task> task)
                   << "Sending Service "
                   << service.metadata.name;
 
-        LOG_TRACE << "Payload: " << toJson(service);
+        LOG_TRACE << "Payload: " << payload_;
 
         try {
-            auto reply = RequestBuilder{ctx}.Post(url)
-               .Data(service, jsonFieldMappings())
-               .Execute();
+            auto reply = sendCreate(ctx, url, payload_);
 
             LOG_DEBUG << logName()
                   << "Applying gave response: "
@@ -251,5 +246,14 @@ void ServiceComponent::doRemove(std::weak_ptr<Component::Task> task)
     });
 }
 
+string ServiceComponent::getCreationUrl() const
+{
+    const auto url = cluster_->getUrl()
+            + "/api/v1/namespaces/"
+            + getNamespace()
+            + "/services";
+
+    return url;
+}
 
 } // ns
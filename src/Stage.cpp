@@ -0,0 +1,74 @@
+#include <stdexcept>
+
+#include "k8deployer/Stage.h"
+
+using namespace std;
+
+namespace k8deployer {
+
+void Stage::setReady()
+{
+    complete({});
+}
+
+void Stage::setFailed(exception_ptr ex)
+{
+    complete(ex ? ex : make_exception_ptr(runtime_error{"Stage failed"}));
+}
+
+bool Stage::isDone() const
+{
+    lock_guard<mutex> lock{mutex_};
+    return result_.has_value();
+}
+
+bool Stage::isReady() const
+{
+    lock_guard<mutex> lock{mutex_};
+    return result_ && !*result_;
+}
+
+void Stage::onDone(cb_t fn)
+{
+    exception_ptr result;
+    {
+        lock_guard<mutex> lock{mutex_};
+        if (!result_) {
+            callbacks_.emplace_back(move(fn));
+            return;
+        }
+        result = *result_;
+    }
+
+    fn(result);
+}
+
+void Stage::wait()
+{
+    unique_lock<mutex> lock{mutex_};
+    cond_.wait(lock, [this] { return result_.has_value(); });
+    if (*result_) {
+        rethrow_exception(*result_);
+    }
+}
+
+void Stage::complete(exception_ptr ex)
+{
+    decltype(callbacks_) callbacks;
+    {
+        lock_guard<mutex> lock{mutex_};
+        if (result_) {
+            return; // Only the first result counts
+        }
+        result_ = ex;
+        callbacks = move(callbacks_);
+    }
+
+    cond_.notify_all();
+
+    for(auto& cb : callbacks) {
+        cb(ex);
+    }
+}
+
+} // ns
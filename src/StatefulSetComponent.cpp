@@ -97,8 +97,8 @@ void StatefulSetComponent::buildDependencies()
 {
     DeploymentComponent::buildDependencies();
 
-    if (auto replicas = getArg("replicas")) {
-        getSpec()->replicas = stoull(*replicas);
+    if (auto replicas = parsedArgs_.replicas) {
+        getSpec()->replicas = *replicas;
     }
 
     if (const auto svc = getFirstKindAmongChildren(Kind::SERVICE)) {
@@ -149,6 +149,8 @@ void StatefulSetComponent::buildDependencies()
         pv.spec.storageClassName = Engine::config().pvcStorageClassName;
         pv.spec.resources.emplace();
         pv.spec.resources->requests["storage"] = storageDef.capacity;
+        // Lets --fast-teardown find the claims made from the template
+        pv.metadata.labels.try_emplace(Atom{Atom::K8DEP_DEPLOYMENT}.str(), getRoot().name);
 
 
         statefulSet.spec->volumeClaimTemplates.push_back(pv);
@@ -163,7 +165,7 @@ void StatefulSetComponent::buildDependencies()
 
 void StatefulSetComponent::doDeploy(std::weak_ptr<Component::Task> task)
 {
-    sendApply(statefulSet, getCreationUrl(), task);
+    sendApplyJson(payload_, getCreationUrl(), task);
 }
 
 void StatefulSetComponent::doRemove(std::weak_ptr<Component::Task> task)
@@ -0,0 +1,150 @@
+#include <cassert>
+#include <cstdio>
+#include <stdexcept>
+
+#include "k8deployer/Tracer.h"
+#include "k8deployer/logging.h"
+
+using namespace std;
+
+namespace k8deployer {
+
+namespace {
+
+Tracer *instance_ = {};
+
+void appendJson(string& out, string_view text)
+{
+    out += '"';
+    for(const auto ch : text) {
+        switch(ch) {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            if (static_cast<unsigned char>(ch) < 0x20) {
+                char buffer[8] = {};
+                snprintf(buffer, sizeof(buffer), "\\u%04x", static_cast<unsigned>(ch));
+                out += buffer;
+            } else {
+                out += ch;
+            }
+        }
+    }
+    out += '"';
+}
+
+string metadata(string_view what, int pid, int tid, string_view name)
+{
+    string event = "{\"ph\":\"M\",\"name\":\"";
+    event.append(what);
+    event += "\",\"pid\":" + to_string(pid) + ",\"tid\":" + to_string(tid) + ",\"args\":{\"name\":";
+    appendJson(event, name);
+    event += "}}";
+    return event;
+}
+
+} // anon ns
+
+Tracer::Tracer(const filesystem::path &path)
+    : file_{path, ios_base::out | ios_base::trunc}
+{
+    if (!file_) {
+        throw runtime_error("Failed to open trace file: "s + path.string());
+    }
+
+    file_ << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+    assert(instance_ == nullptr);
+    instance_ = this;
+    LOG_INFO << "Writing trace to " << path;
+}
+
+Tracer::~Tracer()
+{
+    instance_ = nullptr;
+    file_ << "\n]}\n";
+}
+
+Tracer *Tracer::instance() noexcept
+{
+    return instance_;
+}
+
+void Tracer::span(const string &cluster, const string &track, string_view name,
+                  string_view category, clock_t::time_point start, clock_t::time_point end,
+                  string_view detail)
+{
+    const auto startUs = toUs(start);
+    const auto endUs = max(toUs(end), startUs);
+
+    string event = "{\"ph\":\"X\",\"name\":";
+    appendJson(event, name);
+    event += ",\"cat\":";
+    appendJson(event, category);
+    event += ",\"ts\":" + to_string(startUs) + ",\"dur\":" + to_string(endUs - startUs);
+
+    if (!detail.empty()) {
+        event += ",\"args\":{\"detail\":";
+        appendJson(event, detail);
+        event += '}';
+    }
+
+    lock_guard<mutex> lock{mutex_};
+    const auto [pid, tid] = ids(cluster, track);
+    event += ",\"pid\":" + to_string(pid) + ",\"tid\":" + to_string(tid) + "}";
+    write(event);
+}
+
+pair<int, int> Tracer::ids(const string &cluster, const string &track)
+{
+    auto cit = clusters_.find(cluster);
+    if (cit == clusters_.end()) {
+        const auto pid = static_cast<int>(clusters_.size()) + 1;
+        cit = clusters_.emplace(cluster, pid).first;
+        write(metadata("process_name", pid, 0, cluster));
+        write(metadata("thread_name", pid, 0, "cluster"));
+    }
+
+    const auto pid = cit->second;
+    if (track.empty()) {
+        return {pid, 0};
+    }
+
+    auto tit = tracks_.find({pid, track});
+    if (tit == tracks_.end()) {
+        const auto tid = static_cast<int>(tracks_.size()) + 1;
+        tit = tracks_.emplace(make_pair(pid, track), tid).first;
+        write(metadata("thread_name", pid, tid, track));
+    }
+
+    return {pid, tit->second};
+}
+
+void Tracer::write(const string &event)
+{
+    if (!first_) {
+        file_ << ",\n";
+    }
+    first_ = false;
+    file_ << event;
+}
+
+uint64_t Tracer::toUs(clock_t::time_point when) const
+{
+    if (when <= started_) {
+        return 0;
+    }
+    return static_cast<uint64_t>(chrono::duration_cast<chrono::microseconds>(when - started_).count());
+}
+
+} // ns
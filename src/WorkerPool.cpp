@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+#include "k8deployer/WorkerPool.h"
+#include "k8deployer/logging.h"
+
+using namespace std;
+
+namespace k8deployer {
+
+WorkerPool::WorkerPool(size_t numThreads)
+{
+    if (numThreads == 0) {
+        numThreads = max<size_t>(thread::hardware_concurrency(), 1);
+    }
+
+    LOG_DEBUG << "Starting " << numThreads << " worker threads";
+
+    for(size_t i = 0; i < numThreads; ++i) {
+        threads_.emplace_back([this] {
+            run();
+        });
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        lock_guard<mutex> lock{mutex_};
+        done_ = true;
+    }
+
+    cond_.notify_all();
+
+    for(auto& t : threads_) {
+        t.join();
+    }
+}
+
+void WorkerPool::parallelFor(size_t count, const std::function<void (size_t)>& fn)
+{
+    if (count == 0) {
+        return;
+    }
+
+    // Shared with the workers, as a worker may pick up a job
+    // after all the items are done and we have returned.
+    struct State {
+        State(size_t count, const std::function<void (size_t)> *fn)
+            : count{count}, fn{fn}, errors(count) {}
+
+        const size_t count;
+        const std::function<void (size_t)> *fn; // Only valid while items remain
+        std::atomic_size_t next{0};
+        size_t completed = 0;
+        std::vector<exception_ptr> errors;
+        std::mutex mutex;
+        std::condition_variable cond;
+
+        void runItems() {
+            for(size_t ix = next++; ix < count; ix = next++) {
+                exception_ptr err;
+                try {
+                    (*fn)(ix);
+                } catch(...) {
+                    err = current_exception();
+                }
+
+                lock_guard<std::mutex> lock{mutex};
+                errors[ix] = err;
+                if (++completed == count) {
+                    cond.notify_all();
+                }
+            }
+        }
+    };
+
+    auto state = make_shared<State>(count, &fn);
+
+    const auto helpers = min(count - 1, threads_.size());
+    for(size_t i = 0; i < helpers; ++i) {
+        post([state] {
+            state->runItems();
+        });
+    }
+
+    state->runItems();
+
+    {
+        unique_lock<mutex> lock{state->mutex};
+        state->cond.wait(lock, [&state] {
+            return state->completed == state->count;
+        });
+    }
+
+    for(const auto& err : state->errors) {
+        if (err) {
+            rethrow_exception(err);
+        }
+    }
+}
+
+void WorkerPool::post(std::function<void ()> job)
+{
+    {
+        lock_guard<mutex> lock{mutex_};
+        queue_.push_back(move(job));
+    }
+    cond_.notify_one();
+}
+
+void WorkerPool::run()
+{
+    while(true) {
+        std::function<void ()> job;
+        {
+            unique_lock<mutex> lock{mutex_};
+            cond_.wait(lock, [this] {
+                return done_ || !queue_.empty();
+            });
+
+            if (queue_.empty()) {
+                return; // done
+            }
+
+            job = move(queue_.front());
+            queue_.pop_front();
+        }
+
+        try {
+            job();
+        } catch(const exception& ex) {
+            LOG_ERROR << "Caught exception in worker thread: " << ex.what();
+        }
+    }
+}
+
+} // ns
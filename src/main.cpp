@@ -6,6 +6,7 @@
 #include "k8deployer/Config.h"
 #include "k8deployer/Engine.h"
 #include "k8deployer/Component.h"
+#include "k8deployer/LogStore.h"
 
 using namespace std;
 using namespace k8deployer;
@@ -55,7 +56,7 @@ int main(int argc, char* argv[]) {
                  "Log-level to use; one of 'info', 'debug', 'trace'")
             ("command,c",
                  po::value<string>(&config.command)->default_value(config.command),
-                 "Comand; one of: 'deploy', 'delete', 'depends'")
+                 "Comand; one of: 'deploy', 'delete', 'depends', 'render', 'watch', 'logs'")
             ("storage,s",
                  po::value<string>(&config.storageEngine)->default_value(config.storageEngine),
                  "Storage engine for managed volumes")
@@ -110,9 +111,160 @@ int main(int argc, char* argv[]) {
             ("wipe-log-dir",
                  po::value<bool>(&config.wipeLogDir)->default_value(config.wipeLogDir),
                  "Delete all files and subdirectories in the log-dir before logging starts.")
+            ("log-queue-size",
+                 po::value<size_t>(&config.logQueueSize)->default_value(config.logQueueSize),
+                 "Max bytes of container log data waiting to be written to disk, for each container.")
+            ("log-overflow",
+                 po::value<string>(&config.logOverflow)->default_value(config.logOverflow),
+                 "What to do when the queue for a container log is full: 'wait' stops reading "
+                 "the log from the cluster until there is room, 'drop' discards the data and "
+                 "writes a note about it in the log-file.")
+            ("log-compression",
+                 po::value<string>(&config.logCompression)->default_value(config.logCompression),
+                 "Compress the container logs while they are written: none, gzip or zstd. "
+                 "zstd requires a build with -DWITH_ZSTD=ON.")
+            ("log-rotate-size",
+                 po::value<size_t>(&config.logRotateSize)->default_value(config.logRotateSize),
+                 "Start a new segment of a container log after this many MB of log. 0 to not rotate by size. "
+                 "The segments are listed in <log>.index with their uncompressed offsets.")
+            ("log-rotate-seconds",
+                 po::value<size_t>(&config.logRotateSeconds)->default_value(config.logRotateSeconds),
+                 "Start a new segment of a container log after this many seconds. 0 to not rotate by age.")
+            ("log-keep-segments",
+                 po::value<size_t>(&config.logKeepSegments)->default_value(config.logKeepSegments),
+                 "Delete the oldest segments of a rotated container log, so that at most this "
+                 "many remain. 0 keeps all.")
+            ("log-store",
+                 po::value<bool>(&config.logStore)->default_value(config.logStore),
+                 "Also write the container logs with the time of each line to <log>.tlog, "
+                 "with a sparse time index, so they can be queried with the logs command. "
+                 "It is rotated like the logs, and is only limited by --log-keep-segments.")
+            ("logs-since",
+                 po::value<string>(&config.logsSince)->default_value(config.logsSince),
+                 "With the logs command, only show lines logged at or after this time. "
+                 "RFC3339, like 2021-03-04T05:06:07Z, or milliseconds since the epoch.")
+            ("logs-until",
+                 po::value<string>(&config.logsUntil)->default_value(config.logsUntil),
+                 "With the logs command, only show lines logged at or before this time.")
+            ("logs-source",
+                 po::value<string>(&config.logsSource)->default_value(config.logsSource),
+                 "With the logs command, only show lines from containers where "
+                 "cluster/namespace/pod[_container] matches this regex. Pods are named "
+                 "after their components, so this can be used to select components.")
+            ("logs-grep",
+                 po::value<string>(&config.logsGrep)->default_value(config.logsGrep),
+                 "With the logs command, only show lines matching this regex.")
             ("log-viewer",
                  po::value<string>(&config.logViewer)->default_value(config.logViewer),
-                 "If specified, call this command with the log-file patch each time a log-file is opened.")
+                 "If specified, call this command with the log-file patch each time a log-file is opened. "
+                 "Can not be used with compressed or rotated logs, as they are written to segments.")
+            ("cluster-dependency-timeout",
+                 po::value<size_t>(&config.clusterDependencyTimeout)->default_value(config.clusterDependencyTimeout),
+                 "Seconds to wait for another cluster to reach a stage we depend on "
+                 "(like having its variables or components ready) while preparing. 0 to wait forever.")
+            ("sync-start",
+                 po::value<bool>(&config.syncStart)->default_value(config.syncStart),
+                 "Let all the clusters complete prepare before any of them start to execute, "
+                 "and complete execute before any start on pending work. "
+                 "By default, each cluster moves on as soon as it's ready.")
+            ("fleet",
+                 po::value<bool>(&config.fleetMode)->default_value(config.fleetMode),
+                 "Fleet mode. Let all the clusters share a fixed pool of io-threads, "
+                 "in stead of using one or more threads for each cluster. "
+                 "Use this when deploying to a large number of clusters. "
+                 "The definitions are read (and yaml converted) on --fleet-threads "
+                 "worker threads. Creating and preparing the components still runs "
+                 "on the shared io-threads, and delays the other clusters on that thread.")
+            ("fleet-threads",
+                 po::value<size_t>(&config.fleetThreads)->default_value(config.fleetThreads),
+                 "Number of io-threads in fleet mode, and of threads to read the definitions. "
+                 "0 uses one thread per core.")
+            ("max-parallel-clusters",
+                 po::value<size_t>(&config.maxParallelClusters)->default_value(config.maxParallelClusters),
+                 "Max number of clusters to execute at the same time. 0 is unlimited. "
+                 "The clusters that depend on other clusters in the same wave must leave "
+                 "at least one slot for the others, or they fail when they are prepared.")
+            ("rollout-canary",
+                 po::value<size_t>(&config.rolloutCanary)->default_value(config.rolloutCanary),
+                 "Execute the first N clusters as a canary wave. The other clusters don't start "
+                 "before all the canary clusters are done.")
+            ("rollout-batch-percent",
+                 po::value<size_t>(&config.rolloutBatchPercent)->default_value(config.rolloutBatchPercent),
+                 "Execute the (remaining) clusters in waves of this percentage of the clusters. "
+                 "A wave starts when the previous one is done. If a cluster fails, the rollout "
+                 "is aborted. Clusters can only depend on clusters in the same or earlier waves.")
+            ("prepare-threads",
+                 po::value<size_t>(&config.prepareThreads)->default_value(config.prepareThreads),
+                 "Number of threads used to prepare the components. The children of a "
+                 "component are prepared in parallel, after the component itself. 0 uses one "
+                 "thread per core, 1 prepares each cluster sequentially.")
+            ("render-only",
+                 po::value<string>(&config.renderOnly)->default_value(config.renderOnly),
+                 "Output directory for the render command, which use 'rendered' if it's "
+                 "not set. Each cluster get its own sub-directory. With the deploy command, "
+                 "this is an alias for the render command.")
+            ("journal-dir",
+                 po::value<string>(&config.journalDir)->default_value(config.journalDir),
+                 "Keep a journal of the state changes for all the tasks in this directory, "
+                 "so that an interrupted deployment can be resumed.")
+            ("resume",
+                 po::value<bool>(&config.resume)->default_value(config.resume),
+                 "Resume an interrupted deployment from the journal in --journal-dir. "
+                 "Tasks that are done in the journal are skipped if their objects "
+                 "still exist in the cluster.")
+            ("prune",
+                 po::value<bool>(&config.prune)->default_value(config.prune),
+                 "With the watch command, delete the objects for the components that are "
+                 "removed from the definitions. Without it, they are only reported. Note that "
+                 "removing a namespace deletes everything in it.")
+            ("fast-teardown",
+                 po::value<bool>(&config.fastTeardown)->default_value(config.fastTeardown),
+                 "With the delete command, delete everything labeled with the deployment "
+                 "using one request for each kind and namespace, with foreground propagation, "
+                 "in stead of deleting the objects one by one. DNS names provisioned for "
+                 "ingresses are still deleted one by one.")
+            ("delete-timeout",
+                 po::value<size_t>(&config.deleteTimeout)->default_value(config.deleteTimeout),
+                 "Seconds to wait for the deleted objects to be gone, by the delete tasks "
+                 "or with --fast-teardown. The delete fails if they remain. 0 to wait forever.")
+            ("metrics-port",
+                 po::value<unsigned>(&config.metricsPort)->default_value(config.metricsPort),
+                 "Serve Prometheus metrics about the run on http://127.0.0.1:<port>/metrics. "
+                 "0 disables it.")
+            ("metrics-file",
+                 po::value<string>(&config.metricsFile)->default_value(config.metricsFile),
+                 "Write the Prometheus metrics to this file when the run is done, "
+                 "for the textfile collector in node-exporter.")
+            ("trace-file",
+                 po::value<string>(&config.traceFile)->default_value(config.traceFile),
+                 "Write a timeline of the run to this file in the Trace Event Format, "
+                 "with a track for each cluster, component and task, and spans for their "
+                 "states and the API requests. Open it in ui.perfetto.dev or chrome://tracing.")
+            ("critical-path",
+                 po::value<bool>(&config.criticalPath)->default_value(config.criticalPath),
+                 "When a deployment is done, log the chain of components that bounded its duration, "
+                 "with the slack of each component and the time spent in delay timers and "
+                 "waiting for probes, and write it as a DOT graph to <cluster>-critical-path.dot.")
+            ("history-db",
+                 po::value<string>(&config.historyDb)->default_value(config.historyDb),
+                 "Keep the durations of the components from each deployment in this directory. "
+                 "They are used to start the longest chains first with --max-concurrent-tasks, "
+                 "and the depends command uses them to estimate the duration and the critical path.")
+            ("max-concurrent-tasks",
+                 po::value<size_t>(&config.maxConcurrentTasks)->default_value(config.maxConcurrentTasks),
+                 "Max tasks that are executing or waiting for their objects to become ready "
+                 "in each cluster. 0 is unlimited.")
+            ("profile",
+                 po::value<bool>(&config.profile)->default_value(config.profile),
+                 "When the run is done, log the wall time, CPU time and heap allocations "
+                 "for loading the kubeconfigs, setting up the connections, reading and "
+                 "expanding the definitions, and preparing the components, for all the "
+                 "clusters and for each cluster.")
+            ("virtual-clusters",
+                 po::value<size_t>(&config.virtualClusters)->default_value(config.virtualClusters),
+                 "With the render command, render for this many virtual clusters, "
+                 "named virtual0, virtual1 ..., in stead of the kubeconfigs. "
+                 "Variables can be set with --variables.")
             ("web-browser,b",
                  po::value<string>(&config.webBrowser)->default_value(config.webBrowser),
                  "If specified, calls this command with the value of 'openInBrowser' "
@@ -165,6 +317,22 @@ int main(int argc, char* argv[]) {
         logfault::LogManager::Instance().AddHandler(
                     make_unique<logfault::StreamHandler>(clog, llevel));
 
+        if (!config.logViewer.empty() && (config.logCompression != "none"
+                                          || config.logRotateSize || config.logRotateSeconds)) {
+            // The viewer would get <log>, that is not written then
+            LOG_ERROR << "--log-viewer can not be used with --log-compression, "
+                      << "--log-rotate-size or --log-rotate-seconds";
+            return -1;
+        }
+
+        if (config.command == "deploy" && !config.renderOnly.empty()) {
+            config.command = "render";
+        }
+
+        if (config.command == "render" && config.renderOnly.empty()) {
+            config.renderOnly = "rendered";
+        }
+
         if (config.kubeconfigs.empty()) {
             config.kubeconfigs.push_back(""); // Use the default kubeconfig, whatever that is
         }
@@ -172,6 +340,32 @@ int main(int argc, char* argv[]) {
         LOG_INFO << filesystem::path(argv[0]).stem().string() << ' ' << K8DEPLOYER_VERSION  ". Log level: " << log_level;
     }
 
+    if (config.command == "logs") {
+        // Query the log store from a previous deployment
+        try {
+            if (config.logDir.empty()) {
+                throw runtime_error("The logs command requires --log-dir");
+            }
+
+            LogStore::Query query;
+            if (!config.logsSince.empty()) {
+                query.fromMs = LogStore::parseTime(config.logsSince);
+            }
+            if (!config.logsUntil.empty()) {
+                query.toMs = LogStore::parseTime(config.logsUntil);
+            }
+            query.source = config.logsSource;
+            query.grep = config.logsGrep;
+
+            const auto lines = LogStore{config.logDir}.query(query, cout);
+            LOG_DEBUG << "Found " << lines << " lines.";
+        } catch (const exception& ex) {
+            LOG_ERROR << "Failed to query the logs: " << ex.what();
+            return -1;
+        }
+        return 0;
+    }
+
     try {
         Engine engine{config};
         engine.run();